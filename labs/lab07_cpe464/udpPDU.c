@@ -4,6 +4,7 @@
 int createPDU(uint8_t pduBuff[], uint32_t seqNum, uint8_t flag, uint8_t *payload, int payloadLen) {
 
     uint16_t pduBuffLen = PDU_HEADER_LEN, checksum = 0;
+    unsigned int sum;
     /* Convert the sequence to network order */
     uint32_t seqNum_NET_ORDER = htonl(seqNum);
 
@@ -22,12 +23,15 @@ int createPDU(uint8_t pduBuff[], uint32_t seqNum, uint8_t flag, uint8_t *payload
     /* Add in the flag (1 byte) */
     memcpy(&pduBuff[PDU_FLG], &flag, 1);
 
-    /* Add in the payload */
-    memcpy(&pduBuff[PDU_PLD], payload, payloadLen);
+    /* Sum the header, its last byte is the first half of a word */
+    sum = in_cksum_partial(pduBuff, PDU_HEADER_LEN, 0);
+
+    /* Add in the payload, summing it as it's copied */
+    sum = in_cksum_block_add(sum, in_cksum_partial_copy(&pduBuff[PDU_PLD], payload, payloadLen, 0), PDU_PLD);
     pduBuffLen += payloadLen;
 
     /* Calculate the payload checksum */
-    checksum = in_cksum((unsigned short *) pduBuff, pduBuffLen);
+    checksum = in_cksum_fold(sum);
 
     /* Put the checksum into the PDU */
     memcpy(&pduBuff[PDU_CHK], &checksum, 2);
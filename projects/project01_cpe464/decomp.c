@@ -0,0 +1,513 @@
+#include <pthread.h>
+
+#include "trace.h"
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+/* Records straddling two buffers are copied here, it grows for bigger ones */
+#define CARRY_MIN (1 << 16)
+
+typedef struct decomp_buf {
+    uint8_t *data;
+    size_t len;
+} decomp_buf_t;
+
+/*
+ * A single-producer, single-consumer ring. The thread fills bufs[filled % n]
+ * while fewer than n are waiting, the reader parses bufs[released % n] and
+ * hands it back when it moves on to the next.
+ */
+typedef struct decomp {
+    int fd;
+    int format;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+
+    decomp_buf_t bufs[DECOMP_NUM_BUFS];
+    uint64_t filled;
+    uint64_t released;
+
+    /* Decompressed bytes in the filled buffers */
+    off_t produced;
+
+    /* Set by the thread at the end of the data, err says why if it ended early */
+    int done;
+    char err[PCAP_ERRBUF_SIZE];
+
+    /* Set by decomp_close() to stop the thread before the end */
+    int stop;
+
+    /* Thread side, compressed input read in blocks */
+    uint8_t *in;
+    size_t in_len;
+    size_t in_pos;
+    int in_eof;
+
+#ifdef HAVE_ZLIB
+    z_stream gz;
+#endif
+#ifdef HAVE_ZSTD
+    ZSTD_DCtx *zstd;
+    size_t zstd_ret;
+#endif
+
+    /* Reader side, the buffer being parsed and where it starts in the decompressed data */
+    const uint8_t *cur;
+    off_t cur_off;
+    size_t cur_len;
+    int holding;
+
+    uint8_t *carry;
+    off_t carry_off;
+    size_t carry_len;
+    size_t carry_cap;
+} decomp_t;
+
+static void *decomp_alloc(size_t size) {
+
+    void *p = malloc(size);
+
+    if (p == NULL) {
+        perror("malloc");
+        exit(1);
+    }
+
+    return p;
+}
+
+/* Tops up the compressed input once it's all been used, returns -1 on a read error */
+static int read_input(decomp_t *d) {
+
+    ssize_t len;
+
+    if (d->in_pos < d->in_len || d->in_eof) return 0;
+
+    do {
+        len = read(d->fd, d->in, DECOMP_READ_SIZE);
+    } while (len < 0 && errno == EINTR);
+
+    if (len < 0) {
+        snprintf(d->err, PCAP_ERRBUF_SIZE, "read: %s", strerror(errno));
+        return -1;
+    }
+
+    d->in_len = (size_t) len;
+    d->in_pos = 0;
+    d->in_eof = len == 0;
+
+    return 0;
+}
+
+#ifdef HAVE_ZLIB
+
+/* Fills out with up to len bytes, returns how many, or -1 with d->err set */
+static ssize_t fill_gzip(decomp_t *d, uint8_t *out, size_t len) {
+
+    int ret;
+
+    d->gz.next_out = out;
+    d->gz.avail_out = (uInt) len;
+
+    while (d->gz.avail_out > 0) {
+
+        if (read_input(d)) return -1;
+
+        if (d->in_pos == d->in_len) {
+
+            /* Ending between members is fine, in the middle of one it's cut short */
+            if (d->gz.total_in > 0) {
+                snprintf(d->err, PCAP_ERRBUF_SIZE, "gzip data is cut short");
+                return -1;
+            }
+
+            break;
+        }
+
+        d->gz.next_in = &d->in[d->in_pos];
+        d->gz.avail_in = (uInt) (d->in_len - d->in_pos);
+
+        ret = inflate(&d->gz, Z_NO_FLUSH);
+
+        d->in_pos = d->in_len - d->gz.avail_in;
+
+        /* Concatenated members, as from gzip -c a b > c, carry on with the next */
+        if (ret == Z_STREAM_END) {
+            inflateReset(&d->gz);
+            continue;
+        }
+
+        if (ret != Z_OK && ret != Z_BUF_ERROR) {
+            snprintf(d->err, PCAP_ERRBUF_SIZE, "gzip: %s", d->gz.msg != NULL ? d->gz.msg : "corrupt data");
+            return -1;
+        }
+    }
+
+    return (ssize_t) (len - d->gz.avail_out);
+}
+
+#endif /* HAVE_ZLIB */
+
+#ifdef HAVE_ZSTD
+
+static ssize_t fill_zstd(decomp_t *d, uint8_t *out, size_t len) {
+
+    ZSTD_outBuffer output;
+    ZSTD_inBuffer input;
+
+    output.dst = out;
+    output.size = len;
+    output.pos = 0;
+
+    while (output.pos < output.size) {
+
+        if (read_input(d)) return -1;
+
+        /* Anything but 0 means a frame was left unfinished */
+        if (d->in_pos == d->in_len) {
+
+            if (d->zstd_ret != 0) {
+                snprintf(d->err, PCAP_ERRBUF_SIZE, "zstd data is cut short");
+                return -1;
+            }
+
+            break;
+        }
+
+        input.src = d->in;
+        input.size = d->in_len;
+        input.pos = d->in_pos;
+
+        d->zstd_ret = ZSTD_decompressStream(d->zstd, &output, &input);
+
+        d->in_pos = input.pos;
+
+        if (ZSTD_isError(d->zstd_ret)) {
+            snprintf(d->err, PCAP_ERRBUF_SIZE, "zstd: %s", ZSTD_getErrorName(d->zstd_ret));
+            return -1;
+        }
+    }
+
+    return (ssize_t) output.pos;
+}
+
+#endif /* HAVE_ZSTD */
+
+static ssize_t fill(decomp_t *d, uint8_t *out, size_t len) {
+
+#ifdef HAVE_ZLIB
+    if (d->format == DECOMP_GZIP) return fill_gzip(d, out, len);
+#endif
+#ifdef HAVE_ZSTD
+    if (d->format == DECOMP_ZSTD) return fill_zstd(d, out, len);
+#endif
+
+    (void) out;
+    (void) len;
+
+    return 0;
+}
+
+static void *decomp_thread(void *arg) {
+
+    decomp_t *d = (decomp_t *) arg;
+    decomp_buf_t *buf;
+    ssize_t len;
+
+    for (;;) {
+
+        pthread_mutex_lock(&d->lock);
+
+        while (!d->stop && d->filled - d->released == DECOMP_NUM_BUFS) {
+            pthread_cond_wait(&d->cond, &d->lock);
+        }
+
+        if (d->stop) {
+            pthread_mutex_unlock(&d->lock);
+            break;
+        }
+
+        pthread_mutex_unlock(&d->lock);
+
+        /* The reader doesn't touch this buffer until it's counted as filled */
+        buf = &d->bufs[d->filled % DECOMP_NUM_BUFS];
+        len = fill(d, buf->data, DECOMP_BUF_SIZE);
+
+        pthread_mutex_lock(&d->lock);
+
+        if (len > 0) {
+            buf->len = (size_t) len;
+            d->produced += len;
+            d->filled++;
+        }
+
+        /* A short buffer is the end, error or not */
+        if (len < DECOMP_BUF_SIZE) d->done = 1;
+
+        pthread_cond_broadcast(&d->cond);
+        pthread_mutex_unlock(&d->lock);
+
+        if (len < DECOMP_BUF_SIZE) break;
+    }
+
+    return NULL;
+}
+
+int decomp_open(reader_t *r, int format) {
+
+    decomp_t *d;
+    int i;
+
+#ifndef HAVE_ZLIB
+    if (format == DECOMP_GZIP) {
+        snprintf(r->errbuf, PCAP_ERRBUF_SIZE, "trace was built without zlib, gzip captures can't be read");
+        return -1;
+    }
+#endif
+#ifndef HAVE_ZSTD
+    if (format == DECOMP_ZSTD) {
+        snprintf(r->errbuf, PCAP_ERRBUF_SIZE, "trace was built without libzstd, zstd captures can't be read");
+        return -1;
+    }
+#endif
+
+    d = decomp_alloc(sizeof(decomp_t));
+    memset(d, 0, sizeof(decomp_t));
+
+    d->fd = r->fd;
+    d->format = format;
+    d->in = decomp_alloc(DECOMP_READ_SIZE);
+    d->carry = decomp_alloc(CARRY_MIN);
+    d->carry_cap = CARRY_MIN;
+
+    for (i = 0; i < DECOMP_NUM_BUFS; i++) {
+        d->bufs[i].data = decomp_alloc(DECOMP_BUF_SIZE);
+    }
+
+#ifdef HAVE_ZLIB
+    /* 15 + 32 takes gzip or zlib headers, with the largest window */
+    if (format == DECOMP_GZIP && inflateInit2(&d->gz, 15 + 32) != Z_OK) {
+        fprintf(stderr, "inflateInit2 failed\n");
+        exit(1);
+    }
+#endif
+#ifdef HAVE_ZSTD
+    if (format == DECOMP_ZSTD && (d->zstd = ZSTD_createDCtx()) == NULL) {
+        fprintf(stderr, "ZSTD_createDCtx failed\n");
+        exit(1);
+    }
+#endif
+
+    pthread_mutex_init(&d->lock, NULL);
+    pthread_cond_init(&d->cond, NULL);
+
+    if (pthread_create(&d->thread, NULL, decomp_thread, d)) {
+        perror("pthread_create");
+        exit(1);
+    }
+
+    r->zs = d;
+
+    return 0;
+}
+
+/* Hands the current buffer back and takes the next, returns -1 at the end of the data */
+static int next_buf(decomp_t *d) {
+
+    decomp_buf_t *buf;
+
+    pthread_mutex_lock(&d->lock);
+
+    if (d->holding) {
+        d->released++;
+        d->holding = 0;
+        pthread_cond_broadcast(&d->cond);
+    }
+
+    while (d->filled == d->released && !d->done) {
+        pthread_cond_wait(&d->cond, &d->lock);
+    }
+
+    if (d->filled == d->released) {
+        pthread_mutex_unlock(&d->lock);
+        return -1;
+    }
+
+    buf = &d->bufs[d->released % DECOMP_NUM_BUFS];
+
+    d->cur_off += (off_t) d->cur_len;
+    d->cur = buf->data;
+    d->cur_len = buf->len;
+    d->holding = 1;
+
+    pthread_mutex_unlock(&d->lock);
+
+    return 0;
+}
+
+/*
+ * Copies [offset, offset + len) into carry, handing buffers back as they're
+ * used up. Returns the bytes, or NULL with the reason in r->errbuf, and as much
+ * as there was held in carry, if the data ends first.
+ */
+static const uint8_t *carry_range(reader_t *r, off_t offset, size_t len) {
+
+    decomp_t *d = r->zs;
+    off_t end = offset + (off_t) len, next;
+    size_t n;
+
+    if (offset >= d->cur_off) {
+
+        /* Starts in the current buffer, or right after it */
+        d->carry_off = offset;
+        d->carry_len = 0;
+
+    } else if (offset >= d->carry_off) {
+
+        /* The same record again, now wanted in full */
+        n = (size_t) (offset - d->carry_off);
+        memmove(d->carry, &d->carry[n], d->carry_len - n);
+        d->carry_off = offset;
+        d->carry_len -= n;
+
+    } else {
+        snprintf(r->errbuf, PCAP_ERRBUF_SIZE, "can't go back in a compressed capture");
+        return NULL;
+    }
+
+    if (len > d->carry_cap) {
+
+        while (len > d->carry_cap) d->carry_cap *= 2;
+
+        d->carry = realloc(d->carry, d->carry_cap);
+
+        if (d->carry == NULL) {
+            perror("realloc");
+            exit(1);
+        }
+    }
+
+    while (d->carry_len < len) {
+
+        next = d->carry_off + (off_t) d->carry_len;
+
+        if (next == d->cur_off + (off_t) d->cur_len) {
+
+            if (next_buf(d)) {
+                snprintf(r->errbuf, PCAP_ERRBUF_SIZE, "%s", d->err[0] ? d->err : "decompressed data is cut short");
+                return NULL;
+            }
+
+            /* Nothing copied yet and it's all in the new buffer */
+            if (d->carry_len == 0 && end <= d->cur_off + (off_t) d->cur_len) {
+                return &d->cur[offset - d->cur_off];
+            }
+
+            continue;
+        }
+
+        n = (size_t) (d->cur_off + (off_t) d->cur_len - next);
+        if (n > len - d->carry_len) n = len - d->carry_len;
+
+        memcpy(&d->carry[d->carry_len], &d->cur[next - d->cur_off], n);
+        d->carry_len += n;
+    }
+
+    return d->carry;
+}
+
+off_t decomp_remaining(reader_t *r, off_t want) {
+
+    decomp_t *d = r->zs;
+    off_t end = r->pos + want, produced;
+
+    if (end <= d->cur_off + (off_t) d->cur_len) return want;
+
+    if (r->pos >= d->carry_off && end <= d->carry_off + (off_t) d->carry_len) return want;
+
+    /*
+     * More than the other buffers hold would never be produced while the current
+     * one is held, so it's copied out to carry and the buffers handed back
+     */
+    if (end - (d->cur_off + (off_t) d->cur_len) > (off_t) (DECOMP_NUM_BUFS - 1) * DECOMP_BUF_SIZE) {
+
+        if (carry_range(r, r->pos, (size_t) want) != NULL) return want;
+        if (d->err[0] != '\0' || d->carry_off != r->pos) return -1;
+
+        return (off_t) d->carry_len;
+    }
+
+    pthread_mutex_lock(&d->lock);
+
+    while (d->produced < end && !d->done) {
+        pthread_cond_wait(&d->cond, &d->lock);
+    }
+
+    produced = d->produced;
+
+    pthread_mutex_unlock(&d->lock);
+
+    if (produced >= end) return want;
+
+    if (d->err[0] != '\0') {
+        snprintf(r->errbuf, PCAP_ERRBUF_SIZE, "%s", d->err);
+        return -1;
+    }
+
+    return produced - r->pos;
+}
+
+const uint8_t *decomp_range(reader_t *r, off_t offset, size_t len) {
+
+    decomp_t *d = r->zs;
+    off_t end = offset + (off_t) len;
+
+    if (offset >= d->cur_off && end <= d->cur_off + (off_t) d->cur_len) {
+        return &d->cur[offset - d->cur_off];
+    }
+
+    if (offset >= d->carry_off && end <= d->carry_off + (off_t) d->carry_len) {
+        return &d->carry[offset - d->carry_off];
+    }
+
+    return carry_range(r, offset, len);
+}
+
+void decomp_close(reader_t *r) {
+
+    decomp_t *d = r->zs;
+    int i;
+
+    if (d == NULL) return;
+
+    pthread_mutex_lock(&d->lock);
+    d->stop = 1;
+    pthread_cond_broadcast(&d->cond);
+    pthread_mutex_unlock(&d->lock);
+
+    pthread_join(d->thread, NULL);
+
+#ifdef HAVE_ZLIB
+    if (d->format == DECOMP_GZIP) inflateEnd(&d->gz);
+#endif
+#ifdef HAVE_ZSTD
+    if (d->format == DECOMP_ZSTD) ZSTD_freeDCtx(d->zstd);
+#endif
+
+    pthread_mutex_destroy(&d->lock);
+    pthread_cond_destroy(&d->cond);
+
+    for (i = 0; i < DECOMP_NUM_BUFS; i++) free(d->bufs[i].data);
+
+    free(d->in);
+    free(d->carry);
+    free(d);
+
+    r->zs = NULL;
+}
@@ -0,0 +1,240 @@
+
+#include "trace.h"
+
+/*
+ * Walks the headers of one packet, filling in info without formatting
+ * anything. A header is only set if all of it was captured.
+ */
+
+void dissect_arp(packet_info_t *info, const uint8_t *packet_data, uint32_t avail) {
+
+    if (avail < ARP_HEADER_LEN) return;
+
+    info->arp = (const arp_header_t *) packet_data;
+    info->net_proto = PROTO_ARP;
+}
+
+void dissect_vlan(packet_info_t *info, const uint8_t *packet_data, uint32_t avail) {
+
+    const vlan_header_t *vlan_header = (const vlan_header_t *) packet_data;
+    const proto_t *next;
+
+    /* Tags nested deeper than QinQ aren't followed */
+    if (avail < VLAN_HEADER_LEN || info->num_vlans == VLAN_MAX_TAGS) return;
+
+    info->vlan[info->num_vlans++] = vlan_header;
+
+    next = PROTO_BY_ETHERTYPE(ntohs(vlan_header->type));
+    if (next->dissect != NULL) next->dissect(info, &packet_data[VLAN_HEADER_LEN], avail - VLAN_HEADER_LEN);
+}
+
+/*
+ * Starts a TCP/UDP/ICMPv6 checksum with the pseudo-header, the segment itself
+ * is then added in place with in_cksum_partial() so nothing gets copied.
+ */
+static unsigned int pseudo_header_sum(const packet_info_t *info, uint8_t protocol, uint16_t len) {
+
+    pseudo_header_t pseudo_header;
+    uint32_t tail[2];
+
+    /* The IPv6 addresses sit next to each other in the header, only the length and protocol need building */
+    if (info->ip6 != NULL) {
+        tail[0] = htonl(len);
+        tail[1] = htonl(protocol);
+        return in_cksum_partial(tail, sizeof(tail), in_cksum_partial(info->ip6->src_addr, 32, 0));
+    }
+
+    pseudo_header.src_addr = info->ip->src_addr;
+    pseudo_header.dst_addr = info->ip->dst_addr;
+    pseudo_header.type = htons(protocol);
+    pseudo_header.tcp_len = htons(len);
+
+    return in_cksum_partial(&pseudo_header, PSEUDO_HEADER_LEN, 0);
+}
+
+void dissect_icmp(packet_info_t *info, const uint8_t *packet_data, uint32_t avail) {
+
+    uint16_t icmp_len = info->ip_len - info->ip_header_len;
+    unsigned int sum = 0;
+
+    if (avail < ICMP_HEADER_LEN) return;
+
+    info->icmp = (const icmp_header_t *) packet_data;
+    info->transport_proto = PROTO_ICMP;
+
+    /* ICMPv6 covers a pseudo-header, plain ICMP only the message */
+    if (info->ip_proto == 0x3a) {
+        info->transport_proto = PROTO_ICMP6;
+        sum = pseudo_header_sum(info, 0x3a, icmp_len);
+    }
+
+    /* Only what was captured can be checksummed */
+    if (icmp_len > avail) icmp_len = (uint16_t) avail;
+
+    PROF_BEGIN(PROF_CKSUM);
+    info->icmp_cksum_ok = in_cksum_fold(in_cksum_partial(packet_data, icmp_len, sum)) == 0;
+    PROF_END();
+}
+
+void dissect_udp(packet_info_t *info, const uint8_t *packet_data, uint32_t avail) {
+
+    const udp_header_t *udp_header = (const udp_header_t *) packet_data;
+    uint16_t udp_len;
+    unsigned int sum;
+
+    if (avail < UDP_HEADER_LEN) return;
+
+    info->udp = udp_header;
+    info->transport_proto = PROTO_UDP;
+
+    /* A zero checksum means the sender didn't compute one, which only IPv4 allows */
+    if (udp_header->cksum == 0 && info->ip6 == NULL) {
+        info->udp_cksum_ok = 1;
+        return;
+    }
+
+    udp_len = ntohs(udp_header->udp_len);
+
+    PROF_BEGIN(PROF_CKSUM);
+    sum = pseudo_header_sum(info, 0x11, udp_len);
+
+    if (udp_len > avail) udp_len = (uint16_t) avail;
+
+    sum = in_cksum_partial(packet_data, udp_len, sum);
+    info->udp_cksum_ok = in_cksum_fold(sum) == 0;
+    PROF_END();
+}
+
+void dissect_tcp(packet_info_t *info, const uint8_t *packet_data, uint32_t avail) {
+
+    uint16_t tcp_len = info->ip_len - info->ip_header_len;
+    unsigned int sum;
+
+    if (avail < TCP_HEADER_LEN) return;
+
+    info->tcp = (const tcp_header_t *) packet_data;
+    info->transport_proto = PROTO_TCP;
+
+    PROF_BEGIN(PROF_CKSUM);
+    sum = pseudo_header_sum(info, 0x06, tcp_len);
+
+    /* Only what was captured can be checksummed */
+    if (tcp_len > avail) tcp_len = (uint16_t) avail;
+
+    sum = in_cksum_partial(packet_data, tcp_len, sum);
+    info->tcp_cksum_ok = in_cksum_fold(sum) == 0;
+    PROF_END();
+}
+
+void dissect_ip(packet_info_t *info, const uint8_t *packet_data, uint32_t avail) {
+
+    const ip_v4_header_t *ip_header = (const ip_v4_header_t *) packet_data;
+    const proto_t *next;
+
+    if (avail < IPV4_HEADER_LEN) return;
+
+    info->ip = ip_header;
+    info->net_proto = PROTO_IPV4;
+    info->ip_header_len = (ip_header->Ver_IHL & 0xf) * 4;
+    info->ip_len = ntohs(ip_header->len);
+    info->ip_proto = ip_header->protocol;
+
+    if (avail < info->ip_header_len) return;
+
+    /* Verify checksum */
+    PROF_BEGIN(PROF_CKSUM);
+    info->ip_cksum_ok = in_cksum((unsigned short *) packet_data, info->ip_header_len) == 0;
+    PROF_END();
+
+    /* Anything under 20 bytes can't be a real header, so there's no telling where the payload starts */
+    if (info->ip_header_len < IPV4_HEADER_LEN) return;
+
+    /* Advance the packet data pointer past the header and any options */
+    packet_data = &packet_data[info->ip_header_len];
+    avail -= info->ip_header_len;
+
+    next = PROTO_BY_IP_PROTO(ip_header->protocol);
+    if (next->dissect != NULL) next->dissect(info, packet_data, avail);
+}
+
+/* Hop-by-hop, routing, fragment, authentication and destination options */
+static int is_ip6_ext(uint8_t next_header) {
+    return next_header == 0 || next_header == 43 || next_header == 44 || next_header == 51 || next_header == 60;
+}
+
+void dissect_ip6(packet_info_t *info, const uint8_t *packet_data, uint32_t avail) {
+
+    const ip_v6_header_t *ip6_header = (const ip_v6_header_t *) packet_data;
+    const proto_t *next;
+    uint32_t off = IPV6_HEADER_LEN, ip_len;
+    uint8_t next_header, ext;
+    int num_ext = 0;
+
+    if (avail < IPV6_HEADER_LEN) return;
+
+    ip_len = IPV6_HEADER_LEN + ntohs(ip6_header->payload_len);
+
+    info->ip6 = ip6_header;
+    info->net_proto = PROTO_IPV6;
+    info->ip_len = ip_len > UINT16_MAX ? UINT16_MAX : (uint16_t) ip_len;
+    info->ip_header_len = IPV6_HEADER_LEN;
+    info->ip_proto = next_header = ip6_header->next_header;
+
+    /* There's no header checksum to get wrong */
+    info->ip_cksum_ok = 1;
+
+    /* Follow the extension header chain in place to the upper-layer header */
+    while (is_ip6_ext(next_header)) {
+
+        if (++num_ext > IPV6_MAX_EXT || avail < off + 8) return;
+
+        /* Only the first fragment starts with the upper-layer header */
+        if (next_header == 44 && ((packet_data[off + 2] << 8 | packet_data[off + 3]) & 0xfff8)) return;
+
+        ext = next_header;
+        next_header = packet_data[off];
+
+        if (ext == 44) {
+            off += 8;
+        } else if (ext == 51) {
+            off += (packet_data[off + 1] + 2) * 4;
+        } else {
+            off += (packet_data[off + 1] + 1) * 8;
+        }
+
+        info->ip_header_len = (uint16_t) off;
+        info->ip_proto = next_header;
+    }
+
+    if (avail < off) return;
+
+    next = PROTO_BY_IP_PROTO(next_header);
+    if (next->dissect != NULL) next->dissect(info, &packet_data[off], avail - off);
+}
+
+void dissect_packet(const packet_t *pkt, packet_info_t *info) {
+
+    const uint8_t *packet_data = pkt->data;
+    const proto_t *next;
+    uint32_t avail = pkt->caplen;
+
+    memset(info, 0, sizeof(packet_info_t));
+    info->pkt = pkt;
+
+    if (avail < ETH_HEADER_LEN) return;
+
+    PROF_BEGIN(PROF_DISSECT);
+
+    /* The header structs are packed, so they can be read straight out of the packet */
+    info->eth = (const eth_header_t *) packet_data;
+
+    /* Advance the packet data pointer to the next header */
+    packet_data = &packet_data[ETH_HEADER_LEN];
+    avail -= ETH_HEADER_LEN;
+
+    /* Continue to the next header */
+    next = PROTO_BY_ETHERTYPE(ntohs(info->eth->type));
+    if (next->dissect != NULL) next->dissect(info, packet_data, avail);
+
+    PROF_END();
+}
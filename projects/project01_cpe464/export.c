@@ -0,0 +1,281 @@
+
+#include "trace.h"
+
+/* Seconds with all nine digits of the fraction, the same for every format */
+static void export_ts(outbuf_t *out, const packet_t *pkt) {
+    ob_dec(out, pkt->ts_sec);
+    ob_char(out, '.');
+    ob_dec_pad(out, pkt->ts_nsec, 9);
+}
+
+static void export_bool(outbuf_t *out, int val, int json) {
+    if (json) {
+        if (val) OB_LIT(out, "true");
+        else OB_LIT(out, "false");
+    } else {
+        ob_char(out, val ? '1' : '0');
+    }
+}
+
+/* Source or destination address of either IP version */
+static void export_addr(outbuf_t *out, const packet_info_t *info, int dst) {
+    if (info->ip != NULL) {
+        ob_ipv4(out, dst ? info->ip->dst_addr : info->ip->src_addr);
+    } else {
+        ob_ipv6(out, dst ? info->ip6->dst_addr : info->ip6->src_addr);
+    }
+}
+
+/* IPv6 traffic class, the IPv4 TOS byte */
+static uint32_t export_tos(const packet_info_t *info) {
+    return info->ip != NULL ? info->ip->TOS : (ntohl(info->ip6->Ver_TC_Flow) >> 20) & 0xff;
+}
+
+/* IPv6 hop limit, the IPv4 TTL */
+static uint32_t export_ttl(const packet_info_t *info) {
+    return info->ip != NULL ? info->ip->TTL : info->ip6->hop_limit;
+}
+
+void export_ndjson(void *arg, int worker, outbuf_t *out, uint32_t pkt_num, const packet_t *pkt) {
+
+    packet_info_t info;
+    int i;
+
+    (void) arg;
+    (void) worker;
+
+    dissect_packet(pkt, &info);
+
+    OB_LIT(out, "{\"num\":");
+    ob_dec(out, pkt_num);
+    OB_LIT(out, ",\"ts\":");
+    export_ts(out, pkt);
+    OB_LIT(out, ",\"caplen\":");
+    ob_dec(out, pkt->caplen);
+    OB_LIT(out, ",\"len\":");
+    ob_dec(out, pkt->len);
+
+    if (info.eth != NULL) {
+        OB_LIT(out, ",\"eth\":{\"dst\":\"");
+        ob_mac_pad(out, info.eth->dst_addr);
+        OB_LIT(out, "\",\"src\":\"");
+        ob_mac_pad(out, info.eth->src_addr);
+        OB_LIT(out, "\",\"type\":");
+        ob_dec(out, ntohs(info.eth->type));
+        ob_char(out, '}');
+    }
+
+    /* VLAN IDs, outer tag first */
+    for (i = 0; i < info.num_vlans; i++) {
+        if (i == 0) OB_LIT(out, ",\"vlan\":[");
+        else ob_char(out, ',');
+        ob_dec(out, ntohs(info.vlan[i]->TCI) & 0xfff);
+        if (i == info.num_vlans - 1) ob_char(out, ']');
+    }
+
+    if (info.arp != NULL) {
+        OB_LIT(out, ",\"arp\":{\"op\":");
+        ob_dec(out, ntohs(info.arp->OPER));
+        OB_LIT(out, ",\"sender_mac\":\"");
+        ob_mac_pad(out, info.arp->SHA);
+        OB_LIT(out, "\",\"sender_ip\":\"");
+        ob_ipv4(out, info.arp->SPA);
+        OB_LIT(out, "\",\"target_mac\":\"");
+        ob_mac_pad(out, info.arp->THA);
+        OB_LIT(out, "\",\"target_ip\":\"");
+        ob_ipv4(out, info.arp->TPA);
+        OB_LIT(out, "\"}");
+    }
+
+    /* IPv6 has no header checksum, so no cksum_ok */
+    if (info.ip != NULL || info.ip6 != NULL) {
+        OB_LIT(out, ",\"ip\":{\"version\":");
+        ob_char(out, info.ip != NULL ? '4' : '6');
+        OB_LIT(out, ",\"src\":\"");
+        export_addr(out, &info, 0);
+        OB_LIT(out, "\",\"dst\":\"");
+        export_addr(out, &info, 1);
+        OB_LIT(out, "\",\"header_len\":");
+        ob_dec(out, info.ip_header_len);
+        OB_LIT(out, ",\"len\":");
+        ob_dec(out, info.ip_len);
+        OB_LIT(out, ",\"tos\":");
+        ob_dec(out, export_tos(&info));
+        OB_LIT(out, ",\"ttl\":");
+        ob_dec(out, export_ttl(&info));
+        OB_LIT(out, ",\"proto\":");
+        ob_dec(out, info.ip_proto);
+
+        if (info.ip != NULL) {
+            OB_LIT(out, ",\"cksum_ok\":");
+            export_bool(out, info.ip_cksum_ok, 1);
+        }
+
+        ob_char(out, '}');
+    }
+
+    if (info.tcp != NULL) {
+        OB_LIT(out, ",\"tcp\":{\"src_port\":");
+        ob_dec(out, ntohs(info.tcp->src_port));
+        OB_LIT(out, ",\"dst_port\":");
+        ob_dec(out, ntohs(info.tcp->dst_port));
+        OB_LIT(out, ",\"seq\":");
+        ob_dec(out, ntohl(info.tcp->seq));
+        OB_LIT(out, ",\"ack\":");
+        ob_dec(out, ntohl(info.tcp->ack));
+        OB_LIT(out, ",\"flags\":");
+        ob_dec(out, ntohs(info.tcp->flags) & 0x1ff);
+        OB_LIT(out, ",\"window\":");
+        ob_dec(out, ntohs(info.tcp->win_size));
+        OB_LIT(out, ",\"cksum_ok\":");
+        export_bool(out, info.tcp_cksum_ok, 1);
+        ob_char(out, '}');
+    }
+
+    if (info.udp != NULL) {
+        OB_LIT(out, ",\"udp\":{\"src_port\":");
+        ob_dec(out, ntohs(info.udp->src_port));
+        OB_LIT(out, ",\"dst_port\":");
+        ob_dec(out, ntohs(info.udp->dst_port));
+        OB_LIT(out, ",\"len\":");
+        ob_dec(out, ntohs(info.udp->udp_len));
+        OB_LIT(out, ",\"cksum_ok\":");
+        export_bool(out, info.udp_cksum_ok, 1);
+        ob_char(out, '}');
+    }
+
+    if (info.icmp != NULL) {
+        OB_LIT(out, ",\"icmp\":{\"type\":");
+        ob_dec(out, info.icmp->type);
+        OB_LIT(out, ",\"code\":");
+        ob_dec(out, info.icmp->code);
+        OB_LIT(out, ",\"cksum_ok\":");
+        export_bool(out, info.icmp_cksum_ok, 1);
+        ob_char(out, '}');
+    }
+
+    OB_LIT(out, "}\n");
+}
+
+void export_csv_header(outbuf_t *out) {
+    OB_LIT(out, "num,ts,caplen,len,eth_dst,eth_src,eth_type,vlan_id,vlan_inner_id,"
+                "arp_op,arp_sender_mac,arp_sender_ip,arp_target_mac,arp_target_ip,"
+                "ip_version,ip_src,ip_dst,ip_header_len,ip_len,ip_tos,ip_ttl,ip_proto,ip_cksum_ok,"
+                "src_port,dst_port,tcp_seq,tcp_ack,tcp_flags,tcp_window,tcp_cksum_ok,"
+                "udp_len,udp_cksum_ok,icmp_type,icmp_code,icmp_cksum_ok\n");
+}
+
+void export_csv(void *arg, int worker, outbuf_t *out, uint32_t pkt_num, const packet_t *pkt) {
+
+    packet_info_t info;
+    int i;
+
+    (void) arg;
+    (void) worker;
+
+    dissect_packet(pkt, &info);
+
+    ob_dec(out, pkt_num);
+    ob_char(out, ',');
+    export_ts(out, pkt);
+    ob_char(out, ',');
+    ob_dec(out, pkt->caplen);
+    ob_char(out, ',');
+    ob_dec(out, pkt->len);
+    ob_char(out, ',');
+
+    if (info.eth != NULL) {
+        ob_mac_pad(out, info.eth->dst_addr);
+        ob_char(out, ',');
+        ob_mac_pad(out, info.eth->src_addr);
+        ob_char(out, ',');
+        ob_dec(out, ntohs(info.eth->type));
+        ob_char(out, ',');
+    } else {
+        OB_LIT(out, ",,,");
+    }
+
+    for (i = 0; i < VLAN_MAX_TAGS; i++) {
+        if (i < info.num_vlans) ob_dec(out, ntohs(info.vlan[i]->TCI) & 0xfff);
+        ob_char(out, ',');
+    }
+
+    if (info.arp != NULL) {
+        ob_dec(out, ntohs(info.arp->OPER));
+        ob_char(out, ',');
+        ob_mac_pad(out, info.arp->SHA);
+        ob_char(out, ',');
+        ob_ipv4(out, info.arp->SPA);
+        ob_char(out, ',');
+        ob_mac_pad(out, info.arp->THA);
+        ob_char(out, ',');
+        ob_ipv4(out, info.arp->TPA);
+        ob_char(out, ',');
+    } else {
+        OB_LIT(out, ",,,,,");
+    }
+
+    if (info.ip != NULL || info.ip6 != NULL) {
+        ob_char(out, info.ip != NULL ? '4' : '6');
+        ob_char(out, ',');
+        export_addr(out, &info, 0);
+        ob_char(out, ',');
+        export_addr(out, &info, 1);
+        ob_char(out, ',');
+        ob_dec(out, info.ip_header_len);
+        ob_char(out, ',');
+        ob_dec(out, info.ip_len);
+        ob_char(out, ',');
+        ob_dec(out, export_tos(&info));
+        ob_char(out, ',');
+        ob_dec(out, export_ttl(&info));
+        ob_char(out, ',');
+        ob_dec(out, info.ip_proto);
+        ob_char(out, ',');
+        if (info.ip != NULL) export_bool(out, info.ip_cksum_ok, 0);
+        ob_char(out, ',');
+    } else {
+        OB_LIT(out, ",,,,,,,,,");
+    }
+
+    /* TCP and UDP share the port columns, ip_proto says which it was */
+    if (info.tcp != NULL) {
+        ob_dec(out, ntohs(info.tcp->src_port));
+        ob_char(out, ',');
+        ob_dec(out, ntohs(info.tcp->dst_port));
+        ob_char(out, ',');
+        ob_dec(out, ntohl(info.tcp->seq));
+        ob_char(out, ',');
+        ob_dec(out, ntohl(info.tcp->ack));
+        ob_char(out, ',');
+        ob_dec(out, ntohs(info.tcp->flags) & 0x1ff);
+        ob_char(out, ',');
+        ob_dec(out, ntohs(info.tcp->win_size));
+        ob_char(out, ',');
+        export_bool(out, info.tcp_cksum_ok, 0);
+        OB_LIT(out, ",,,");
+    } else if (info.udp != NULL) {
+        ob_dec(out, ntohs(info.udp->src_port));
+        ob_char(out, ',');
+        ob_dec(out, ntohs(info.udp->dst_port));
+        OB_LIT(out, ",,,,,,");
+        ob_dec(out, ntohs(info.udp->udp_len));
+        ob_char(out, ',');
+        export_bool(out, info.udp_cksum_ok, 0);
+        ob_char(out, ',');
+    } else {
+        OB_LIT(out, ",,,,,,,,,");
+    }
+
+    if (info.icmp != NULL) {
+        ob_dec(out, info.icmp->type);
+        ob_char(out, ',');
+        ob_dec(out, info.icmp->code);
+        ob_char(out, ',');
+        export_bool(out, info.icmp_cksum_ok, 0);
+    } else {
+        OB_LIT(out, ",,");
+    }
+
+    ob_char(out, '\n');
+}
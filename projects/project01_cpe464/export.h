@@ -0,0 +1,26 @@
+
+#ifndef PROJECT_1_EXPORT_H
+#define PROJECT_1_EXPORT_H
+
+#include <stdint.h>
+
+#include "libs/outbuf.h"
+#include "reader.h"
+
+#define FORMAT_TEXT   0
+#define FORMAT_NDJSON 1
+#define FORMAT_CSV    2
+
+/* Column names, written once before the first CSV record */
+void export_csv_header(outbuf_t *out);
+
+/*
+ * packet_fn_t's writing one record per packet, a JSON object per line or a
+ * CSV row. Headers that are missing or cut short are left out of the JSON
+ * and leave their CSV columns empty.
+ */
+void export_ndjson(void *arg, int worker, outbuf_t *out, uint32_t pkt_num, const packet_t *pkt);
+
+void export_csv(void *arg, int worker, outbuf_t *out, uint32_t pkt_num, const packet_t *pkt);
+
+#endif /* PROJECT_1_EXPORT_H */
@@ -0,0 +1,635 @@
+
+#include "trace.h"
+
+#include <ctype.h>
+
+/*
+ * Expressions are parsed into a small tree, then flattened into a list of
+ * tests where each test jumps forward to the next one to run. and/or/not
+ * only ever change where a test jumps to, so running a filter is a single
+ * loop over fixed-offset loads with no recursion or stack.
+ */
+
+#define NODE_TEST 0
+#define NODE_AND  1
+#define NODE_OR   2
+#define NODE_NOT  3
+
+/* Longest word in an expression, e.g. an address or field name */
+#define FILTER_MAX_WORD 32
+
+#define FILTER_MAX_NODES 4096
+
+typedef struct node {
+    int kind;
+    int left;
+    int right;
+    filter_insn_t test;
+} node_t;
+
+typedef struct parser {
+    const char *expr;
+    const char *pos;
+
+    /* The token at pos, either a word or one or two punctuation characters */
+    const char *tok;
+    size_t tok_len;
+
+    node_t *nodes;
+    int num_nodes;
+
+    filter_insn_t *insns;
+    int num_insns;
+
+    char *errbuf;
+    size_t errlen;
+} parser_t;
+
+/* Guards a field is only valid under */
+#define GUARD_NONE 0
+#define GUARD_IP   1
+#define GUARD_TCP  2
+#define GUARD_UDP  3
+#define GUARD_ICMP 4
+
+typedef struct field {
+    const char *name;
+    uint8_t guard;
+    uint8_t base;
+    uint8_t size;
+    uint16_t off;
+
+    /* Either end of the packet for fields like ip.addr, or -1 */
+    int other_off;
+} field_t;
+
+static const field_t fields[] = {
+        {"frame.len",   GUARD_NONE, FILTER_BASE_LEN,       4, 0,  -1},
+        {"eth.type",    GUARD_NONE, FILTER_BASE_ETHERTYPE, 2, 0,  -1},
+        {"ip.tos",      GUARD_IP,   FILTER_BASE_NETWORK,   1, 1,  -1},
+        {"ip.len",      GUARD_IP,   FILTER_BASE_NETWORK,   2, 2,  -1},
+        {"ip.ttl",      GUARD_IP,   FILTER_BASE_NETWORK,   1, 8,  -1},
+        {"ip.proto",    GUARD_IP,   FILTER_BASE_NETWORK,   1, 9,  -1},
+        {"ip.src",      GUARD_IP,   FILTER_BASE_NETWORK,   4, 12, -1},
+        {"ip.dst",      GUARD_IP,   FILTER_BASE_NETWORK,   4, 16, -1},
+        {"ip.addr",     GUARD_IP,   FILTER_BASE_NETWORK,   4, 12, 16},
+        {"tcp.srcport", GUARD_TCP,  FILTER_BASE_TRANSPORT, 2, 0,  -1},
+        {"tcp.dstport", GUARD_TCP,  FILTER_BASE_TRANSPORT, 2, 2,  -1},
+        {"tcp.port",    GUARD_TCP,  FILTER_BASE_TRANSPORT, 2, 0,  2},
+        {"tcp.flags",   GUARD_TCP,  FILTER_BASE_TRANSPORT, 1, 13, -1},
+        {"tcp.window",  GUARD_TCP,  FILTER_BASE_TRANSPORT, 2, 14, -1},
+        {"udp.srcport", GUARD_UDP,  FILTER_BASE_TRANSPORT, 2, 0,  -1},
+        {"udp.dstport", GUARD_UDP,  FILTER_BASE_TRANSPORT, 2, 2,  -1},
+        {"udp.port",    GUARD_UDP,  FILTER_BASE_TRANSPORT, 2, 0,  2},
+        {"udp.len",     GUARD_UDP,  FILTER_BASE_TRANSPORT, 2, 4,  -1},
+        {"icmp.type",   GUARD_ICMP, FILTER_BASE_TRANSPORT, 1, 0,  -1},
+        {"icmp.code",   GUARD_ICMP, FILTER_BASE_TRANSPORT, 1, 1,  -1},
+        {NULL, 0, 0, 0, 0, 0}
+};
+
+static const char *cmp_names[] = {"==", "!=", "<", "<=", ">", ">="};
+
+static int fail(parser_t *p, const char *msg) {
+
+    if (p->tok_len > 0) {
+        snprintf(p->errbuf, p->errlen, "%s at '%.*s' (offset %d)", msg, (int) p->tok_len, p->tok,
+                 (int) (p->tok - p->expr));
+    } else {
+        snprintf(p->errbuf, p->errlen, "%s at end of expression", msg);
+    }
+
+    return -1;
+}
+
+/* Moves on to the next token */
+static void next(parser_t *p) {
+
+    const char *s = p->pos;
+
+    while (isspace((unsigned char) *s)) s++;
+
+    p->tok = s;
+
+    if (*s == '\0') {
+        p->tok_len = 0;
+    } else if (isalnum((unsigned char) *s) || *s == '_') {
+        while (isalnum((unsigned char) *s) || *s == '_' || *s == '.') s++;
+        p->tok_len = s - p->tok;
+    } else if ((s[1] == '=' && strchr("=!<>", s[0])) || (s[0] == '&' && s[1] == '&') ||
+               (s[0] == '|' && s[1] == '|')) {
+        p->tok_len = 2;
+    } else {
+        p->tok_len = 1;
+    }
+
+    p->pos = p->tok + p->tok_len;
+}
+
+static int is(const parser_t *p, const char *word) {
+    return p->tok_len == strlen(word) && strncmp(p->tok, word, p->tok_len) == 0;
+}
+
+static int new_node(parser_t *p, int kind, int left, int right) {
+
+    node_t *node;
+
+    if (left < 0 || right < 0) return -1;
+
+    if (p->num_nodes == FILTER_MAX_NODES) {
+        return fail(p, "expression too long");
+    }
+
+    node = &p->nodes[p->num_nodes];
+    memset(node, 0, sizeof(node_t));
+    node->kind = kind;
+    node->left = left;
+    node->right = right;
+
+    return p->num_nodes++;
+}
+
+static int test(parser_t *p, uint8_t base, uint16_t off, uint8_t size, uint32_t mask, uint8_t cmp,
+                uint32_t value) {
+
+    int n = new_node(p, NODE_TEST, 0, 0);
+
+    if (n < 0) return -1;
+
+    p->nodes[n].test.base = base;
+    p->nodes[n].test.off = off;
+    p->nodes[n].test.size = size;
+    p->nodes[n].test.mask = mask;
+    p->nodes[n].test.cmp = cmp;
+    p->nodes[n].test.value = value;
+
+    return n;
+}
+
+static int ip_proto(parser_t *p, uint8_t protocol) {
+    return new_node(p, NODE_AND, test(p, FILTER_BASE_ETHERTYPE, 0, 2, 0xffff, FILTER_EQ, 0x0800),
+                    test(p, FILTER_BASE_NETWORK, 9, 1, 0xff, FILTER_EQ, protocol));
+}
+
+/* TCP/UDP/ICMP headers are only at the start of the first fragment */
+static int transport(parser_t *p, uint8_t protocol) {
+    return new_node(p, NODE_AND, ip_proto(p, protocol),
+                    test(p, FILTER_BASE_NETWORK, 6, 2, 0x1fff, FILTER_EQ, 0));
+}
+
+static int guard(parser_t *p, int which) {
+
+    switch (which) {
+        case GUARD_IP:
+            return test(p, FILTER_BASE_ETHERTYPE, 0, 2, 0xffff, FILTER_EQ, 0x0800);
+        case GUARD_TCP:
+            return transport(p, 0x06);
+        case GUARD_UDP:
+            return transport(p, 0x11);
+        case GUARD_ICMP:
+            return transport(p, 0x01);
+        default:
+            return -1;
+    }
+}
+
+static int parse_number(parser_t *p, uint32_t *value, uint32_t max) {
+
+    char word[FILTER_MAX_WORD];
+    char *end;
+    unsigned long n;
+
+    if (p->tok_len == 0 || p->tok_len >= sizeof(word)) return fail(p, "expected a number");
+
+    memcpy(word, p->tok, p->tok_len);
+    word[p->tok_len] = '\0';
+
+    errno = 0;
+    n = strtoul(word, &end, 0);
+
+    if (*end != '\0' || errno || n > UINT32_MAX) return fail(p, "expected a number");
+    if (n > max) return fail(p, "value out of range");
+
+    *value = (uint32_t) n;
+    next(p);
+
+    return 0;
+}
+
+/* Dotted quads compare as big-endian numbers, the same way they're loaded */
+static int parse_addr(parser_t *p, uint32_t *value) {
+
+    char word[FILTER_MAX_WORD];
+    struct in_addr addr;
+
+    if (p->tok_len == 0 || p->tok_len >= sizeof(word)) return fail(p, "expected an address");
+
+    memcpy(word, p->tok, p->tok_len);
+    word[p->tok_len] = '\0';
+
+    if (inet_pton(AF_INET, word, &addr) != 1) return fail(p, "expected an address");
+
+    *value = ntohl(addr.s_addr);
+    next(p);
+
+    return 0;
+}
+
+/* [src|dst] host A */
+static int parse_host(parser_t *p, int dir) {
+
+    uint32_t addr;
+    int src, dst;
+
+    if (parse_addr(p, &addr)) return -1;
+
+    src = dir != 2 ? test(p, FILTER_BASE_NETWORK, 12, 4, 0xffffffff, FILTER_EQ, addr) : 0;
+    dst = dir != 1 ? test(p, FILTER_BASE_NETWORK, 16, 4, 0xffffffff, FILTER_EQ, addr) : 0;
+
+    return new_node(p, NODE_AND, guard(p, GUARD_IP),
+                    dir == 1 ? src : dir == 2 ? dst : new_node(p, NODE_OR, src, dst));
+}
+
+/* [tcp|udp] [src|dst] port N */
+static int parse_port(parser_t *p, int protocol, int dir) {
+
+    uint32_t port;
+    int src, dst, which;
+
+    if (parse_number(p, &port, UINT16_MAX)) return -1;
+
+    src = dir != 2 ? test(p, FILTER_BASE_TRANSPORT, 0, 2, 0xffff, FILTER_EQ, port) : 0;
+    dst = dir != 1 ? test(p, FILTER_BASE_TRANSPORT, 2, 2, 0xffff, FILTER_EQ, port) : 0;
+    which = dir == 1 ? src : dir == 2 ? dst : new_node(p, NODE_OR, src, dst);
+
+    if (protocol == GUARD_TCP || protocol == GUARD_UDP) {
+        return new_node(p, NODE_AND, guard(p, protocol), which);
+    }
+
+    return new_node(p, NODE_AND, new_node(p, NODE_OR, guard(p, GUARD_TCP), guard(p, GUARD_UDP)),
+                    which);
+}
+
+/* src/dst followed by host or port */
+static int parse_dir(parser_t *p, int protocol, int dir) {
+
+    if (is(p, "host") && protocol == GUARD_NONE) {
+        next(p);
+        return parse_host(p, dir);
+    }
+
+    if (is(p, "port")) {
+        next(p);
+        return parse_port(p, protocol, dir);
+    }
+
+    return fail(p, protocol == GUARD_NONE ? "expected host or port" : "expected port");
+}
+
+/* field op value, e.g. ip.ttl < 64 */
+static int parse_field(parser_t *p) {
+
+    const field_t *field;
+    uint32_t value;
+    uint8_t cmp;
+    int a, b;
+
+    for (field = fields; field->name != NULL; field++) {
+        if (is(p, field->name)) break;
+    }
+
+    if (field->name == NULL) return fail(p, "unknown field or keyword");
+
+    next(p);
+
+    for (cmp = 0; cmp < sizeof(cmp_names) / sizeof(cmp_names[0]); cmp++) {
+        if (is(p, cmp_names[cmp])) break;
+    }
+
+    if (cmp == sizeof(cmp_names) / sizeof(cmp_names[0])) return fail(p, "expected a comparison");
+
+    next(p);
+
+    if (field->size == 4 && field->base == FILTER_BASE_NETWORK) {
+        if (parse_addr(p, &value)) return -1;
+    } else if (parse_number(p, &value, field->size < 4 ? (1u << field->size * 8) - 1 : UINT32_MAX)) {
+        return -1;
+    }
+
+    a = test(p, field->base, field->off, field->size, 0xffffffff, cmp, value);
+
+    /* Either end matches, except != which means neither end does */
+    if (field->other_off >= 0) {
+        b = test(p, field->base, (uint16_t) field->other_off, field->size, 0xffffffff, cmp, value);
+        a = new_node(p, cmp == FILTER_NE ? NODE_AND : NODE_OR, a, b);
+    }
+
+    if (field->guard == GUARD_NONE) return a;
+
+    return new_node(p, NODE_AND, guard(p, field->guard), a);
+}
+
+/* src or dst ahead of host/port, 0 for either */
+static int parse_dir_word(parser_t *p) {
+
+    int dir = is(p, "src") ? 1 : is(p, "dst") ? 2 : 0;
+
+    if (dir) next(p);
+
+    return dir;
+}
+
+static int parse_primitive(parser_t *p) {
+
+    int protocol, dir;
+
+    if (is(p, "ip")) {
+        next(p);
+        return guard(p, GUARD_IP);
+    }
+
+    if (is(p, "arp")) {
+        next(p);
+        return test(p, FILTER_BASE_ETHERTYPE, 0, 2, 0xffff, FILTER_EQ, 0x0806);
+    }
+
+    /* Matches on the ethertype alone, host, port and the fields only look inside IPv4 */
+    if (is(p, "ip6")) {
+        next(p);
+        return test(p, FILTER_BASE_ETHERTYPE, 0, 2, 0xffff, FILTER_EQ, 0x86dd);
+    }
+
+    if (is(p, "vlan")) {
+        next(p);
+        return new_node(p, NODE_OR, test(p, FILTER_BASE_FRAME, 12, 2, 0xffff, FILTER_EQ, 0x8100),
+                        test(p, FILTER_BASE_FRAME, 12, 2, 0xffff, FILTER_EQ, 0x88a8));
+    }
+
+    if (is(p, "icmp")) {
+        next(p);
+        return ip_proto(p, 0x01);
+    }
+
+    if (is(p, "tcp") || is(p, "udp")) {
+
+        protocol = is(p, "tcp") ? GUARD_TCP : GUARD_UDP;
+        next(p);
+
+        /* A protocol on its own also matches later fragments */
+        if (is(p, "port") || is(p, "src") || is(p, "dst")) {
+            dir = parse_dir_word(p);
+            return parse_dir(p, protocol, dir);
+        }
+
+        return ip_proto(p, protocol == GUARD_TCP ? 0x06 : 0x11);
+    }
+
+    if (is(p, "host") || is(p, "port") || is(p, "src") || is(p, "dst")) {
+        dir = parse_dir_word(p);
+        return parse_dir(p, GUARD_NONE, dir);
+    }
+
+    return parse_field(p);
+}
+
+static int parse_or(parser_t *p);
+
+static int parse_not(parser_t *p) {
+
+    int n;
+
+    if (is(p, "not") || is(p, "!")) {
+        next(p);
+        return new_node(p, NODE_NOT, parse_not(p), 0);
+    }
+
+    if (is(p, "(")) {
+
+        next(p);
+
+        if ((n = parse_or(p)) < 0) return -1;
+        if (!is(p, ")")) return fail(p, "expected ')'");
+
+        next(p);
+        return n;
+    }
+
+    if (p->tok_len == 0) return fail(p, "expected an expression");
+
+    return parse_primitive(p);
+}
+
+static int parse_and(parser_t *p) {
+
+    int n = parse_not(p);
+
+    while (n >= 0 && (is(p, "and") || is(p, "&&"))) {
+        next(p);
+        n = new_node(p, NODE_AND, n, parse_not(p));
+    }
+
+    return n;
+}
+
+static int parse_or(parser_t *p) {
+
+    int n = parse_and(p);
+
+    while (n >= 0 && (is(p, "or") || is(p, "||"))) {
+        next(p);
+        n = new_node(p, NODE_OR, n, parse_and(p));
+    }
+
+    return n;
+}
+
+/*
+ * Emits node so that it continues at jt when true and jf when false, and
+ * returns where it starts. Code is emitted back to front, so by the time a
+ * node is emitted everything it can jump to already has a position.
+ */
+static int emit(parser_t *p, int n, int jt, int jf) {
+
+    const node_t *node = &p->nodes[n];
+    int right;
+
+    switch (node->kind) {
+        case NODE_AND:
+            right = emit(p, node->right, jt, jf);
+            return right < 0 ? -1 : emit(p, node->left, right, jf);
+        case NODE_OR:
+            right = emit(p, node->right, jt, jf);
+            return right < 0 ? -1 : emit(p, node->left, jt, right);
+        case NODE_NOT:
+            return emit(p, node->left, jf, jt);
+        default:
+            break;
+    }
+
+    if (p->num_insns == FILTER_MAX_NODES) {
+        return fail(p, "expression too long");
+    }
+
+    p->insns[p->num_insns] = node->test;
+    p->insns[p->num_insns].jt = (uint16_t) jt;
+    p->insns[p->num_insns].jf = (uint16_t) jf;
+
+    return p->num_insns++;
+}
+
+int filter_compile(filter_t *filter, const char *expr, char *errbuf, size_t errlen) {
+
+    parser_t p;
+    filter_insn_t *insn;
+    int root, i, n;
+
+    memset(filter, 0, sizeof(filter_t));
+    memset(&p, 0, sizeof(parser_t));
+
+    p.expr = p.pos = expr;
+    p.errbuf = errbuf;
+    p.errlen = errlen;
+    p.nodes = malloc(FILTER_MAX_NODES * sizeof(node_t));
+    p.insns = malloc(FILTER_MAX_NODES * sizeof(filter_insn_t));
+
+    if (p.nodes == NULL || p.insns == NULL) {
+        perror("malloc");
+        exit(1);
+    }
+
+    next(&p);
+
+    root = parse_or(&p);
+
+    if (root >= 0 && p.tok_len > 0) {
+        root = fail(&p, "unexpected token");
+    }
+
+    if (root >= 0 && emit(&p, root, FILTER_ACCEPT, FILTER_REJECT) < 0) {
+        root = -1;
+    }
+
+    free(p.nodes);
+
+    if (root < 0) {
+        free(p.insns);
+        return -1;
+    }
+
+    /* Flip the program around so it runs front to back, jumps stay forward */
+    n = p.num_insns;
+    filter->insns = malloc(n * sizeof(filter_insn_t));
+
+    if (filter->insns == NULL) {
+        perror("malloc");
+        exit(1);
+    }
+
+    for (i = 0; i < n; i++) {
+
+        insn = &filter->insns[i];
+        *insn = p.insns[n - 1 - i];
+
+        if (insn->jt < FILTER_ACCEPT) insn->jt = (uint16_t) (n - 1 - insn->jt);
+        if (insn->jf < FILTER_ACCEPT) insn->jf = (uint16_t) (n - 1 - insn->jf);
+    }
+
+    filter->len = (uint16_t) n;
+    free(p.insns);
+
+    return 0;
+}
+
+int filter_match(const filter_t *filter, const packet_t *pkt) {
+
+    const uint8_t *data = pkt->data;
+    const filter_insn_t *insn;
+    uint32_t pc = 0, off, value, net = ETH_HEADER_LEN, type;
+    int result, tags;
+
+    /* Step over up to two VLAN tags to find the network header */
+    for (tags = 0; tags < VLAN_MAX_TAGS && net <= pkt->caplen; tags++) {
+
+        type = (uint32_t) data[net - 2] << 8 | data[net - 1];
+
+        if (type != 0x8100 && type != 0x88a8) break;
+
+        net += VLAN_HEADER_LEN;
+    }
+
+    while (pc < filter->len) {
+
+        insn = &filter->insns[pc];
+
+        /* Offsets past the network header depend on the IP header length */
+        if (insn->base == FILTER_BASE_NETWORK) {
+            off = net + insn->off;
+        } else if (insn->base == FILTER_BASE_ETHERTYPE) {
+            off = net - 2 + insn->off;
+        } else if (insn->base == FILTER_BASE_TRANSPORT) {
+            off = pkt->caplen > net ? net + (data[net] & 0xf) * 4 + insn->off : UINT32_MAX - 4;
+        } else {
+            off = insn->off;
+        }
+
+        if (insn->base == FILTER_BASE_LEN) {
+            value = pkt->len;
+        } else if (off + insn->size > pkt->caplen) {
+            pc = insn->jf;
+            continue;
+        } else if (insn->size == 1) {
+            value = data[off];
+        } else if (insn->size == 2) {
+            value = (uint32_t) data[off] << 8 | data[off + 1];
+        } else {
+            value = (uint32_t) data[off] << 24 | (uint32_t) data[off + 1] << 16 |
+                    (uint32_t) data[off + 2] << 8 | data[off + 3];
+        }
+
+        value &= insn->mask;
+
+        switch (insn->cmp) {
+            case FILTER_EQ:
+                result = value == insn->value;
+                break;
+            case FILTER_NE:
+                result = value != insn->value;
+                break;
+            case FILTER_LT:
+                result = value < insn->value;
+                break;
+            case FILTER_LE:
+                result = value <= insn->value;
+                break;
+            case FILTER_GT:
+                result = value > insn->value;
+                break;
+            default:
+                result = value >= insn->value;
+                break;
+        }
+
+        pc = result ? insn->jt : insn->jf;
+    }
+
+    return pc == FILTER_ACCEPT;
+}
+
+void filter_packet(void *arg, int worker, outbuf_t *out, uint32_t pkt_num, const packet_t *pkt) {
+
+    const filter_run_t *run = (const filter_run_t *) arg;
+    int match;
+
+    PROF_BEGIN(PROF_FILTER);
+    match = filter_match(run->filter, pkt);
+    PROF_END();
+
+    if (match) {
+        run->fn(run->arg, worker, out, pkt_num, pkt);
+    }
+}
+
+void filter_free(filter_t *filter) {
+    free(filter->insns);
+    filter->insns = NULL;
+    filter->len = 0;
+}
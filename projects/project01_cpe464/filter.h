@@ -0,0 +1,71 @@
+
+#ifndef PROJECT_1_FILTER_H
+#define PROJECT_1_FILTER_H
+
+#include <stdint.h>
+
+#include "libs/outbuf.h"
+#include "reader.h"
+#include "parallel.h"
+
+/* Jump targets past the end of the program */
+#define FILTER_ACCEPT 0xfffe
+#define FILTER_REJECT 0xffff
+
+/* Where a load's offset counts from. Past the frame start, VLAN tags are skipped first */
+#define FILTER_BASE_FRAME     0
+#define FILTER_BASE_NETWORK   1
+#define FILTER_BASE_TRANSPORT 2
+#define FILTER_BASE_LEN       3
+#define FILTER_BASE_ETHERTYPE 4
+
+#define FILTER_EQ 0
+#define FILTER_NE 1
+#define FILTER_LT 2
+#define FILTER_LE 3
+#define FILTER_GT 4
+#define FILTER_GE 5
+
+/*
+ * One test, load size bytes (big-endian) at base + off, mask them, compare
+ * against value and continue at jt or jf. Jumps only ever go forward, and a
+ * load past the captured bytes takes jf.
+ */
+typedef struct filter_insn {
+    uint8_t base;
+    uint8_t size;
+    uint8_t cmp;
+    uint16_t off;
+    uint16_t jt;
+    uint16_t jf;
+    uint32_t mask;
+    uint32_t value;
+} filter_insn_t;
+
+typedef struct filter {
+    filter_insn_t *insns;
+    uint16_t len;
+} filter_t;
+
+/* Wraps another packet_fn_t, only matching packets get passed on */
+typedef struct filter_run {
+    const filter_t *filter;
+    packet_fn_t fn;
+    void *arg;
+} filter_run_t;
+
+/*
+ * Compiles an expression such as "tcp and port 80" or
+ * "ip.src == 10.0.0.1 and not arp". Returns 0 on success, otherwise -1 with
+ * the reason in errbuf.
+ */
+int filter_compile(filter_t *filter, const char *expr, char *errbuf, size_t errlen);
+
+int filter_match(const filter_t *filter, const packet_t *pkt);
+
+/* packet_fn_t that runs ((filter_run_t *) arg)->fn on the packets that match */
+void filter_packet(void *arg, int worker, outbuf_t *out, uint32_t pkt_num, const packet_t *pkt);
+
+void filter_free(filter_t *filter);
+
+#endif /* PROJECT_1_FILTER_H */
@@ -0,0 +1,371 @@
+
+#include "trace.h"
+
+/* 64-bit multipliers from splitmix64, built up this way to stay valid C89 */
+#define MIX1 ((uint64_t) 0x9e3779b9 << 32 | 0x7f4a7c15)
+#define MIX2 ((uint64_t) 0xbf58476d << 32 | 0x1ce4e5b9)
+
+uint32_t flow_hash(const flow_key_t *key) {
+
+    uint64_t words[4], h = 0;
+    int i;
+
+    /* Both addresses, 8 bytes at a time */
+    memcpy(words, key->src_addr, sizeof(words));
+
+    for (i = 0; i < 4; i++) h = (h ^ words[i]) * MIX1;
+
+    h ^= ((uint64_t) key->src_port << 24 | (uint64_t) key->dst_port << 8 | key->protocol) + (h >> 29);
+    h *= MIX2;
+
+    return (uint32_t) (h >> 32);
+}
+
+/* Keys are always zeroed before being filled in, so unused address bytes match */
+static int flow_key_eq(const flow_key_t *a, const flow_key_t *b) {
+    return memcmp(a, b, sizeof(flow_key_t)) == 0;
+}
+
+void flows_init(flow_table_t *table, uint32_t max_flows) {
+
+    uint32_t size = 16;
+
+    memset(table, 0, sizeof(flow_table_t));
+
+    if (max_flows < 1) max_flows = 1;
+
+    /* Keep the load factor at or under 3/4 */
+    while (size / 4 * 3 < max_flows) size *= 2;
+
+    table->slots = calloc(size, sizeof(flow_t));
+
+    if (table->slots == NULL) {
+        perror("calloc");
+        exit(1);
+    }
+
+    table->mask = size - 1;
+    table->max_flows = max_flows;
+    table->lru_head = table->lru_tail = FLOW_NONE;
+}
+
+void flows_free(flow_table_t *table) {
+    free(table->slots);
+    table->slots = NULL;
+}
+
+static void lru_unlink(flow_table_t *table, uint32_t i) {
+
+    flow_t *flow = &table->slots[i];
+
+    if (flow->prev != FLOW_NONE) table->slots[flow->prev].next = flow->next;
+    else table->lru_head = flow->next;
+
+    if (flow->next != FLOW_NONE) table->slots[flow->next].prev = flow->prev;
+    else table->lru_tail = flow->prev;
+}
+
+static void lru_push(flow_table_t *table, uint32_t i) {
+
+    flow_t *flow = &table->slots[i];
+
+    flow->prev = FLOW_NONE;
+    flow->next = table->lru_head;
+
+    if (table->lru_head != FLOW_NONE) table->slots[table->lru_head].prev = i;
+    else table->lru_tail = i;
+
+    table->lru_head = i;
+}
+
+/* Empties slot i, shifting back any entries that probed past it so lookups never hit a gap */
+static void flow_delete(flow_table_t *table, uint32_t i) {
+
+    uint32_t j = i, home;
+    flow_t *flow;
+
+    lru_unlink(table, i);
+
+    for (;;) {
+
+        j = (j + 1) & table->mask;
+        flow = &table->slots[j];
+
+        if (!flow->used) break;
+
+        home = flow_hash(&flow->key) & table->mask;
+
+        /* The entry at j can fill the gap if the gap is no further from its home slot */
+        if (((j - home) & table->mask) < ((j - i) & table->mask)) continue;
+
+        table->slots[i] = *flow;
+
+        if (flow->prev != FLOW_NONE) table->slots[flow->prev].next = i;
+        else table->lru_head = i;
+
+        if (flow->next != FLOW_NONE) table->slots[flow->next].prev = i;
+        else table->lru_tail = i;
+
+        i = j;
+    }
+
+    table->slots[i].used = 0;
+    table->count--;
+}
+
+static void flow_evict(flow_table_t *table) {
+
+    flow_t *oldest = &table->slots[table->lru_tail];
+
+    table->evicted++;
+    table->evicted_packets += oldest->packets;
+    table->evicted_bytes += oldest->bytes;
+
+    flow_delete(table, table->lru_tail);
+}
+
+/* Finds the flow for key, making room for it if it's new, and marks it most recently seen */
+static flow_t *flow_lookup(flow_table_t *table, const flow_key_t *key) {
+
+    uint32_t i = flow_hash(key) & table->mask;
+    flow_t *flow;
+
+    while (table->slots[i].used) {
+
+        if (flow_key_eq(&table->slots[i].key, key)) {
+            lru_unlink(table, i);
+            lru_push(table, i);
+            return &table->slots[i];
+        }
+
+        i = (i + 1) & table->mask;
+    }
+
+    if (table->count >= table->max_flows) {
+
+        flow_evict(table);
+
+        /* The eviction may have shifted entries, probe again for the new slot */
+        i = flow_hash(key) & table->mask;
+        while (table->slots[i].used) i = (i + 1) & table->mask;
+    }
+
+    flow = &table->slots[i];
+
+    memset(flow, 0, sizeof(flow_t));
+    flow->key = *key;
+    flow->used = 1;
+    table->count++;
+
+    lru_push(table, i);
+
+    return flow;
+}
+
+int flow_key(flow_key_t *key, const packet_info_t *info) {
+
+    if (info->ip == NULL && info->ip6 == NULL) return -1;
+
+    memset(key, 0, sizeof(flow_key_t));
+    key->protocol = info->ip_proto;
+
+    if (info->ip != NULL) {
+        key->version = 4;
+        memcpy(key->src_addr, &info->ip->src_addr, 4);
+        memcpy(key->dst_addr, &info->ip->dst_addr, 4);
+    } else {
+        key->version = 6;
+        memcpy(key->src_addr, info->ip6->src_addr, 16);
+        memcpy(key->dst_addr, info->ip6->dst_addr, 16);
+    }
+
+    if (info->tcp != NULL) {
+        key->src_port = info->tcp->src_port;
+        key->dst_port = info->tcp->dst_port;
+    } else if (info->udp != NULL) {
+        key->src_port = info->udp->src_port;
+        key->dst_port = info->udp->dst_port;
+    }
+
+    return 0;
+}
+
+void flow_conversation(flow_key_t *key) {
+
+    uint8_t addr[16];
+    uint16_t port;
+    int cmp = memcmp(key->src_addr, key->dst_addr, 16);
+
+    if (cmp < 0 || (cmp == 0 && ntohs(key->src_port) <= ntohs(key->dst_port))) return;
+
+    memcpy(addr, key->src_addr, 16);
+    memcpy(key->src_addr, key->dst_addr, 16);
+    memcpy(key->dst_addr, addr, 16);
+
+    port = key->src_port;
+    key->src_port = key->dst_port;
+    key->dst_port = port;
+}
+
+void flows_add(flow_table_t *table, const packet_info_t *info) {
+
+    flow_key_t key;
+    flow_t *flow;
+    uint16_t flags;
+    uint64_t ts = (uint64_t) info->pkt->ts_sec * 1000000000 + info->pkt->ts_nsec;
+
+    if (flow_key(&key, info)) return;
+
+    flow = flow_lookup(table, &key);
+
+    if (flow->packets == 0 || ts < flow->first_ts) flow->first_ts = ts;
+    if (flow->packets == 0 || ts > flow->last_ts) flow->last_ts = ts;
+
+    flow->packets++;
+    flow->bytes += info->pkt->len;
+
+    if (!info->ip_cksum_ok || (info->tcp != NULL && !info->tcp_cksum_ok) ||
+        (info->udp != NULL && !info->udp_cksum_ok) || (info->icmp != NULL && !info->icmp_cksum_ok)) {
+        flow->bad_cksum++;
+    }
+
+    if (info->tcp != NULL) {
+        flags = ntohs(info->tcp->flags);
+        if (flags & 0x02) flow->syn++;
+        if (flags & 0x01) flow->fin++;
+        if (flags & 0x04) flow->rst++;
+    }
+}
+
+void flows_packet(void *arg, int worker, outbuf_t *out, uint32_t pkt_num, const packet_t *pkt) {
+
+    packet_info_t info;
+
+    (void) out;
+    (void) pkt_num;
+
+    dissect_packet(pkt, &info);
+    flows_add(&((flow_table_t *) arg)[worker], &info);
+}
+
+void flows_merge(flow_table_t *dst, const flow_table_t *src) {
+
+    uint32_t i;
+    const flow_t *from;
+    flow_t *to;
+
+    dst->evicted += src->evicted;
+    dst->evicted_packets += src->evicted_packets;
+    dst->evicted_bytes += src->evicted_bytes;
+
+    /* Oldest first, so the most recent flows are the last to be evicted */
+    for (i = src->lru_tail; i != FLOW_NONE; i = from->prev) {
+
+        from = &src->slots[i];
+        to = flow_lookup(dst, &from->key);
+
+        if (to->packets == 0 || from->first_ts < to->first_ts) to->first_ts = from->first_ts;
+        if (to->packets == 0 || from->last_ts > to->last_ts) to->last_ts = from->last_ts;
+
+        to->packets += from->packets;
+        to->bytes += from->bytes;
+        to->syn += from->syn;
+        to->fin += from->fin;
+        to->rst += from->rst;
+        to->bad_cksum += from->bad_cksum;
+    }
+}
+
+static int cmp_bytes(const void *a, const void *b) {
+
+    const flow_t *fa = *(const flow_t *const *) a, *fb = *(const flow_t *const *) b;
+
+    if (fa->bytes != fb->bytes) return fa->bytes < fb->bytes ? 1 : -1;
+    if (fa->first_ts != fb->first_ts) return fa->first_ts < fb->first_ts ? -1 : 1;
+
+    return 0;
+}
+
+void flow_endpoint(outbuf_t *out, int version, const uint8_t *addr, uint16_t port, int has_ports) {
+
+    uint32_t addr4;
+
+    if (version == 4) {
+        memcpy(&addr4, addr, 4);
+        ob_ipv4(out, addr4);
+    } else if (has_ports) {
+        ob_char(out, '[');
+        ob_ipv6(out, addr);
+        ob_char(out, ']');
+    } else {
+        ob_ipv6(out, addr);
+    }
+
+    if (has_ports) {
+        ob_char(out, ':');
+        ob_dec(out, ntohs(port));
+    }
+}
+
+void flows_report(const flow_table_t *table, outbuf_t *out) {
+
+    const flow_t **sorted = malloc((table->count + 1) * sizeof(flow_t *));
+    const flow_t *flow;
+    uint64_t duration;
+    uint32_t i, n = 0;
+    int has_ports;
+
+    if (sorted == NULL) {
+        perror("malloc");
+        exit(1);
+    }
+
+    for (i = 0; i <= table->mask; i++) {
+        if (table->slots[i].used) sorted[n++] = &table->slots[i];
+    }
+
+    qsort(sorted, n, sizeof(flow_t *), cmp_bytes);
+
+    OB_LIT(out, "\tFlows\n\t\tActive: ");
+    ob_dec(out, n);
+    OB_LIT(out, "\n\t\tEvicted: ");
+    ob_dec64(out, table->evicted);
+    OB_LIT(out, " (");
+    ob_dec64(out, table->evicted_packets);
+    OB_LIT(out, " packets, ");
+    ob_dec64(out, table->evicted_bytes);
+    OB_LIT(out, " bytes)\n\n");
+
+    for (i = 0; i < n; i++) {
+
+        flow = sorted[i];
+        duration = flow->last_ts - flow->first_ts;
+        has_ports = flow->key.protocol == 0x6 || flow->key.protocol == 0x11;
+
+        OB_LIT(out, "\t\t");
+        ob_str(out, PROTO_BY_IP_PROTO(flow->key.protocol)->name);
+        ob_char(out, ' ');
+        flow_endpoint(out, flow->key.version, flow->key.src_addr, flow->key.src_port, has_ports);
+        OB_LIT(out, " -> ");
+        flow_endpoint(out, flow->key.version, flow->key.dst_addr, flow->key.dst_port, has_ports);
+        OB_LIT(out, "  Packets: ");
+        ob_dec64(out, flow->packets);
+        OB_LIT(out, "  Bytes: ");
+        ob_dec64(out, flow->bytes);
+        OB_LIT(out, "  Duration: ");
+        ob_dec64(out, duration / 1000000000);
+        ob_char(out, '.');
+        ob_dec_pad(out, (uint32_t) (duration % 1000000000), 9);
+        OB_LIT(out, "  SYN: ");
+        ob_dec(out, flow->syn);
+        OB_LIT(out, "  FIN: ");
+        ob_dec(out, flow->fin);
+        OB_LIT(out, "  RST: ");
+        ob_dec(out, flow->rst);
+        OB_LIT(out, "  Bad Checksums: ");
+        ob_dec(out, flow->bad_cksum);
+        ob_char(out, '\n');
+    }
+
+    free(sorted);
+}
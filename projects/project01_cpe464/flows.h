@@ -0,0 +1,88 @@
+
+#ifndef PROJECT_1_FLOWS_H
+#define PROJECT_1_FLOWS_H
+
+#include <stdint.h>
+
+#include "libs/outbuf.h"
+#include "reader.h"
+
+/* Flows kept at once unless --flows=N says otherwise, about 100 bytes each */
+#define FLOWS_DEFAULT_MAX (1 << 18)
+
+/* Marks the ends of the LRU list */
+#define FLOW_NONE UINT32_MAX
+
+struct packet_info;
+
+/* Directional, the two halves of a conversation are separate flows. IPv4 addresses use the first 4 bytes */
+typedef struct flow_key {
+    uint8_t src_addr[16];
+    uint8_t dst_addr[16];
+    uint16_t src_port;
+    uint16_t dst_port;
+    uint8_t protocol;
+    uint8_t version;
+} flow_key_t;
+
+typedef struct flow {
+    flow_key_t key;
+    uint8_t used;
+
+    uint64_t packets;
+    uint64_t bytes;
+    uint64_t first_ts;
+    uint64_t last_ts;
+    uint32_t syn;
+    uint32_t fin;
+    uint32_t rst;
+    uint32_t bad_cksum;
+
+    /* Neighbours in the LRU list, most recently seen first */
+    uint32_t prev;
+    uint32_t next;
+} flow_t;
+
+/* Open addressing with linear probing, the oldest flow is evicted when full */
+typedef struct flow_table {
+    flow_t *slots;
+    uint32_t mask;
+    uint32_t count;
+    uint32_t max_flows;
+
+    uint32_t lru_head;
+    uint32_t lru_tail;
+
+    /* Totals for everything evicted so far */
+    uint64_t evicted;
+    uint64_t evicted_packets;
+    uint64_t evicted_bytes;
+} flow_table_t;
+
+/* Fills in key from a dissected IP packet, -1 if it has no IP header */
+int flow_key(flow_key_t *key, const struct packet_info *info);
+
+uint32_t flow_hash(const flow_key_t *key);
+
+/* Puts the two ends in a fixed order, so both directions of a conversation get the same key */
+void flow_conversation(flow_key_t *key);
+
+/* Prints an address and, if has_ports, a port (network order) after it, IPv6 in brackets */
+void flow_endpoint(outbuf_t *out, int version, const uint8_t *addr, uint16_t port, int has_ports);
+
+void flows_init(flow_table_t *table, uint32_t max_flows);
+
+void flows_free(flow_table_t *table);
+
+void flows_add(flow_table_t *table, const struct packet_info *info);
+
+/* packet_fn_t that adds to ((flow_table_t *) arg)[worker] instead of printing */
+void flows_packet(void *arg, int worker, outbuf_t *out, uint32_t pkt_num, const packet_t *pkt);
+
+/* Adds every flow in src to dst */
+void flows_merge(flow_table_t *dst, const flow_table_t *src);
+
+/* Lists the flows by bytes, largest first */
+void flows_report(const flow_table_t *table, outbuf_t *out);
+
+#endif /* PROJECT_1_FLOWS_H */
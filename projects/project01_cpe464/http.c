@@ -0,0 +1,267 @@
+
+#include <strings.h>
+
+#include "trace.h"
+
+void http_init(http_parser_t *p) {
+    memset(p, 0, sizeof(http_parser_t));
+    p->state = HTTP_START;
+}
+
+/* Digits at the start of s, in the given base, stopping at the first that isn't one */
+static uint64_t parse_u64(const char *s, int base) {
+
+    uint64_t value = 0;
+    int digit;
+
+    while (*s == ' ' || *s == '\t') s++;
+
+    for (;; s++) {
+
+        if (*s >= '0' && *s <= '9') digit = *s - '0';
+        else if (base == 16 && *s >= 'a' && *s <= 'f') digit = *s - 'a' + 10;
+        else if (base == 16 && *s >= 'A' && *s <= 'F') digit = *s - 'A' + 10;
+        else break;
+
+        /* Anything this big is garbage, treat it as the largest possible */
+        if (value > UINT64_MAX / 16 - 16) return UINT64_MAX;
+
+        value = value * base + digit;
+    }
+
+    return value;
+}
+
+/* Value of the header in line if it's called name, otherwise NULL */
+static const char *header_value(const char *line, const char *name) {
+
+    size_t len = strlen(name);
+
+    if (strncasecmp(line, name, len) != 0 || line[len] != ':') return NULL;
+
+    line += len + 1;
+    while (*line == ' ' || *line == '\t') line++;
+
+    return line;
+}
+
+/* A request line is "METHOD target HTTP/x.y", with the method in capitals */
+static int is_request_line(const char *line) {
+
+    int i;
+
+    for (i = 0; line[i] >= 'A' && line[i] <= 'Z'; i++);
+
+    return i > 0 && i <= 16 && line[i] == ' ' && strstr(line, " HTTP/") != NULL;
+}
+
+static void message_end(http_parser_t *p, outbuf_t *out) {
+
+    if (!p->no_body) {
+        OB_LIT(out, "\t\tBody: ");
+        ob_dec64(out, p->body);
+        OB_LIT(out, " (bytes)\n");
+    }
+
+    p->state = HTTP_START;
+}
+
+static void start_line(http_parser_t *p, outbuf_t *out, const flow_key_t *key) {
+
+    const char *line = p->line;
+    const char *status;
+    int code = 0;
+
+    /* Stray blank lines between messages are allowed */
+    if (line[0] == '\0') return;
+
+    if (strncmp(line, "HTTP/", 5) == 0) {
+        p->is_response = 1;
+    } else if (is_request_line(line)) {
+        p->is_response = 0;
+    } else {
+        p->state = HTTP_NONE;
+        return;
+    }
+
+    if (p->is_response) {
+
+        if ((status = strchr(line, ' ')) != NULL) code = (int) parse_u64(status, 10);
+
+        OB_LIT(out, "\n\tHTTP Response (packet ");
+    } else {
+        OB_LIT(out, "\n\tHTTP Request (packet ");
+    }
+
+    ob_dec(out, p->pkt_num);
+    OB_LIT(out, ")\n\t\tStream: ");
+    flow_endpoint(out, key->version, key->src_addr, key->src_port, 1);
+    OB_LIT(out, " -> ");
+    flow_endpoint(out, key->version, key->dst_addr, key->dst_port, 1);
+    OB_LIT(out, "\n\t\t");
+    ob_str(out, line);
+    ob_char(out, '\n');
+
+    p->state = HTTP_HEADERS;
+    p->chunked = 0;
+    p->has_length = 0;
+    p->remaining = 0;
+    p->body = 0;
+
+    /* Informational, No Content and Not Modified responses never have a body */
+    p->no_body = p->is_response && ((code >= 100 && code < 200) || code == 204 || code == 304);
+}
+
+static void headers_end(http_parser_t *p, outbuf_t *out) {
+
+    if (p->no_body) {
+        message_end(p, out);
+    } else if (p->chunked) {
+        p->state = HTTP_CHUNK_SIZE;
+    } else if (p->has_length) {
+        p->state = HTTP_BODY;
+        if (p->remaining == 0) message_end(p, out);
+    } else if (p->is_response) {
+        p->state = HTTP_UNTIL_CLOSE;
+    } else {
+        /* Requests without a length have no body */
+        p->no_body = 1;
+        message_end(p, out);
+    }
+}
+
+static void header_line(http_parser_t *p, outbuf_t *out) {
+
+    const char *value;
+
+    if (p->line[0] == '\0') {
+        headers_end(p, out);
+        return;
+    }
+
+    OB_LIT(out, "\t\t");
+    ob_str(out, p->line);
+    ob_char(out, '\n');
+
+    if ((value = header_value(p->line, "Content-Length")) != NULL) {
+        p->has_length = 1;
+        p->remaining = parse_u64(value, 10);
+    } else if ((value = header_value(p->line, "Transfer-Encoding")) != NULL) {
+        p->chunked = strstr(value, "chunked") != NULL;
+    }
+}
+
+/* Handles a complete line, without its line ending */
+static void end_line(http_parser_t *p, outbuf_t *out, const flow_key_t *key) {
+
+    switch (p->state) {
+        case HTTP_START:
+            start_line(p, out, key);
+            break;
+        case HTTP_HEADERS:
+            header_line(p, out);
+            break;
+        case HTTP_CHUNK_SIZE:
+            p->remaining = parse_u64(p->line, 16);
+            p->state = p->remaining > 0 ? HTTP_CHUNK_DATA : HTTP_TRAILERS;
+            break;
+        case HTTP_CHUNK_END:
+            p->state = HTTP_CHUNK_SIZE;
+            break;
+        case HTTP_TRAILERS:
+            if (p->line[0] == '\0') message_end(p, out);
+            break;
+    }
+}
+
+void http_parse(http_parser_t *p, outbuf_t *out, const flow_key_t *key, uint32_t pkt_num,
+                const uint8_t *data, uint32_t len) {
+
+    const uint8_t *end = data + len, *eol;
+    uint32_t n;
+
+    while (data < end) {
+
+        switch (p->state) {
+
+            case HTTP_NONE:
+                return;
+
+            case HTTP_UNTIL_CLOSE:
+                p->body += end - data;
+                return;
+
+            case HTTP_BODY:
+            case HTTP_CHUNK_DATA:
+                n = p->remaining < (uint64_t) (end - data) ? (uint32_t) p->remaining : (uint32_t) (end - data);
+
+                p->body += n;
+                p->remaining -= n;
+                data += n;
+
+                if (p->remaining == 0) {
+                    if (p->state == HTTP_BODY) message_end(p, out);
+                    else p->state = HTTP_CHUNK_END;
+                }
+                break;
+
+            default:
+                if (p->line_len == 0) p->pkt_num = pkt_num;
+
+                eol = memchr(data, '\n', end - data);
+                n = (uint32_t) ((eol != NULL ? eol : end) - data);
+
+                /* Keep what fits, with anything unprintable other than CR shown as '.' */
+                for (; n > 0; n--, data++) {
+                    if (p->line_len < HTTP_MAX_LINE - 1) {
+                        p->line[p->line_len++] = (*data >= 0x20 && *data < 0x7f) || *data == '\r' ? (char) *data : '.';
+                    }
+                }
+
+                if (eol == NULL) break;
+
+                data++;
+
+                /* Lines end in CRLF, but a bare LF is taken too */
+                if (p->line_len > 0 && p->line[p->line_len - 1] == '\r') p->line_len--;
+
+                p->line[p->line_len] = '\0';
+
+                for (n = 0; n < p->line_len; n++) {
+                    if (p->line[n] == '\r') p->line[n] = '.';
+                }
+
+                p->line_len = 0;
+
+                end_line(p, out, key);
+                break;
+        }
+    }
+}
+
+void http_gap(http_parser_t *p, outbuf_t *out, uint32_t len) {
+
+    if ((p->state == HTTP_BODY || p->state == HTTP_CHUNK_DATA) && len <= p->remaining) {
+
+        p->remaining -= len;
+        p->body += len;
+
+        /* A gap to the very end of the body or chunk finishes it, as if it had arrived */
+        if (p->remaining == 0) {
+            if (p->state == HTTP_BODY) message_end(p, out);
+            else p->state = HTTP_CHUNK_END;
+        }
+
+    } else if (p->state == HTTP_UNTIL_CLOSE) {
+        p->body += len;
+    } else {
+        p->state = HTTP_NONE;
+    }
+}
+
+void http_close(http_parser_t *p, outbuf_t *out) {
+
+    if (p->state == HTTP_UNTIL_CLOSE) message_end(p, out);
+
+    p->state = HTTP_NONE;
+}
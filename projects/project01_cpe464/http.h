@@ -0,0 +1,55 @@
+
+#ifndef PROJECT_1_HTTP_H
+#define PROJECT_1_HTTP_H
+
+#include <stdint.h>
+
+#include "libs/outbuf.h"
+#include "flows.h"
+
+/* Longest start or header line kept, the rest of a longer line is cut off */
+#define HTTP_MAX_LINE 512
+
+/* Parser states, NONE once a stream turns out not to be HTTP or loses sync */
+#define HTTP_START       0
+#define HTTP_HEADERS     1
+#define HTTP_BODY        2
+#define HTTP_CHUNK_SIZE  3
+#define HTTP_CHUNK_DATA  4
+#define HTTP_CHUNK_END   5
+#define HTTP_TRAILERS    6
+#define HTTP_UNTIL_CLOSE 7
+#define HTTP_NONE        8
+
+/* One direction of a connection, fed its bytes in order by the reassembler */
+typedef struct http_parser {
+    uint8_t state;
+    uint8_t is_response;
+    uint8_t chunked;
+    uint8_t has_length;
+    uint8_t no_body;
+
+    /* Body bytes still to come in the current message or chunk */
+    uint64_t remaining;
+    uint64_t body;
+
+    /* Packet the current line started in */
+    uint32_t pkt_num;
+
+    uint16_t line_len;
+    char line[HTTP_MAX_LINE];
+} http_parser_t;
+
+void http_init(http_parser_t *p);
+
+/* Parses the next len bytes of the stream key, printing messages as their lines complete */
+void http_parse(http_parser_t *p, outbuf_t *out, const flow_key_t *key, uint32_t pkt_num,
+                const uint8_t *data, uint32_t len);
+
+/* len bytes of the stream were lost, a body can skip them but anything else gives up */
+void http_gap(http_parser_t *p, outbuf_t *out, uint32_t len);
+
+/* The stream ended, finishing a body that runs until close */
+void http_close(http_parser_t *p, outbuf_t *out);
+
+#endif /* PROJECT_1_HTTP_H */
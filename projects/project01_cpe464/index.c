@@ -0,0 +1,220 @@
+
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "trace.h"
+
+/* 64-bit FNV-1a offset basis and prime, built up this way to stay valid C89 */
+#define FNV_BASIS ((uint64_t) 0xcbf29ce4 << 32 | 0x84222325)
+#define FNV_PRIME ((uint64_t) 0x00000100 << 32 | 0x000001b3)
+
+#define ENTRY_TS(e) ((uint64_t) (e)->ts_sec * 1000000000 + (e)->ts_nsec)
+
+static uint64_t fingerprint(int fd, off_t size) {
+
+    uint8_t buf[INDEX_FINGERPRINT_LEN];
+    uint64_t h = FNV_BASIS;
+    ssize_t len, i;
+
+    len = pread(fd, buf, size < (off_t) sizeof(buf) ? (size_t) size : sizeof(buf), 0);
+
+    for (i = 0; i < len; i++) h = (h ^ buf[i]) * FNV_PRIME;
+
+    return h;
+}
+
+static void add_entry(index_t *index, off_t offset, const packet_t *pkt) {
+
+    index_entry_t *entry;
+
+    if (index->num_entries == index->max_entries) {
+
+        index->max_entries = index->max_entries ? index->max_entries * 2 : 1024;
+        index->entries = realloc(index->entries, index->max_entries * sizeof(index_entry_t));
+
+        if (index->entries == NULL) {
+            perror("realloc");
+            exit(1);
+        }
+    }
+
+    entry = &index->entries[index->num_entries++];
+
+    entry->offset = (uint64_t) offset;
+    entry->ts_sec = pkt->ts_sec;
+    entry->ts_nsec = pkt->ts_nsec;
+}
+
+/* Reads the index in name if it still describes the capture, returns -1 if it has to be rebuilt */
+static int index_load(index_t *index, const char *name, uint64_t print, off_t size, uint32_t stride) {
+
+    index_header_t *header = &index->header;
+    uint64_t num;
+    ssize_t len;
+    int fd = open(name, O_RDONLY);
+
+    if (fd < 0) return -1;
+
+    if (pread(fd, header, sizeof(index_header_t), 0) != (ssize_t) sizeof(index_header_t) ||
+        header->magic != INDEX_MAGIC || header->version != INDEX_VERSION || header->stride == 0 ||
+        (stride != 0 && header->stride != stride) || header->fingerprint != print ||
+        header->covered > (uint64_t) size) {
+        close(fd);
+        return -1;
+    }
+
+    num = (header->packets + header->stride - 1) / header->stride;
+
+    index->entries = malloc((num + 1) * sizeof(index_entry_t));
+
+    if (index->entries == NULL) {
+        perror("malloc");
+        exit(1);
+    }
+
+    len = pread(fd, index->entries, num * sizeof(index_entry_t), sizeof(index_header_t));
+    close(fd);
+
+    if (len != (ssize_t) (num * sizeof(index_entry_t))) {
+        free(index->entries);
+        index->entries = NULL;
+        return -1;
+    }
+
+    index->num_entries = num;
+    index->max_entries = num + 1;
+
+    return 0;
+}
+
+/* Writes the entries from first on, then the header, so an interrupted save leaves the old index intact */
+static void index_save(const index_t *index, const char *name, uint64_t first) {
+
+    size_t len = (index->num_entries - first) * sizeof(index_entry_t);
+    int fd = open(name, O_WRONLY | O_CREAT | (first == 0 ? O_TRUNC : 0), 0644);
+
+    if (fd < 0 ||
+        pwrite(fd, &index->entries[first], len, sizeof(index_header_t) + first * sizeof(index_entry_t)) != (ssize_t) len ||
+        pwrite(fd, &index->header, sizeof(index_header_t), 0) != (ssize_t) sizeof(index_header_t)) {
+        fprintf(stderr, "WARN: Couldn't save index %s: %s\n", name, strerror(errno));
+    }
+
+    if (fd >= 0) close(fd);
+}
+
+int index_update(index_t *index, const char *path, uint32_t stride, char *errbuf, size_t errlen) {
+
+    index_header_t *header = &index->header;
+    reader_t r;
+    packet_t pkt;
+    char *name;
+    uint64_t print, first, packets, ts;
+    off_t pos;
+
+    memset(index, 0, sizeof(index_t));
+
+    if (reader_open(&r, path)) {
+        snprintf(errbuf, errlen, "%s", r.errbuf);
+        return -1;
+    }
+
+    if (r.kind != READER_MMAP || r.zs != NULL) {
+        snprintf(errbuf, errlen, "only uncompressed classic pcap captures can be indexed");
+        reader_close(&r);
+        return -1;
+    }
+
+    name = malloc(strlen(path) + sizeof(INDEX_SUFFIX));
+
+    if (name == NULL) {
+        perror("malloc");
+        exit(1);
+    }
+
+    sprintf(name, "%s%s", path, INDEX_SUFFIX);
+
+    print = fingerprint(r.fd, r.file_size);
+
+    if (index_load(index, name, print, r.file_size, stride)) {
+        memset(header, 0, sizeof(index_header_t));
+        header->magic = INDEX_MAGIC;
+        header->version = INDEX_VERSION;
+        header->stride = stride ? stride : INDEX_DEFAULT_STRIDE;
+        header->fingerprint = print;
+        header->covered = (uint64_t) r.pos;
+    }
+
+    first = index->num_entries;
+    packets = header->packets;
+
+    /* Only the records after the indexed part are read */
+    reader_seek(&r, (off_t) header->covered);
+    pos = r.pos;
+
+    /* A record cut short at the end is probably still being written, the next update picks it up */
+    while (reader_next(&r, &pkt) > 0) {
+
+        if (header->packets % header->stride == 0) add_entry(index, pos, &pkt);
+
+        ts = (uint64_t) pkt.ts_sec * 1000000000 + pkt.ts_nsec;
+
+        if (header->packets > 0 && ts < header->last_ts) header->flags |= INDEX_UNORDERED;
+
+        header->last_ts = ts;
+        header->packets++;
+        pos = r.pos;
+    }
+
+    header->covered = (uint64_t) pos;
+    index->added = index->num_entries - first;
+
+    if (first == 0 || header->packets != packets) index_save(index, name, first);
+
+    free(name);
+    reader_close(&r);
+
+    return 0;
+}
+
+int index_seek_packet(const index_t *index, reader_t *r, uint64_t num) {
+
+    uint64_t i = num / index->header.stride, skip;
+    packet_t pkt;
+
+    if (i >= index->num_entries) return -1;
+
+    reader_seek(r, (off_t) index->entries[i].offset);
+
+    for (skip = num - i * index->header.stride; skip > 0; skip--) {
+        if (reader_next(r, &pkt) <= 0) return -1;
+    }
+
+    return 0;
+}
+
+uint64_t index_seek_time(const index_t *index, reader_t *r, uint64_t ts) {
+
+    uint64_t lo = 0, hi = index->num_entries, mid;
+
+    if (index->header.flags & INDEX_UNORDERED) hi = 0;
+
+    /* First entry at or after ts, the record wanted may be in the stride before it */
+    while (lo < hi) {
+
+        mid = lo + (hi - lo) / 2;
+
+        if (ENTRY_TS(&index->entries[mid]) < ts) lo = mid + 1;
+        else hi = mid;
+    }
+
+    if (lo > 0) lo--;
+
+    if (lo < index->num_entries) reader_seek(r, (off_t) index->entries[lo].offset);
+
+    return lo * index->header.stride;
+}
+
+void index_free(index_t *index) {
+    free(index->entries);
+    index->entries = NULL;
+}
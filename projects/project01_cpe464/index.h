@@ -0,0 +1,76 @@
+
+#ifndef PROJECT_1_INDEX_H
+#define PROJECT_1_INDEX_H
+
+#include <stdint.h>
+
+#include "reader.h"
+
+/* Kept next to the capture, "file.pcap" is indexed in "file.pcap.tidx" */
+#define INDEX_SUFFIX ".tidx"
+
+#define INDEX_MAGIC   0x58444954 /* "TIDX" */
+#define INDEX_VERSION 1
+
+/* Every 64th record unless --index=N says otherwise, a seek then reads at most 63 records ahead */
+#define INDEX_DEFAULT_STRIDE 64
+
+/* Leading bytes of the capture hashed to notice when it's been replaced rather than appended to */
+#define INDEX_FINGERPRINT_LEN 4096
+
+/* Set once a record is found with an earlier timestamp than the one before it */
+#define INDEX_UNORDERED 0x1
+
+/* 48 bytes, followed by the entries. Host byte order, the magic shows if it doesn't match */
+typedef struct index_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t stride;
+    uint32_t flags;
+    uint64_t fingerprint;
+
+    /* Bytes of the capture and records in them indexed so far, and the last one's timestamp */
+    uint64_t covered;
+    uint64_t packets;
+    uint64_t last_ts;
+} index_header_t;
+
+/* Where record i * stride starts, and its timestamp */
+typedef struct index_entry {
+    uint64_t offset;
+    uint32_t ts_sec;
+    uint32_t ts_nsec;
+} index_entry_t;
+
+typedef struct index {
+    index_header_t header;
+    index_entry_t *entries;
+    uint64_t num_entries;
+    uint64_t max_entries;
+
+    /* Entries added by the last index_update() */
+    uint64_t added;
+} index_t;
+
+/*
+ * Loads the index of a classic pcap capture and indexes any records added
+ * since it was written, building it from scratch if it's missing, stale or
+ * uses a different stride. stride 0 keeps the existing one. Returns 0 on
+ * success, otherwise -1 with the reason in errbuf. Failing to save the file
+ * is only a warning, the index is still usable.
+ */
+int index_update(index_t *index, const char *path, uint32_t stride, char *errbuf, size_t errlen);
+
+/* Positions r at record num, counting from 0. Returns -1 if the capture is shorter */
+int index_seek_packet(const index_t *index, reader_t *r, uint64_t num);
+
+/*
+ * Positions r at or before the first record from ts (nanoseconds) on and
+ * returns that record's number. Captures not in time order start from the
+ * first record.
+ */
+uint64_t index_seek_time(const index_t *index, reader_t *r, uint64_t ts);
+
+void index_free(index_t *index);
+
+#endif /* PROJECT_1_INDEX_H */
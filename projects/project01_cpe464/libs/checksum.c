@@ -34,8 +34,18 @@
  * SUCH DAMAGE.
  */
 
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
 #include <sys/types.h>
 
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CKSUM_X86
+#endif
+
+#include "checksum.h"
+
 /* Used for TCP and IP
  *
  * Checking an IP Header:
@@ -47,11 +57,26 @@
  *  - next time in class :/
  */
 
+/* Vector loops flush their 32-bit lanes into a 64-bit sum after this many
+ * loads. Each lane gains at most 2 * 0xffff per load, so the two accumulators
+ * can still be added together without overflowing. */
+#define CKSUM_MAX_LOADS 16384
+
+/* Inputs shorter than this don't fill a vector load, so they skip the dispatch */
+#define CKSUM_MIN_VECTOR 32
+
+/* Every kernel returns a wide, unfolded one's complement sum of 16-bit words */
+typedef struct cksum_kernel {
+    const char *name;
+    uint64_t (*sum)(const uint8_t *p, size_t len);
+    uint64_t (*copy)(uint8_t *dst, const uint8_t *src, size_t len);
+} cksum_kernel_t;
+
 /*
- * in_cksum --
+ * in_cksum_scalar --
  *      Checksum routine for Internet Protocol family headers (C Version)
  */
-unsigned short  in_cksum(unsigned short *addr, int len) {
+unsigned short in_cksum_scalar(unsigned short *addr, int len) {
     register int sum = 0;
     u_short answer = 0;
     register u_short *w = addr;
@@ -80,4 +105,422 @@ unsigned short  in_cksum(unsigned short *addr, int len) {
     return (answer);
 }
 
+/* Adds up 16-bit words the same way in_cksum_scalar() does, also used for
+ * whatever the vector loops leave behind */
+static uint64_t cksum_sum_scalar(const uint8_t *p, size_t nleft) {
+
+    uint64_t sum = 0;
+    uint16_t word;
+
+    while (nleft > 1) {
+        memcpy(&word, p, 2);
+        sum += word;
+        p += 2;
+        nleft -= 2;
+    }
+
+    /* The odd byte goes in the first byte of a zeroed word */
+    if (nleft == 1) {
+        word = 0;
+        memcpy(&word, p, 1);
+        sum += word;
+    }
+
+    return sum;
+}
+
+/* cksum_sum_scalar() that also copies each word to dst as it goes */
+static uint64_t cksum_copy_scalar(uint8_t *dst, const uint8_t *src, size_t nleft) {
+
+    uint64_t sum = 0;
+    uint16_t word;
+
+    while (nleft > 1) {
+        memcpy(&word, src, 2);
+        memcpy(dst, &word, 2);
+        sum += word;
+        src += 2;
+        dst += 2;
+        nleft -= 2;
+    }
+
+    if (nleft == 1) {
+        word = 0;
+        memcpy(&word, src, 1);
+        *dst = *src;
+        sum += word;
+    }
+
+    return sum;
+}
+
+/* Folds a wide one's complement sum down to 16 bits */
+static uint16_t cksum_fold16(uint64_t sum) {
+
+    while (sum >> 16) {
+        sum = (sum >> 16) + (sum & 0xffff);
+    }
+
+    return (uint16_t) sum;
+}
+
+/* Folds a wide one's complement sum down to 16 bits and complements it */
+static unsigned short cksum_fold(uint64_t sum) {
+    return (unsigned short) ~cksum_fold16(sum);
+}
+
+#ifdef CKSUM_X86
+
+/*
+ * The vector kernels split every 32-bit lane into its low and high 16-bit
+ * words and add them into 32-bit accumulators. One's complement addition is
+ * commutative, so the lanes can be summed in any order and folded at the end.
+ */
+
+__attribute__((target("sse2")))
+static uint64_t cksum_sum_sse2(const uint8_t *p, size_t nleft) {
+
+    size_t loads;
+    uint64_t sum = 0;
+    uint32_t lanes[4];
+
+    __m128i mask = _mm_set1_epi32(0xffff);
+    __m128i acc0, acc1, v0, v1;
+
+    while (nleft >= 32) {
+
+        loads = nleft / 32;
+        if (loads > CKSUM_MAX_LOADS) loads = CKSUM_MAX_LOADS;
+        nleft -= loads * 32;
+
+        acc0 = _mm_setzero_si128();
+        acc1 = _mm_setzero_si128();
+
+        /* Two independent accumulators keep both load ports busy */
+        while (loads--) {
+            v0 = _mm_loadu_si128((const __m128i *) p);
+            v1 = _mm_loadu_si128((const __m128i *) (p + 16));
+
+            acc0 = _mm_add_epi32(acc0, _mm_and_si128(v0, mask));
+            acc0 = _mm_add_epi32(acc0, _mm_srli_epi32(v0, 16));
+            acc1 = _mm_add_epi32(acc1, _mm_and_si128(v1, mask));
+            acc1 = _mm_add_epi32(acc1, _mm_srli_epi32(v1, 16));
+
+            p += 32;
+        }
+
+        _mm_storeu_si128((__m128i *) lanes, _mm_add_epi32(acc0, acc1));
+        sum += (uint64_t) lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    }
+
+    return sum + cksum_sum_scalar(p, nleft);
+}
+
+__attribute__((target("sse2")))
+static uint64_t cksum_copy_sse2(uint8_t *dst, const uint8_t *src, size_t nleft) {
+
+    size_t loads;
+    uint64_t sum = 0;
+    uint32_t lanes[4];
+
+    __m128i mask = _mm_set1_epi32(0xffff);
+    __m128i acc0, acc1, v0, v1;
+
+    while (nleft >= 32) {
+
+        loads = nleft / 32;
+        if (loads > CKSUM_MAX_LOADS) loads = CKSUM_MAX_LOADS;
+        nleft -= loads * 32;
+
+        acc0 = _mm_setzero_si128();
+        acc1 = _mm_setzero_si128();
+
+        while (loads--) {
+            v0 = _mm_loadu_si128((const __m128i *) src);
+            v1 = _mm_loadu_si128((const __m128i *) (src + 16));
+
+            _mm_storeu_si128((__m128i *) dst, v0);
+            _mm_storeu_si128((__m128i *) (dst + 16), v1);
+
+            acc0 = _mm_add_epi32(acc0, _mm_and_si128(v0, mask));
+            acc0 = _mm_add_epi32(acc0, _mm_srli_epi32(v0, 16));
+            acc1 = _mm_add_epi32(acc1, _mm_and_si128(v1, mask));
+            acc1 = _mm_add_epi32(acc1, _mm_srli_epi32(v1, 16));
+
+            src += 32;
+            dst += 32;
+        }
+
+        _mm_storeu_si128((__m128i *) lanes, _mm_add_epi32(acc0, acc1));
+        sum += (uint64_t) lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    }
+
+    return sum + cksum_copy_scalar(dst, src, nleft);
+}
+
+__attribute__((target("avx2")))
+static uint64_t cksum_sum_avx2(const uint8_t *p, size_t nleft) {
+
+    size_t loads, i;
+    uint64_t sum = 0;
+    uint32_t lanes[8];
+
+    __m256i mask = _mm256_set1_epi32(0xffff);
+    __m256i acc0, acc1, v0, v1;
+
+    while (nleft >= 64) {
+
+        loads = nleft / 64;
+        if (loads > CKSUM_MAX_LOADS) loads = CKSUM_MAX_LOADS;
+        nleft -= loads * 64;
+
+        acc0 = _mm256_setzero_si256();
+        acc1 = _mm256_setzero_si256();
+
+        while (loads--) {
+            v0 = _mm256_loadu_si256((const __m256i *) p);
+            v1 = _mm256_loadu_si256((const __m256i *) (p + 32));
+
+            acc0 = _mm256_add_epi32(acc0, _mm256_and_si256(v0, mask));
+            acc0 = _mm256_add_epi32(acc0, _mm256_srli_epi32(v0, 16));
+            acc1 = _mm256_add_epi32(acc1, _mm256_and_si256(v1, mask));
+            acc1 = _mm256_add_epi32(acc1, _mm256_srli_epi32(v1, 16));
+
+            p += 64;
+        }
+
+        _mm256_storeu_si256((__m256i *) lanes, _mm256_add_epi32(acc0, acc1));
+        for (i = 0; i < 8; i++) sum += lanes[i];
+    }
+
+    /* One more 32 byte load if it fits. Handing the rest to the SSE2 kernel
+     * instead would pay for an AVX to SSE transition on every packet. */
+    if (nleft >= 32) {
+        v0 = _mm256_loadu_si256((const __m256i *) p);
+        acc0 = _mm256_add_epi32(_mm256_and_si256(v0, mask), _mm256_srli_epi32(v0, 16));
+
+        _mm256_storeu_si256((__m256i *) lanes, acc0);
+        for (i = 0; i < 8; i++) sum += lanes[i];
+
+        p += 32;
+        nleft -= 32;
+    }
+
+    return sum + cksum_sum_scalar(p, nleft);
+}
+
+__attribute__((target("avx2")))
+static uint64_t cksum_copy_avx2(uint8_t *dst, const uint8_t *src, size_t nleft) {
+
+    size_t loads, i;
+    uint64_t sum = 0;
+    uint32_t lanes[8];
+
+    __m256i mask = _mm256_set1_epi32(0xffff);
+    __m256i acc0, acc1, v0, v1;
+
+    while (nleft >= 64) {
+
+        loads = nleft / 64;
+        if (loads > CKSUM_MAX_LOADS) loads = CKSUM_MAX_LOADS;
+        nleft -= loads * 64;
+
+        acc0 = _mm256_setzero_si256();
+        acc1 = _mm256_setzero_si256();
+
+        while (loads--) {
+            v0 = _mm256_loadu_si256((const __m256i *) src);
+            v1 = _mm256_loadu_si256((const __m256i *) (src + 32));
+
+            _mm256_storeu_si256((__m256i *) dst, v0);
+            _mm256_storeu_si256((__m256i *) (dst + 32), v1);
+
+            acc0 = _mm256_add_epi32(acc0, _mm256_and_si256(v0, mask));
+            acc0 = _mm256_add_epi32(acc0, _mm256_srli_epi32(v0, 16));
+            acc1 = _mm256_add_epi32(acc1, _mm256_and_si256(v1, mask));
+            acc1 = _mm256_add_epi32(acc1, _mm256_srli_epi32(v1, 16));
+
+            src += 64;
+            dst += 64;
+        }
+
+        _mm256_storeu_si256((__m256i *) lanes, _mm256_add_epi32(acc0, acc1));
+        for (i = 0; i < 8; i++) sum += lanes[i];
+    }
+
+    if (nleft >= 32) {
+        v0 = _mm256_loadu_si256((const __m256i *) src);
+        _mm256_storeu_si256((__m256i *) dst, v0);
+        acc0 = _mm256_add_epi32(_mm256_and_si256(v0, mask), _mm256_srli_epi32(v0, 16));
+
+        _mm256_storeu_si256((__m256i *) lanes, acc0);
+        for (i = 0; i < 8; i++) sum += lanes[i];
+
+        src += 32;
+        dst += 32;
+        nleft -= 32;
+    }
+
+    return sum + cksum_copy_scalar(dst, src, nleft);
+}
+
+unsigned short in_cksum_sse2(unsigned short *addr, int len) {
+    return cksum_fold(cksum_sum_sse2((const uint8_t *) addr, len > 0 ? (size_t) len : 0));
+}
+
+unsigned short in_cksum_avx2(unsigned short *addr, int len) {
+    return cksum_fold(cksum_sum_avx2((const uint8_t *) addr, len > 0 ? (size_t) len : 0));
+}
+
+#endif /* CKSUM_X86 */
+
+static const cksum_kernel_t cksum_scalar = {"scalar", cksum_sum_scalar, cksum_copy_scalar};
+
+#ifdef CKSUM_X86
+static const cksum_kernel_t cksum_sse2 = {"sse2", cksum_sum_sse2, cksum_copy_sse2};
+
+static const cksum_kernel_t cksum_avx2 = {"avx2", cksum_sum_avx2, cksum_copy_avx2};
+#endif
+
+static const cksum_kernel_t *cksum_impl = NULL;
+
+static const cksum_kernel_t *cksum_select(void) {
+
+#ifdef CKSUM_X86
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx2")) return &cksum_avx2;
+    if (__builtin_cpu_supports("sse2")) return &cksum_sse2;
+#endif
+
+    return &cksum_scalar;
+}
+
+/* Pick a kernel once at startup rather than checking CPUID on every call */
+__attribute__((constructor))
+static void cksum_init(void) {
+    cksum_impl = cksum_select();
+}
+
+/* Covers calls made before cksum_init() has run, e.g. from other constructors */
+static const cksum_kernel_t *cksum_get_kernel(void) {
+
+    if (cksum_impl == NULL) {
+        cksum_impl = cksum_select();
+    }
+
+    return cksum_impl;
+}
+
+/*
+ * in_cksum --
+ *      Returns the same result as in_cksum_scalar() for any buffer
+ */
+unsigned short in_cksum(unsigned short *addr, int len) {
+
+    /*
+     * Headers shorter than one vector load are quicker without the indirect
+     * call. Not in_cksum_scalar(), addr needn't be 2-byte aligned
+     */
+    if (len < CKSUM_MIN_VECTOR) {
+        return cksum_fold(cksum_sum_scalar((const uint8_t *) addr, len > 0 ? (size_t) len : 0));
+    }
+
+    return cksum_fold(cksum_get_kernel()->sum((const uint8_t *) addr, (size_t) len));
+}
+
+/*
+ * in_cksum_partial --
+ *      Adds len bytes of buf onto a running sum, like the kernel's
+ *      csum_partial(). Start with a sum of 0 and finish with in_cksum_fold().
+ *      buf is summed as if it started on an even byte, see
+ *      in_cksum_block_add() for pieces that don't.
+ */
+unsigned int in_cksum_partial(const void *buf, int len, unsigned int sum) {
+
+    uint64_t total = sum;
+
+    if (len <= 0) return sum;
+
+    if (len < CKSUM_MIN_VECTOR) {
+        total += cksum_sum_scalar((const uint8_t *) buf, (size_t) len);
+    } else {
+        total += cksum_get_kernel()->sum((const uint8_t *) buf, (size_t) len);
+    }
+
+    return cksum_fold16(total);
+}
+
+/*
+ * in_cksum_partial_copy --
+ *      in_cksum_partial() of src that also copies it to dst in the same pass,
+ *      like the kernel's csum_partial_copy(). The buffers must not overlap.
+ */
+unsigned int in_cksum_partial_copy(void *dst, const void *src, int len, unsigned int sum) {
+
+    uint64_t total = sum;
+
+    if (len <= 0) return sum;
 
+    if (len < CKSUM_MIN_VECTOR) {
+        total += cksum_copy_scalar((uint8_t *) dst, (const uint8_t *) src, (size_t) len);
+    } else {
+        total += cksum_get_kernel()->copy((uint8_t *) dst, (const uint8_t *) src, (size_t) len);
+    }
+
+    return cksum_fold16(total);
+}
+
+/*
+ * in_cksum_block_add --
+ *      Adds the partial sum of a piece that starts offset bytes into the
+ *      checksummed buffer. A piece starting on an odd byte has all of its
+ *      words shifted by one byte, which swaps the bytes of its sum.
+ */
+unsigned int in_cksum_block_add(unsigned int sum, unsigned int sum2, int offset) {
+
+    uint16_t folded = cksum_fold16(sum2);
+
+    if (offset & 1) {
+        folded = (uint16_t) ((folded << 8) | (folded >> 8));
+    }
+
+    return cksum_fold16((uint64_t) sum + folded);
+}
+
+/* Finishes a partial sum, the result is what in_cksum() would have returned */
+unsigned short in_cksum_fold(unsigned int sum) {
+    return cksum_fold(sum);
+}
+
+/*
+ * in_cksum_update --
+ *      Incremental update from RFC 1624 (eqn. 3), HC' = ~(~HC + ~m + m').
+ *      Returns the new checksum after the 16-bit word old_word, as it sits in
+ *      memory, is replaced by new_word. Matches recomputing the checksum with
+ *      in_cksum() unless every covered byte ends up zero.
+ */
+unsigned short in_cksum_update(unsigned short cksum, unsigned short old_word, unsigned short new_word) {
+
+    uint32_t sum = (uint16_t) ~cksum;
+
+    sum += (uint16_t) ~old_word;
+    sum += new_word;
+
+    return cksum_fold(sum);
+}
+
+/* Same as in_cksum_update() for an aligned 32-bit field, covering both of its words */
+unsigned short in_cksum_update32(unsigned short cksum, unsigned int old_val, unsigned int new_val) {
+
+    uint32_t sum = (uint16_t) ~cksum;
+
+    sum += (uint16_t) ~(old_val >> 16) + (uint16_t) ~(old_val & 0xffff);
+    sum += (new_val >> 16) + (new_val & 0xffff);
+
+    return cksum_fold(sum);
+}
+
+const char *in_cksum_kernel(void) {
+    return cksum_get_kernel()->name;
+}
@@ -0,0 +1,286 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "outbuf.h"
+
+/* Worst case for any single formatted value, a full IPv6 address is 39 characters */
+#define OB_MAX_FIELD 48
+
+/* Two decimal digits for every value from 0 to 99 */
+static const char dec_pairs[] =
+        "00010203040506070809"
+        "10111213141516171819"
+        "20212223242526272829"
+        "30313233343536373839"
+        "40414243444546474849"
+        "50515253545556575859"
+        "60616263646566676869"
+        "70717273747576777879"
+        "80818283848586878889"
+        "90919293949596979899";
+
+static const char hex_digits[] = "0123456789abcdef";
+
+static void write_all(int fd, const char *buf, size_t len) {
+
+    ssize_t ret;
+
+    while (len > 0) {
+
+        ret = write(fd, buf, len);
+
+        if (ret < 0) {
+            if (errno == EINTR) continue;
+            perror("write");
+            exit(1);
+        }
+
+        buf += ret;
+        len -= (size_t) ret;
+    }
+}
+
+/* Makes room for at least n more bytes, flushing or growing the buffer */
+static char *ob_reserve(outbuf_t *ob, size_t n) {
+
+    if (ob->len + n <= ob->cap) {
+        return &ob->buf[ob->len];
+    }
+
+    if (ob->fd >= 0) {
+        ob_flush(ob);
+    }
+
+    if (ob->len + n > ob->cap) {
+
+        while (ob->len + n > ob->cap) ob->cap *= 2;
+
+        ob->buf = realloc(ob->buf, ob->cap);
+
+        if (ob->buf == NULL) {
+            perror("realloc");
+            exit(1);
+        }
+    }
+
+    return &ob->buf[ob->len];
+}
+
+void ob_init(outbuf_t *ob, int fd, size_t cap) {
+
+    ob->fd = fd;
+    ob->len = 0;
+    ob->cap = cap > OB_MAX_FIELD ? cap : OB_MAX_FIELD;
+    ob->buf = malloc(ob->cap);
+
+    if (ob->buf == NULL) {
+        perror("malloc");
+        exit(1);
+    }
+}
+
+void ob_flush(outbuf_t *ob) {
+
+    if (ob->fd >= 0 && ob->len > 0) {
+        write_all(ob->fd, ob->buf, ob->len);
+        ob->len = 0;
+    }
+}
+
+void ob_free(outbuf_t *ob) {
+
+    ob_flush(ob);
+
+    free(ob->buf);
+    ob->buf = NULL;
+    ob->len = ob->cap = 0;
+}
+
+void ob_reset(outbuf_t *ob) {
+    ob->len = 0;
+}
+
+void ob_write_to(const outbuf_t *ob, int fd) {
+    write_all(fd, ob->buf, ob->len);
+}
+
+void ob_write(outbuf_t *ob, const char *str, size_t len) {
+
+    /* Anything bigger than the buffer goes straight out */
+    if (ob->fd >= 0 && len >= ob->cap) {
+        ob_flush(ob);
+        write_all(ob->fd, str, len);
+        return;
+    }
+
+    memcpy(ob_reserve(ob, len), str, len);
+    ob->len += len;
+}
+
+void ob_str(outbuf_t *ob, const char *str) {
+    ob_write(ob, str, strlen(str));
+}
+
+void ob_char(outbuf_t *ob, char c) {
+    *ob_reserve(ob, 1) = c;
+    ob->len++;
+}
+
+/* Formats val right to left into the end of tmp, returns where it starts */
+static char *fmt_dec(char *end, uint64_t val) {
+
+    char *p = end;
+
+    while (val >= 100) {
+        p -= 2;
+        memcpy(p, &dec_pairs[(size_t) (val % 100) * 2], 2);
+        val /= 100;
+    }
+
+    if (val >= 10) {
+        p -= 2;
+        memcpy(p, &dec_pairs[(size_t) val * 2], 2);
+    } else {
+        *--p = (char) ('0' + (int) val);
+    }
+
+    return p;
+}
+
+void ob_dec(outbuf_t *ob, uint32_t val) {
+
+    char tmp[10], *start = fmt_dec(&tmp[sizeof(tmp)], val);
+
+    ob_write(ob, start, &tmp[sizeof(tmp)] - start);
+}
+
+void ob_dec64(outbuf_t *ob, uint64_t val) {
+
+    char tmp[20], *start = fmt_dec(&tmp[sizeof(tmp)], val);
+
+    ob_write(ob, start, &tmp[sizeof(tmp)] - start);
+}
+
+void ob_dec_pad(outbuf_t *ob, uint32_t val, int width) {
+
+    char tmp[10], *start = fmt_dec(&tmp[sizeof(tmp)], val);
+
+    while (&tmp[sizeof(tmp)] - start < width && start > tmp) *--start = '0';
+
+    ob_write(ob, start, &tmp[sizeof(tmp)] - start);
+}
+
+void ob_hex(outbuf_t *ob, uint32_t val) {
+
+    char tmp[8], *p = &tmp[sizeof(tmp)];
+
+    do {
+        *--p = hex_digits[val & 0xf];
+        val >>= 4;
+    } while (val);
+
+    ob_write(ob, p, &tmp[sizeof(tmp)] - p);
+}
+
+void ob_mac(outbuf_t *ob, const uint8_t *mac) {
+
+    char *out = ob_reserve(ob, OB_MAX_FIELD), *p = out;
+    int i;
+
+    for (i = 0; i < 6; i++) {
+
+        if (i) *p++ = ':';
+
+        /* No leading zero, same as %x */
+        if (mac[i] >= 0x10) *p++ = hex_digits[mac[i] >> 4];
+        *p++ = hex_digits[mac[i] & 0xf];
+    }
+
+    ob->len += p - out;
+}
+
+void ob_mac_pad(outbuf_t *ob, const uint8_t *mac) {
+
+    char *out = ob_reserve(ob, OB_MAX_FIELD), *p = out;
+    int i;
+
+    for (i = 0; i < 6; i++) {
+
+        if (i) *p++ = ':';
+
+        *p++ = hex_digits[mac[i] >> 4];
+        *p++ = hex_digits[mac[i] & 0xf];
+    }
+
+    ob->len += p - out;
+}
+
+void ob_ipv4(outbuf_t *ob, uint32_t addr) {
+
+    const uint8_t *octets = (const uint8_t *) &addr;
+    char *out = ob_reserve(ob, OB_MAX_FIELD), *p = out, tmp[3], *start;
+    int i;
+
+    for (i = 0; i < 4; i++) {
+
+        if (i) *p++ = '.';
+
+        start = fmt_dec(&tmp[sizeof(tmp)], octets[i]);
+        memcpy(p, start, &tmp[sizeof(tmp)] - start);
+        p += &tmp[sizeof(tmp)] - start;
+    }
+
+    ob->len += p - out;
+}
+
+void ob_ipv6(outbuf_t *ob, const uint8_t *addr) {
+
+    static const uint8_t v4_mapped[12] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff};
+    char *out, *p;
+    int i, j, best = -1, best_len = 1, word, shift;
+    uint32_t v4;
+
+    /* IPv4-mapped addresses keep the IPv4 part dotted */
+    if (memcmp(addr, v4_mapped, sizeof(v4_mapped)) == 0) {
+        memcpy(&v4, &addr[12], sizeof(v4));
+        OB_LIT(ob, "::ffff:");
+        ob_ipv4(ob, v4);
+        return;
+    }
+
+    out = p = ob_reserve(ob, OB_MAX_FIELD);
+
+    /* The longest run of two or more zero words becomes "::", the first one wins a tie */
+    for (i = 0; i < 8; i = j + 1) {
+
+        for (j = i; j < 8 && addr[j * 2] == 0 && addr[j * 2 + 1] == 0; j++);
+
+        if (j - i > best_len) {
+            best = i;
+            best_len = j - i;
+        }
+    }
+
+    for (i = 0; i < 8; i++) {
+
+        if (i == best) {
+            *p++ = ':';
+            if (i == 0) *p++ = ':';
+            i += best_len - 1;
+            continue;
+        }
+
+        word = addr[i * 2] << 8 | addr[i * 2 + 1];
+
+        /* No leading zeros */
+        for (shift = 12; shift > 0 && (word >> shift) == 0; shift -= 4);
+        for (; shift >= 0; shift -= 4) *p++ = hex_digits[(word >> shift) & 0xf];
+
+        if (i < 7) *p++ = ':';
+    }
+
+    ob->len += p - out;
+}
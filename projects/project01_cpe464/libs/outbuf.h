@@ -0,0 +1,70 @@
+/* Buffered output writer
+ *
+ * Collects output in one large user-space buffer and hands it to the kernel
+ * with a single write() per flush. Numbers, MACs and IPs are formatted with
+ * lookup tables instead of printf.
+ *
+ * A buffer opened on fd -1 never flushes, it grows instead, so output can be
+ * built up in memory and written out later with ob_write_to().
+ */
+
+#ifndef OUTBUF_H
+#define OUTBUF_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define OB_DEFAULT_CAP (1 << 20)
+
+typedef struct outbuf {
+    int fd;
+    size_t len;
+    size_t cap;
+    char *buf;
+} outbuf_t;
+
+/* Write a string literal, its length is known at compile time */
+#define OB_LIT(ob, lit) ob_write((ob), (lit), sizeof(lit) - 1)
+
+void ob_init(outbuf_t *ob, int fd, size_t cap);
+
+void ob_flush(outbuf_t *ob);
+
+void ob_free(outbuf_t *ob);
+
+/* Empties the buffer without writing it, e.g. to reuse an in-memory buffer */
+void ob_reset(outbuf_t *ob);
+
+/* Writes everything buffered so far to fd, leaving the buffer untouched */
+void ob_write_to(const outbuf_t *ob, int fd);
+
+void ob_write(outbuf_t *ob, const char *str, size_t len);
+
+void ob_str(outbuf_t *ob, const char *str);
+
+void ob_char(outbuf_t *ob, char c);
+
+/* Same output as printf's %u */
+void ob_dec(outbuf_t *ob, uint32_t val);
+
+void ob_dec64(outbuf_t *ob, uint64_t val);
+
+/* Zero padded to width digits, up to 10, like %0*u */
+void ob_dec_pad(outbuf_t *ob, uint32_t val, int width);
+
+/* Same output as printf's %x */
+void ob_hex(outbuf_t *ob, uint32_t val);
+
+/* Same output as ether_ntoa(), "%x:%x:%x:%x:%x:%x" */
+void ob_mac(outbuf_t *ob, const uint8_t *mac);
+
+/* Always two digits per byte, "%02x:%02x:%02x:%02x:%02x:%02x" */
+void ob_mac_pad(outbuf_t *ob, const uint8_t *mac);
+
+/* Dotted decimal, addr is in network order as it appears in the packet */
+void ob_ipv4(outbuf_t *ob, uint32_t addr);
+
+/* RFC 5952 text form, e.g. "fe80::1", addr is the 16 bytes from the packet */
+void ob_ipv6(outbuf_t *ob, const uint8_t *addr);
+
+#endif /* OUTBUF_H */
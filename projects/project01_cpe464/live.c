@@ -0,0 +1,226 @@
+
+#include "trace.h"
+
+#ifdef __linux__
+
+#include <poll.h>
+#include <net/if.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+
+/* Set from a signal handler to end the capture */
+static volatile sig_atomic_t live_stopped = 0;
+
+static int live_fail(reader_t *r, const char *what) {
+
+    snprintf(r->errbuf, PCAP_ERRBUF_SIZE, "%s: %s", what, strerror(errno));
+
+    live_close(r);
+
+    return -1;
+}
+
+int live_open(reader_t *r, const char *ifname) {
+
+    struct tpacket_req3 req;
+    struct sockaddr_ll addr;
+    struct ifreq ifr;
+    int version = TPACKET_V3;
+
+    memset(r, 0, sizeof(reader_t));
+    r->kind = READER_LIVE;
+
+    /*
+     * No protocol until it's bound, so frames from other interfaces never get
+     * queued, and bound before the ring is made so none land in its first blocks
+     */
+    r->fd = socket(AF_PACKET, SOCK_RAW, 0);
+
+    if (r->fd < 0) {
+        r->fd = -1;
+        return live_fail(r, "socket");
+    }
+
+    memset(&ifr, 0, sizeof(ifr));
+    strncpy(ifr.ifr_name, ifname, IFNAMSIZ - 1);
+
+    if (ioctl(r->fd, SIOCGIFINDEX, &ifr)) {
+        return live_fail(r, ifname);
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sll_family = AF_PACKET;
+    addr.sll_protocol = htons(ETH_P_ALL);
+    addr.sll_ifindex = ifr.ifr_ifindex;
+
+    if (bind(r->fd, (struct sockaddr *) &addr, sizeof(addr))) {
+        return live_fail(r, "bind");
+    }
+
+    if (setsockopt(r->fd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version))) {
+        return live_fail(r, "PACKET_VERSION");
+    }
+
+    /* Blocks are handed over when full, or after LIVE_BLOCK_TIMEOUT ms */
+    memset(&req, 0, sizeof(req));
+    req.tp_block_size = LIVE_BLOCK_SIZE;
+    req.tp_block_nr = LIVE_NUM_BLOCKS;
+    req.tp_frame_size = LIVE_FRAME_SIZE;
+    req.tp_frame_nr = req.tp_block_size / req.tp_frame_size * req.tp_block_nr;
+    req.tp_retire_blk_tov = LIVE_BLOCK_TIMEOUT;
+
+    if (setsockopt(r->fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req))) {
+        return live_fail(r, "PACKET_RX_RING");
+    }
+
+    r->block_size = req.tp_block_size;
+    r->num_blocks = req.tp_block_nr;
+    r->ring_len = (size_t) req.tp_block_size * req.tp_block_nr;
+    r->ring = mmap(NULL, r->ring_len, PROT_READ | PROT_WRITE, MAP_SHARED, r->fd, 0);
+
+    if (r->ring == MAP_FAILED) {
+        r->ring = NULL;
+        return live_fail(r, "mmap");
+    }
+
+    /* Loopback shows every packet twice, once going out and once coming in */
+    if (ioctl(r->fd, SIOCGIFFLAGS, &ifr) == 0 && (ifr.ifr_flags & IFF_LOOPBACK)) {
+        r->loopback = 1;
+    }
+
+    return 0;
+}
+
+int live_next(reader_t *r, packet_t *pkt) {
+
+    struct tpacket_block_desc *block;
+    const struct tpacket3_hdr *header;
+    const struct sockaddr_ll *addr;
+    struct pollfd pfd;
+
+    for (;;) {
+
+        /* Packets left in the block we're holding */
+        while (r->pkts_left > 0) {
+
+            header = (const struct tpacket3_hdr *) r->next_pkt;
+
+            r->next_pkt += header->tp_next_offset;
+            r->pkts_left--;
+
+            addr = (const struct sockaddr_ll *) ((const uint8_t *) header +
+                                                 TPACKET_ALIGN(sizeof(struct tpacket3_hdr)));
+
+            if (r->loopback && addr->sll_pkttype == PACKET_OUTGOING) continue;
+
+            pkt->ts_sec = header->tp_sec;
+            pkt->ts_nsec = header->tp_nsec;
+            pkt->caplen = header->tp_snaplen;
+            pkt->len = header->tp_len;
+            pkt->data = (const uint8_t *) header + header->tp_mac;
+
+            return 1;
+        }
+
+        block = (struct tpacket_block_desc *) &r->ring[(size_t) r->cur_block * r->block_size];
+
+        /* Hand the block we just finished back to the kernel */
+        if (r->held) {
+            __atomic_store_n(&block->hdr.bh1.block_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+            r->cur_block = (r->cur_block + 1) % r->num_blocks;
+            r->held = 0;
+            continue;
+        }
+
+        if (live_stopped) {
+            return 0;
+        }
+
+        /* Sleep until the kernel retires the next block */
+        if (!(__atomic_load_n(&block->hdr.bh1.block_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER)) {
+
+            pfd.fd = r->fd;
+            pfd.events = POLLIN | POLLERR;
+            pfd.revents = 0;
+
+            if (poll(&pfd, 1, LIVE_BLOCK_TIMEOUT) < 0 && errno != EINTR) {
+                snprintf(r->errbuf, PCAP_ERRBUF_SIZE, "poll: %s", strerror(errno));
+                return -1;
+            }
+
+            continue;
+        }
+
+        r->held = 1;
+        r->pkts_left = block->hdr.bh1.num_pkts;
+        r->next_pkt = (const uint8_t *) block + block->hdr.bh1.offset_to_first_pkt;
+    }
+}
+
+void live_stats(reader_t *r, uint64_t *received, uint64_t *dropped) {
+
+    struct tpacket_stats_v3 st;
+    socklen_t len = sizeof(st);
+
+    /* The kernel resets its counters every time they're read */
+    if (getsockopt(r->fd, SOL_PACKET, PACKET_STATISTICS, &st, &len) == 0) {
+        r->received += st.tp_packets;
+        r->dropped += st.tp_drops;
+    }
+
+    *received = r->received;
+    *dropped = r->dropped;
+}
+
+void live_close(reader_t *r) {
+
+    if (r->ring != NULL) {
+        munmap(r->ring, r->ring_len);
+        r->ring = NULL;
+    }
+
+    if (r->fd >= 0) {
+        close(r->fd);
+        r->fd = -1;
+    }
+}
+
+void live_stop(void) {
+    live_stopped = 1;
+}
+
+#else
+
+int live_open(reader_t *r, const char *ifname) {
+
+    (void) ifname;
+
+    memset(r, 0, sizeof(reader_t));
+    r->fd = -1;
+    snprintf(r->errbuf, PCAP_ERRBUF_SIZE, "live capture is only supported on Linux");
+
+    return -1;
+}
+
+int live_next(reader_t *r, packet_t *pkt) {
+    (void) r;
+    (void) pkt;
+    return 0;
+}
+
+void live_stats(reader_t *r, uint64_t *received, uint64_t *dropped) {
+    (void) r;
+    *received = *dropped = 0;
+}
+
+void live_close(reader_t *r) {
+    (void) r;
+}
+
+void live_stop(void) {
+}
+
+#endif
@@ -0,0 +1,207 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "parallel.h"
+#include "prof.h"
+
+typedef struct chunk {
+    outbuf_t out;
+    int done;
+} chunk_t;
+
+typedef struct pool {
+    reader_t *reader;
+    packet_fn_t fn;
+    void *arg;
+
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+
+    /* Chunk n lives in slots[n % num_slots] until it has been written out */
+    chunk_t *slots;
+    uint32_t num_slots;
+
+    uint32_t next_chunk;
+    uint32_t next_write;
+    uint32_t pkt_num;
+
+    /* Set once the scan reaches the end of the capture */
+    int eof;
+    int ret;
+} pool_t;
+
+typedef struct worker_arg {
+    pool_t *pool;
+    int id;
+} worker_arg_t;
+
+static void *worker(void *data) {
+
+    pool_t *pool = ((worker_arg_t *) data)->pool;
+    int worker_id = ((worker_arg_t *) data)->id;
+    reader_t sub;
+    packet_t pkt;
+    chunk_t *chunk;
+    off_t start, end;
+    uint32_t id, pkt_num;
+    int ret;
+
+    pthread_mutex_lock(&pool->lock);
+
+    for (;;) {
+
+        /* Don't get too far ahead of the writer */
+        while (!pool->eof && pool->next_chunk - pool->next_write >= pool->num_slots) {
+            pthread_cond_wait(&pool->cond, &pool->lock);
+        }
+
+        if (pool->eof) break;
+
+        /* Claim the next chunk by walking its record headers */
+        id = pool->next_chunk++;
+        pkt_num = pool->pkt_num;
+        start = pool->reader->pos;
+
+        while (pool->reader->pos - start < CHUNK_BYTES) {
+
+            ret = reader_next(pool->reader, &pkt);
+
+            if (ret <= 0) {
+                pool->eof = 1;
+                pool->ret = ret;
+                pthread_cond_broadcast(&pool->cond);
+                break;
+            }
+
+            pool->pkt_num++;
+        }
+
+        end = pool->reader->pos;
+
+        reader_slice(pool->reader, &sub, start, end);
+
+        pthread_mutex_unlock(&pool->lock);
+
+        /* Dissect the chunk on its own mapping */
+        chunk = &pool->slots[id % pool->num_slots];
+        ob_reset(&chunk->out);
+
+        for (;;) {
+
+            PROF_BEGIN(PROF_READ);
+            ret = reader_next(&sub, &pkt);
+            PROF_END();
+
+            if (ret <= 0) break;
+
+            PROF_BEGIN(PROF_HANDLE);
+            pool->fn(pool->arg, worker_id, &chunk->out, pkt_num++, &pkt);
+            PROF_END();
+        }
+
+        reader_close(&sub);
+
+        pthread_mutex_lock(&pool->lock);
+
+        chunk->done = 1;
+        pthread_cond_broadcast(&pool->cond);
+    }
+
+    pthread_mutex_unlock(&pool->lock);
+
+    return NULL;
+}
+
+int run_parallel(reader_t *r, int num_threads, packet_fn_t fn, void *arg, outbuf_t *out) {
+
+    pool_t pool;
+    pthread_t *threads;
+    worker_arg_t *args;
+    chunk_t *chunk;
+    uint32_t i;
+    int started;
+
+    memset(&pool, 0, sizeof(pool_t));
+
+    pool.reader = r;
+    pool.fn = fn;
+    pool.arg = arg;
+    pool.pkt_num = 1;
+    pool.num_slots = (uint32_t) num_threads * CHUNKS_PER_WORKER;
+
+    pthread_mutex_init(&pool.lock, NULL);
+    pthread_cond_init(&pool.cond, NULL);
+
+    pool.slots = malloc(pool.num_slots * sizeof(chunk_t));
+    threads = malloc(num_threads * sizeof(pthread_t));
+    args = malloc(num_threads * sizeof(worker_arg_t));
+
+    if (pool.slots == NULL || threads == NULL || args == NULL) {
+        perror("malloc");
+        exit(1);
+    }
+
+    for (i = 0; i < pool.num_slots; i++) {
+        ob_init(&pool.slots[i].out, -1, CHUNK_BYTES);
+        pool.slots[i].done = 0;
+    }
+
+    for (started = 0; started < num_threads; started++) {
+
+        args[started].pool = &pool;
+        args[started].id = started;
+
+        if (pthread_create(&threads[started], NULL, worker, &args[started])) {
+            perror("pthread_create");
+            exit(1);
+        }
+    }
+
+    /* Copy finished chunks out in capture order */
+    pthread_mutex_lock(&pool.lock);
+
+    for (;;) {
+
+        chunk = &pool.slots[pool.next_write % pool.num_slots];
+
+        while (pool.next_write == pool.next_chunk ? !pool.eof : !chunk->done) {
+            pthread_cond_wait(&pool.cond, &pool.lock);
+        }
+
+        if (pool.next_write == pool.next_chunk) break;
+
+        pthread_mutex_unlock(&pool.lock);
+
+        PROF_BEGIN(PROF_WRITE);
+        ob_write(out, chunk->out.buf, chunk->out.len);
+        PROF_END();
+
+        pthread_mutex_lock(&pool.lock);
+
+        chunk->done = 0;
+        pool.next_write++;
+        pthread_cond_broadcast(&pool.cond);
+    }
+
+    pthread_mutex_unlock(&pool.lock);
+
+    for (i = 0; i < (uint32_t) num_threads; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    for (i = 0; i < pool.num_slots; i++) {
+        ob_free(&pool.slots[i].out);
+    }
+
+    free(pool.slots);
+    free(threads);
+    free(args);
+
+    pthread_mutex_destroy(&pool.lock);
+    pthread_cond_destroy(&pool.cond);
+
+    return pool.ret;
+}
@@ -0,0 +1,26 @@
+
+#ifndef PROJECT_1_PARALLEL_H
+#define PROJECT_1_PARALLEL_H
+
+#include "reader.h"
+#include "libs/outbuf.h"
+
+/* Records are handed out to the workers in chunks of about this many bytes */
+#define CHUNK_BYTES (1 << 20)
+
+/* Chunks allowed to be in flight per worker, bounds the buffered output */
+#define CHUNKS_PER_WORKER 4
+
+/* Called once per packet, worker is the index of the calling thread (0 when serial) */
+typedef void (*packet_fn_t)(void *arg, int worker, outbuf_t *out, uint32_t pkt_num, const packet_t *pkt);
+
+/*
+ * Runs fn over every packet of a native capture on num_threads workers. The
+ * capture is split into chunks on record boundaries, each chunk is written
+ * to its own buffer, and the buffers are copied to out in capture order, so
+ * the output matches a serial run. Returns the same as reader_next() did at
+ * the end of the capture.
+ */
+int run_parallel(reader_t *r, int num_threads, packet_fn_t fn, void *arg, outbuf_t *out);
+
+#endif /* PROJECT_1_PARALLEL_H */
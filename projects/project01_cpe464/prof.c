@@ -0,0 +1,189 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "prof.h"
+
+typedef struct prof_stage {
+    uint64_t calls;
+    uint64_t ticks;
+    uint64_t hist[PROF_BUCKETS];
+} prof_stage_t;
+
+typedef struct prof_frame {
+    int stage;
+    uint64_t start;
+
+    /* Spent in the stages nested inside, taken off this one's time */
+    uint64_t nested;
+} prof_frame_t;
+
+/* One per thread so the -j workers don't share counters, linked up for the report */
+typedef struct prof_thread {
+    prof_stage_t stages[PROF_NUM];
+    prof_frame_t frames[PROF_MAX_DEPTH];
+    int depth;
+    struct prof_thread *next;
+} prof_thread_t;
+
+static const char *stage_names[PROF_NUM] = {
+        "read", "handle", "filter", "dissect", "checksum", "eth", "arp",
+        "ip", "ip6", "tcp", "icmp", "udp", "write"
+};
+
+static __thread prof_thread_t *local;
+static prof_thread_t *threads;
+static pthread_mutex_t threads_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Ticks and wall clock at prof_init(), the report works out the tick rate from them */
+static uint64_t init_ticks;
+static uint64_t init_ns;
+
+static uint64_t wall_ns(void) {
+
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* The TSC where there is one, it's a fraction of the cost of a clock_gettime() */
+static uint64_t ticks(void) {
+
+#if defined(__x86_64__) || defined(__i386__)
+    uint32_t lo, hi;
+
+    __asm__ __volatile__ ("rdtsc" : "=a" (lo), "=d" (hi));
+
+    return (uint64_t) hi << 32 | lo;
+#else
+    return wall_ns();
+#endif
+}
+
+static prof_thread_t *prof_thread(void) {
+
+    if (local != NULL) return local;
+
+    local = calloc(1, sizeof(prof_thread_t));
+
+    if (local == NULL) {
+        perror("calloc");
+        exit(1);
+    }
+
+    pthread_mutex_lock(&threads_lock);
+    local->next = threads;
+    threads = local;
+    pthread_mutex_unlock(&threads_lock);
+
+    return local;
+}
+
+void prof_init(void) {
+    init_ns = wall_ns();
+    init_ticks = ticks();
+}
+
+void prof_begin(int stage) {
+
+    prof_thread_t *t = prof_thread();
+    prof_frame_t *frame;
+
+    if (t->depth == PROF_MAX_DEPTH) {
+        fprintf(stderr, "prof: stages nested more than %d deep\n", PROF_MAX_DEPTH);
+        exit(1);
+    }
+
+    frame = &t->frames[t->depth++];
+    frame->stage = stage;
+    frame->nested = 0;
+    frame->start = ticks();
+}
+
+void prof_end(void) {
+
+    uint64_t now = ticks(), elapsed, self;
+    prof_thread_t *t = local;
+    prof_frame_t *frame = &t->frames[--t->depth];
+    prof_stage_t *stage = &t->stages[frame->stage];
+    int bucket = 0;
+
+    elapsed = now - frame->start;
+    self = elapsed > frame->nested ? elapsed - frame->nested : 0;
+
+    if (t->depth > 0) t->frames[t->depth - 1].nested += elapsed;
+
+    while (bucket < PROF_BUCKETS - 1 && self >> bucket != 0) bucket++;
+
+    stage->calls++;
+    stage->ticks += self;
+    stage->hist[bucket]++;
+}
+
+/* Upper bound of the bucket the given fraction of calls falls in */
+static double percentile(const prof_stage_t *stage, double fraction) {
+
+    uint64_t want = (uint64_t) (stage->calls * fraction), seen = 0;
+    int i;
+
+    for (i = 0; i < PROF_BUCKETS; i++) {
+        seen += stage->hist[i];
+        if (seen > want) break;
+    }
+
+    return (double) ((uint64_t) 1 << i);
+}
+
+void prof_report(void) {
+
+    prof_stage_t total[PROF_NUM];
+    prof_thread_t *t;
+    uint64_t sum = 0, packets;
+    double ns_per_tick;
+    int i, j;
+
+    memset(total, 0, sizeof(total));
+
+    for (t = threads; t != NULL; t = t->next) {
+        for (i = 0; i < PROF_NUM; i++) {
+
+            total[i].calls += t->stages[i].calls;
+            total[i].ticks += t->stages[i].ticks;
+
+            for (j = 0; j < PROF_BUCKETS; j++) total[i].hist[j] += t->stages[i].hist[j];
+        }
+    }
+
+    for (i = 0; i < PROF_NUM; i++) sum += total[i].ticks;
+
+    ns_per_tick = (double) (wall_ns() - init_ns) / (double) (ticks() - init_ticks + 1);
+
+    /* Every packet goes through the handler once */
+    packets = total[PROF_HANDLE].calls ? total[PROF_HANDLE].calls : 1;
+
+    fprintf(stderr, "\nProfile: %lu packets, %.3f ms in stages, %.3f ns per tick\n",
+            (unsigned long) total[PROF_HANDLE].calls, (double) sum * ns_per_tick / 1e6, ns_per_tick);
+    fprintf(stderr, "%-10s %12s %12s %8s %10s %10s %10s\n",
+            "Stage", "Calls", "ns/packet", "% total", "p50 ns", "p99 ns", "max ns");
+
+    for (i = 0; i < PROF_NUM; i++) {
+
+        if (total[i].calls == 0) continue;
+
+        for (j = PROF_BUCKETS - 1; j > 0 && total[i].hist[j] == 0; j--);
+
+        fprintf(stderr, "%-10s %12lu %12.1f %7.1f%% %10.0f %10.0f %10.0f\n",
+                stage_names[i], (unsigned long) total[i].calls,
+                (double) total[i].ticks * ns_per_tick / (double) packets,
+                sum ? 100.0 * (double) total[i].ticks / (double) sum : 0.0,
+                percentile(&total[i], 0.5) * ns_per_tick,
+                percentile(&total[i], 0.99) * ns_per_tick,
+                (double) ((uint64_t) 1 << j) * ns_per_tick);
+    }
+}
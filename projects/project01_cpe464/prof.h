@@ -0,0 +1,61 @@
+
+#ifndef PROJECT_1_PROF_H
+#define PROJECT_1_PROF_H
+
+/*
+ * Stage timing, only built in with -DTRACE_PROFILE (make PROFILE=1, or
+ * cmake -DTRACE_PROFILE=ON). Otherwise the macros are empty and cost nothing.
+ *
+ * Stages nest, and each one is charged only the time not spent in the stages
+ * inside it, so the breakdown adds up to the time spent in all of them. With
+ * -j every thread's times are added together, so they're CPU time, not wall
+ * clock time.
+ */
+
+#define PROF_READ    0
+#define PROF_HANDLE  1
+#define PROF_FILTER  2
+#define PROF_DISSECT 3
+#define PROF_CKSUM   4
+#define PROF_ETH     5
+#define PROF_ARP     6
+#define PROF_IP      7
+#define PROF_IP6     8
+#define PROF_TCP     9
+#define PROF_ICMP    10
+#define PROF_UDP     11
+#define PROF_WRITE   12
+#define PROF_NUM     13
+
+/* Deepest nesting, eth -> ip -> tcp inside the handler is the most there is today */
+#define PROF_MAX_DEPTH 16
+
+/* Log2 histogram of the time per call, bucket n holds calls under 2^n ticks */
+#define PROF_BUCKETS 48
+
+#ifdef TRACE_PROFILE
+
+void prof_init(void);
+
+void prof_begin(int stage);
+
+void prof_end(void);
+
+/* Breakdown per stage to stderr: calls, ns/packet, % of total and percentiles per call */
+void prof_report(void);
+
+#define PROF_INIT()       prof_init()
+#define PROF_BEGIN(stage) prof_begin(stage)
+#define PROF_END()        prof_end()
+#define PROF_REPORT()     prof_report()
+
+#else
+
+#define PROF_INIT()       ((void) 0)
+#define PROF_BEGIN(stage) ((void) 0)
+#define PROF_END()        ((void) 0)
+#define PROF_REPORT()     ((void) 0)
+
+#endif /* TRACE_PROFILE */
+
+#endif /* PROJECT_1_PROF_H */
@@ -0,0 +1,94 @@
+
+#include "trace.h"
+
+/* Maps one value of a next-protocol field to an entry in protos[] or a name */
+typedef struct proto_reg {
+    uint16_t key;
+    uint8_t id;
+} proto_reg_t;
+
+const proto_t protos[PROTO_NUM] = {
+        {"Unknown", NULL,          NULL},
+        {"ARP",     dissect_arp,   process_arp_h},
+        {"IP",      dissect_ip,    process_ip_h},
+        {"ICMP",    dissect_icmp,  process_icmp_h},
+        {"TCP",     dissect_tcp,   process_tcp_h},
+        {"UDP",     dissect_udp,   process_udp_h},
+        {"VLAN",    dissect_vlan,  NULL},
+        {"IPv6",    dissect_ip6,   process_ip6_h},
+        {"ICMPv6",  dissect_icmp,  process_icmp_h}
+};
+
+static const proto_reg_t ethertypes[] = {
+        {0x0800, PROTO_IPV4},
+        {0x0806, PROTO_ARP},
+        {0x8100, PROTO_VLAN},
+        {0x88a8, PROTO_VLAN},
+        {0x86dd, PROTO_IPV6}
+};
+
+static const proto_reg_t ip_protos[] = {
+        {0x01, PROTO_ICMP},
+        {0x06, PROTO_TCP},
+        {0x11, PROTO_UDP},
+        {0x3a, PROTO_ICMP6}
+};
+
+/* Ports named in the TCP output, ids index port_names[] */
+static const char *const port_names[] = {NULL, "HTTP", "Telnet", "FTP Data", "FTP", "POP3", "SMTP"};
+
+static const proto_reg_t tcp_ports[] = {
+        {80, 1},
+        {23, 2},
+        {20, 3},
+        {21, 4},
+        {110, 5},
+        {25, 6}
+};
+
+static const char *const arp_ops[] = {NULL, "Request", "Reply"};
+
+static const char *const icmp_types[] = {"Reply", NULL, NULL, NULL, NULL, NULL, NULL, NULL, "Request"};
+
+/* Echo request and reply, the rest of the ICMPv6 types print as numbers */
+#define ICMP6_ECHO_REQUEST 128
+
+static const char *const icmp6_types[] = {"Request", "Reply"};
+
+uint8_t ethertype_table[1 << 16];
+uint8_t ip_proto_table[1 << 8];
+uint8_t tcp_port_table[1 << 16];
+
+#define NUM_REGS(regs) (sizeof(regs) / sizeof((regs)[0]))
+
+static void proto_register(uint8_t *table, const proto_reg_t *regs, size_t num) {
+
+    size_t i;
+
+    for (i = 0; i < num; i++) {
+        table[regs[i].key] = regs[i].id;
+    }
+}
+
+void proto_init(void) {
+    proto_register(ethertype_table, ethertypes, NUM_REGS(ethertypes));
+    proto_register(ip_proto_table, ip_protos, NUM_REGS(ip_protos));
+    proto_register(tcp_port_table, tcp_ports, NUM_REGS(tcp_ports));
+}
+
+const char *tcp_port_name(uint16_t port) {
+    return port_names[tcp_port_table[port]];
+}
+
+const char *arp_op_name(uint16_t op) {
+    return op < NUM_REGS(arp_ops) ? arp_ops[op] : NULL;
+}
+
+const char *icmp_type_name(uint8_t type) {
+    return type < NUM_REGS(icmp_types) ? icmp_types[type] : NULL;
+}
+
+const char *icmp6_type_name(uint8_t type) {
+    return type >= ICMP6_ECHO_REQUEST && type - ICMP6_ECHO_REQUEST < (int) NUM_REGS(icmp6_types) ?
+           icmp6_types[type - ICMP6_ECHO_REQUEST] : NULL;
+}
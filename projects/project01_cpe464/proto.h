@@ -0,0 +1,64 @@
+
+#ifndef PROJECT_1_PROTO_H
+#define PROJECT_1_PROTO_H
+
+#include <stdint.h>
+
+#include "libs/outbuf.h"
+
+/*
+ * Protocol registry. Each layer has a lookup table indexed by the value that
+ * names the next protocol (ethertype, IP protocol, port) holding an index
+ * into protos[], so moving to the next layer is a single load. Index 0 is
+ * PROTO_UNKNOWN, which has no dissector.
+ *
+ * Adding a protocol means adding it to protos[] and to the registration list
+ * for its layer in proto.c, no switches need editing.
+ */
+
+#define PROTO_UNKNOWN 0
+#define PROTO_ARP     1
+#define PROTO_IPV4    2
+#define PROTO_ICMP    3
+#define PROTO_TCP     4
+#define PROTO_UDP     5
+#define PROTO_VLAN    6
+#define PROTO_IPV6    7
+#define PROTO_ICMP6   8
+#define PROTO_NUM     9
+
+struct packet_info;
+
+typedef struct proto {
+    const char *name;
+
+    /* Sets this layer's header in info if it was all captured, then moves on to the next layer */
+    void (*dissect)(struct packet_info *info, const uint8_t *data, uint32_t avail);
+
+    /* Prints this layer and whatever follows it, NULL for VLAN tags which the Ethernet printer covers */
+    void (*print)(outbuf_t *out, const struct packet_info *info);
+} proto_t;
+
+extern const proto_t protos[PROTO_NUM];
+
+/* Filled in by proto_init(), keys are in host byte order */
+extern uint8_t ethertype_table[1 << 16];
+extern uint8_t ip_proto_table[1 << 8];
+extern uint8_t tcp_port_table[1 << 16];
+
+#define PROTO_BY_ETHERTYPE(type) (&protos[ethertype_table[(uint16_t) (type)]])
+#define PROTO_BY_IP_PROTO(proto) (&protos[ip_proto_table[(uint8_t) (proto)]])
+
+/* Builds the lookup tables, must run before any packet is dissected */
+void proto_init(void);
+
+/* Names for well-known values, NULL if there isn't one */
+const char *tcp_port_name(uint16_t port);
+
+const char *arp_op_name(uint16_t op);
+
+const char *icmp_type_name(uint8_t type);
+
+const char *icmp6_type_name(uint8_t type);
+
+#endif /* PROJECT_1_PROTO_H */
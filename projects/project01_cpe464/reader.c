@@ -0,0 +1,556 @@
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "trace.h"
+
+/* Same limit libpcap puts on a single record */
+#define MAX_CAPLEN 262144
+
+static uint32_t get32(const reader_t *r, uint32_t val) {
+
+    if (!r->swapped) return val;
+
+    return (val >> 24) | ((val >> 8) & 0xff00) | ((val << 8) & 0xff0000) | (val << 24);
+}
+
+/* Maps a window of the file that covers at least [offset, offset + need) */
+static int map_window(reader_t *r, off_t offset, size_t need) {
+
+    off_t start = offset - offset % sysconf(_SC_PAGESIZE);
+    size_t len = READER_WINDOW;
+
+    if (len < (size_t) (offset - start) + need) {
+        len = (size_t) (offset - start) + need;
+    }
+
+    if ((off_t) len > r->file_size - start) {
+        len = (size_t) (r->file_size - start);
+    }
+
+    if (r->map != NULL) {
+        munmap(r->map, r->map_len);
+    }
+
+    r->map = mmap(NULL, len, PROT_READ, MAP_PRIVATE, r->fd, start);
+
+    if (r->map == MAP_FAILED) {
+        r->map = NULL;
+        r->map_len = 0;
+        snprintf(r->errbuf, PCAP_ERRBUF_SIZE, "mmap: %s", strerror(errno));
+        return -1;
+    }
+
+    /* Every page gets read once, front to back */
+    madvise(r->map, len, MADV_SEQUENTIAL);
+
+    r->map_off = start;
+    r->map_len = len;
+
+    return 0;
+}
+
+static uint32_t read32(const reader_t *r, const uint8_t *p) {
+
+    uint32_t val;
+
+    memcpy(&val, p, sizeof(val));
+
+    return get32(r, val);
+}
+
+static uint16_t read16(const reader_t *r, const uint8_t *p) {
+
+    uint16_t val;
+
+    memcpy(&val, p, sizeof(val));
+
+    return r->swapped ? (uint16_t) (val << 8 | val >> 8) : val;
+}
+
+static const uint8_t *map_range(reader_t *r, off_t offset, size_t len) {
+
+    if (r->zs != NULL) return decomp_range(r, offset, len);
+
+    if (offset < r->map_off || offset + (off_t) len > r->map_off + (off_t) r->map_len) {
+        if (map_window(r, offset, len)) return NULL;
+    }
+
+    return &r->map[offset - r->map_off];
+}
+
+/* Bytes of the capture left from r->pos, up to want. Fewer means it ends first, -1 that it's corrupt */
+static off_t remaining(reader_t *r, off_t want) {
+
+    if (r->zs != NULL) return decomp_remaining(r, want);
+
+    return r->file_size - r->pos < want ? r->file_size - r->pos : want;
+}
+
+/* Anything else is left to libpcap, unless it was decompressed, which libpcap can't do */
+static int not_native(reader_t *r) {
+
+    if (r->zs == NULL) return 1;
+
+    snprintf(r->errbuf, PCAP_ERRBUF_SIZE, "decompressed data isn't a pcap or pcapng capture");
+
+    return -1;
+}
+
+/*
+ * Reads and checks the global header, returns 1 if the file isn't a native
+ * pcap, or -1 with the reason in r->errbuf if it's compressed and can't be read
+ */
+static int open_native(reader_t *r, const char *path) {
+
+    struct stat st;
+    pcap_header_t header;
+
+    r->fd = open(path, O_RDONLY);
+
+    if (r->fd < 0 || fstat(r->fd, &st) || !S_ISREG(st.st_mode)) {
+        return 1;
+    }
+
+    if (pread(r->fd, &header, PCAP_HEADER_LEN, 0) != (ssize_t) PCAP_HEADER_LEN) {
+        return 1;
+    }
+
+    r->file_size = st.st_size;
+
+    /* Compressed, the header is the first thing out of the decompressor */
+    if ((header.magic & 0xffff) == GZIP_MAGIC || header.magic == ZSTD_MAGIC) {
+
+        if (decomp_open(r, header.magic == ZSTD_MAGIC ? DECOMP_ZSTD : DECOMP_GZIP)) return -1;
+
+        if (remaining(r, PCAP_HEADER_LEN) != (off_t) PCAP_HEADER_LEN) {
+            if (r->errbuf[0] == '\0') snprintf(r->errbuf, PCAP_ERRBUF_SIZE, "decompressed capture is too short");
+            return -1;
+        }
+
+        memcpy(&header, decomp_range(r, 0, PCAP_HEADER_LEN), PCAP_HEADER_LEN);
+    }
+
+    /* pcapng, the byte order is picked up from each section header block */
+    if (header.magic == PCAPNG_SHB) {
+        r->pos = 0;
+        r->kind = READER_PCAPNG;
+        return 0;
+    }
+
+    switch (header.magic) {
+        case PCAP_MAGIC_USEC:
+            break;
+        case PCAP_MAGIC_NSEC:
+            r->nsec = 1;
+            break;
+        case PCAP_MAGIC_USEC_SWAPPED:
+            r->swapped = 1;
+            break;
+        case PCAP_MAGIC_NSEC_SWAPPED:
+            r->swapped = r->nsec = 1;
+            break;
+        default:
+            return not_native(r);
+    }
+
+    if ((r->swapped ? (uint16_t) (header.version_major << 8 | header.version_major >> 8)
+                    : header.version_major) != 2) {
+        return not_native(r);
+    }
+
+    r->snaplen = get32(r, header.snaplen);
+    r->linktype = get32(r, header.linktype);
+    r->pos = PCAP_HEADER_LEN;
+    r->kind = READER_MMAP;
+
+    return 0;
+}
+
+int reader_open(reader_t *r, const char *path) {
+
+    int ret;
+
+    memset(r, 0, sizeof(reader_t));
+
+    if ((ret = open_native(r, path)) == 0) {
+        return 0;
+    }
+
+    decomp_close(r);
+
+    if (r->fd >= 0) {
+        close(r->fd);
+    }
+
+    if (ret < 0) {
+        r->fd = -1;
+        return -1;
+    }
+
+    memset(r, 0, sizeof(reader_t));
+    r->fd = -1;
+
+    /* Let libpcap deal with anything else, or report why it can't */
+    r->pcap = pcap_open_offline(path, r->errbuf);
+
+    if (r->pcap == NULL) {
+        return -1;
+    }
+
+    r->kind = READER_PCAP;
+
+    return 0;
+}
+
+static int next_native(reader_t *r, packet_t *pkt) {
+
+    const packet_header_t *header;
+    uint32_t caplen;
+    off_t left = remaining(r, PACKET_HEADER_LEN);
+
+    if (left <= 0) {
+        return (int) left;
+    }
+
+    if (left < (off_t) PACKET_HEADER_LEN) {
+        snprintf(r->errbuf, PCAP_ERRBUF_SIZE, "truncated dump file; packet header is cut short");
+        return -1;
+    }
+
+    header = (const packet_header_t *) map_range(r, r->pos, PACKET_HEADER_LEN);
+
+    if (header == NULL) return -1;
+
+    caplen = get32(r, header->cap_len);
+
+    if (caplen > MAX_CAPLEN && caplen > r->snaplen) {
+        snprintf(r->errbuf, PCAP_ERRBUF_SIZE, "invalid packet capture length %u", caplen);
+        return -1;
+    }
+
+    if ((left = remaining(r, (off_t) PACKET_HEADER_LEN + caplen)) < 0) return -1;
+
+    if (left < (off_t) PACKET_HEADER_LEN + caplen) {
+        snprintf(r->errbuf, PCAP_ERRBUF_SIZE, "truncated dump file; packet data is cut short");
+        return -1;
+    }
+
+    /* The record may straddle the end of the window */
+    header = (const packet_header_t *) map_range(r, r->pos, PACKET_HEADER_LEN + caplen);
+
+    if (header == NULL) return -1;
+
+    pkt->ts_sec = get32(r, header->t_sec);
+    pkt->ts_nsec = r->nsec ? get32(r, header->t_usec) : get32(r, header->t_usec) * 1000;
+    pkt->caplen = caplen;
+    pkt->len = get32(r, header->org_len);
+    pkt->data = (const uint8_t *) header + PACKET_HEADER_LEN;
+
+    r->pos += PACKET_HEADER_LEN + caplen;
+
+    return 1;
+}
+
+/* Reads the options of an interface description block for the timestamp format, -1 if it can't be used */
+static int pcapng_iface_options(reader_t *r, pcapng_iface_t *iface, const uint8_t *opt, const uint8_t *end) {
+
+    uint16_t code, len;
+    uint8_t tsresol;
+    int64_t offset;
+
+    while (end - opt >= 4) {
+
+        code = read16(r, opt);
+        len = read16(r, &opt[2]);
+        opt += 4;
+
+        if (code == 0 || end - opt < len) break;
+
+        /* if_tsresol, a power of ten, or of two if the top bit is set */
+        if (code == 9 && len == 1) {
+
+            tsresol = opt[0];
+            iface->units = 1;
+
+            /* 10^19 and 2^63 are the most units per second that fit in 64 bits */
+            if ((tsresol & 0x7f) > (tsresol & 0x80 ? 63 : 19)) {
+                snprintf(r->errbuf, PCAP_ERRBUF_SIZE, "interface timestamp resolution 0x%02x is out of range", tsresol);
+                return -1;
+            }
+
+            while (tsresol & 0x7f) {
+                iface->units *= tsresol & 0x80 ? 2 : 10;
+                tsresol--;
+            }
+        }
+
+        /* if_tsoffset */
+        if (code == 14 && len == 8) {
+            memcpy(&offset, opt, sizeof(offset));
+            iface->offset = r->swapped ? (int64_t) ((uint64_t) get32(r, (uint32_t) offset) << 32 |
+                                                    get32(r, (uint32_t) ((uint64_t) offset >> 32)))
+                                       : offset;
+        }
+
+        opt += (len + 3) & ~3;
+    }
+
+    return 0;
+}
+
+static int pcapng_add_iface(reader_t *r, const uint8_t *block, uint32_t len) {
+
+    pcapng_iface_t *iface;
+
+    if (len < 20) {
+        snprintf(r->errbuf, PCAP_ERRBUF_SIZE, "interface description block is too short");
+        return -1;
+    }
+
+    if (r->num_ifaces == r->max_ifaces) {
+
+        r->max_ifaces = r->max_ifaces ? r->max_ifaces * 2 : 4;
+        r->ifaces = realloc(r->ifaces, r->max_ifaces * sizeof(pcapng_iface_t));
+
+        if (r->ifaces == NULL) {
+            perror("realloc");
+            exit(1);
+        }
+    }
+
+    iface = &r->ifaces[r->num_ifaces++];
+
+    iface->linktype = read16(r, &block[8]);
+    iface->snaplen = read32(r, &block[12]);
+    iface->units = 1000000;
+    iface->offset = 0;
+
+    return pcapng_iface_options(r, iface, &block[16], &block[len - 4]);
+}
+
+/* Fills in the packet from a 64-bit timestamp and the captured data at block[offset] */
+static int pcapng_packet(reader_t *r, packet_t *pkt, const uint8_t *block, uint32_t block_len,
+                         uint32_t iface_id, uint64_t ts, uint32_t offset, uint32_t caplen, uint32_t len) {
+
+    const pcapng_iface_t *iface;
+    uint64_t frac;
+
+    if (iface_id >= r->num_ifaces) {
+        snprintf(r->errbuf, PCAP_ERRBUF_SIZE, "packet on undeclared interface %u", iface_id);
+        return -1;
+    }
+
+    if (caplen > block_len - 4 - offset) {
+        snprintf(r->errbuf, PCAP_ERRBUF_SIZE, "packet data runs past the end of its block");
+        return -1;
+    }
+
+    iface = &r->ifaces[iface_id];
+    frac = ts % iface->units;
+
+    pkt->ts_sec = (uint32_t) (ts / iface->units + iface->offset);
+
+    if (iface->units <= 1000000000 && 1000000000 % iface->units == 0) {
+        pkt->ts_nsec = (uint32_t) (frac * (1000000000 / iface->units));
+    } else {
+        pkt->ts_nsec = (uint32_t) ((double) frac / (double) iface->units * 1e9);
+    }
+
+    pkt->caplen = caplen;
+    pkt->len = len;
+    pkt->data = &block[offset];
+
+    return 1;
+}
+
+static int next_pcapng(reader_t *r, packet_t *pkt) {
+
+    const uint8_t *block;
+    uint32_t type, len, caplen, orig_len;
+    off_t left;
+
+    for (;;) {
+
+        if ((left = remaining(r, 12)) <= 0) {
+            return (int) left;
+        }
+
+        if (left < 12) {
+            snprintf(r->errbuf, PCAP_ERRBUF_SIZE, "truncated pcapng file; block header is cut short");
+            return -1;
+        }
+
+        block = map_range(r, r->pos, 12);
+
+        if (block == NULL) return -1;
+
+        type = read32(r, block);
+
+        /* A new section may switch byte order and starts with no interfaces */
+        if (type == PCAPNG_SHB) {
+
+            if (read32(r, &block[8]) != PCAPNG_BYTE_ORDER_MAGIC) r->swapped = !r->swapped;
+
+            if (read32(r, &block[8]) != PCAPNG_BYTE_ORDER_MAGIC) {
+                snprintf(r->errbuf, PCAP_ERRBUF_SIZE, "bad pcapng byte-order magic");
+                return -1;
+            }
+
+            r->num_ifaces = 0;
+        }
+
+        len = read32(r, &block[4]);
+
+        if (len < 12 || len % 4 || len > PCAPNG_MAX_BLOCK || (left = remaining(r, len)) < (off_t) len) {
+
+            if (left < 0) return -1;
+
+            snprintf(r->errbuf, PCAP_ERRBUF_SIZE, "bad pcapng block length %u", len);
+            return -1;
+        }
+
+        block = map_range(r, r->pos, len);
+
+        if (block == NULL) return -1;
+
+        if (read32(r, &block[len - 4]) != len) {
+            snprintf(r->errbuf, PCAP_ERRBUF_SIZE, "pcapng block lengths don't match");
+            return -1;
+        }
+
+        r->pos += len;
+
+        switch (type) {
+            case PCAPNG_IDB:
+                if (pcapng_add_iface(r, block, len)) return -1;
+                break;
+
+            case PCAPNG_EPB:
+                if (len < 32) break;
+
+                return pcapng_packet(r, pkt, block, len, read32(r, &block[8]),
+                                     (uint64_t) read32(r, &block[12]) << 32 | read32(r, &block[16]),
+                                     28, read32(r, &block[20]), read32(r, &block[24]));
+
+            case PCAPNG_SPB:
+                if (len < 16 || r->num_ifaces == 0) break;
+
+                /* No captured length, it's whatever of the packet fits the snaplen */
+                orig_len = read32(r, &block[8]);
+                caplen = orig_len < len - 16 ? orig_len : len - 16;
+
+                if (r->ifaces[0].snaplen && caplen > r->ifaces[0].snaplen) caplen = r->ifaces[0].snaplen;
+
+                return pcapng_packet(r, pkt, block, len, 0, 0, 12, caplen, orig_len);
+
+            case PCAPNG_OPB:
+                if (len < 32) break;
+
+                return pcapng_packet(r, pkt, block, len, read16(r, &block[8]),
+                                     (uint64_t) read32(r, &block[12]) << 32 | read32(r, &block[16]),
+                                     28, read32(r, &block[20]), read32(r, &block[24]));
+
+            default:
+                /* Statistics, name resolution and anything else have no packets */
+                break;
+        }
+    }
+}
+
+static int next_pcap(reader_t *r, packet_t *pkt) {
+
+    struct pcap_pkthdr *header;
+    const u_char *data;
+
+    switch (pcap_next_ex(r->pcap, &header, &data)) {
+        case 1:
+            pkt->ts_sec = (uint32_t) header->ts.tv_sec;
+            pkt->ts_nsec = (uint32_t) header->ts.tv_usec * 1000;
+            pkt->caplen = header->caplen;
+            pkt->len = header->len;
+            pkt->data = data;
+            return 1;
+        case -2:
+            return 0;
+        default:
+            snprintf(r->errbuf, PCAP_ERRBUF_SIZE, "%s", pcap_geterr(r->pcap));
+            return -1;
+    }
+}
+
+int reader_next(reader_t *r, packet_t *pkt) {
+
+    switch (r->kind) {
+        case READER_MMAP:
+            return next_native(r, pkt);
+        case READER_PCAPNG:
+            return next_pcapng(r, pkt);
+        case READER_LIVE:
+            return live_next(r, pkt);
+        default:
+            return next_pcap(r, pkt);
+    }
+}
+
+void reader_slice(const reader_t *r, reader_t *sub, off_t start, off_t end) {
+
+    memcpy(sub, r, sizeof(reader_t));
+
+    sub->shared = 1;
+    sub->file_size = end;
+    sub->pos = start;
+    sub->map_off = 0;
+    sub->map_len = 0;
+    sub->map = NULL;
+}
+
+void reader_seek(reader_t *r, off_t pos) {
+    r->pos = pos;
+}
+
+int reader_keeps_map(const reader_t *r) {
+
+    off_t need = r->pos + (off_t) PACKET_HEADER_LEN + (r->snaplen > MAX_CAPLEN ? r->snaplen : MAX_CAPLEN);
+
+    if (r->kind != READER_MMAP || r->zs != NULL || r->map == NULL) return 0;
+
+    /* The next record, however big, is mapped already or the file ends first */
+    return r->map_off + (off_t) r->map_len >= (need < r->file_size ? need : r->file_size);
+}
+
+int reader_idle(const reader_t *r) {
+    return r->kind == READER_LIVE && r->pkts_left == 0;
+}
+
+void reader_close(reader_t *r) {
+
+    if (r->kind == READER_LIVE) {
+        live_close(r);
+        r->kind = 0;
+        return;
+    }
+
+    decomp_close(r);
+
+    if (r->map != NULL) {
+        munmap(r->map, r->map_len);
+    }
+
+    if ((r->kind == READER_MMAP || r->kind == READER_PCAPNG) && !r->shared) {
+        close(r->fd);
+        free(r->ifaces);
+    }
+
+    if (r->pcap != NULL) {
+        pcap_close(r->pcap);
+    }
+
+    /* errbuf is left alone so the caller can still report it */
+    r->map = NULL;
+    r->ifaces = NULL;
+    r->pcap = NULL;
+    r->fd = -1;
+    r->kind = 0;
+}
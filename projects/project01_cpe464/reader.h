@@ -0,0 +1,176 @@
+
+#ifndef PROJECT_1_READER_H
+#define PROJECT_1_READER_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <pcap/pcap.h>
+
+/* Largest piece of the capture mapped at once, the mapping slides along the file */
+#ifndef READER_WINDOW
+#define READER_WINDOW ((size_t) 256 << 20)
+#endif
+
+#define PCAP_MAGIC_USEC         0xa1b2c3d4
+#define PCAP_MAGIC_NSEC         0xa1b23c4d
+#define PCAP_MAGIC_USEC_SWAPPED 0xd4c3b2a1
+#define PCAP_MAGIC_NSEC_SWAPPED 0x4d3cb2a1
+
+/* Block types of the pcapng format */
+#define PCAPNG_SHB 0x0a0d0d0a
+#define PCAPNG_IDB 0x00000001
+#define PCAPNG_OPB 0x00000002
+#define PCAPNG_SPB 0x00000003
+#define PCAPNG_EPB 0x00000006
+
+#define PCAPNG_BYTE_ORDER_MAGIC 0x1a2b3c4d
+
+/* Largest pcapng block accepted, anything bigger is treated as corruption */
+#define PCAPNG_MAX_BLOCK (16 << 20)
+
+/* Live capture ring, 64 blocks of 4 MiB, each handed over when full or after 50 ms */
+#define LIVE_BLOCK_SIZE    (1 << 22)
+#define LIVE_NUM_BLOCKS    64
+#define LIVE_FRAME_SIZE    2048
+#define LIVE_BLOCK_TIMEOUT 50
+
+/* Compressed captures are decompressed on their own thread into a ring of buffers this big */
+#define DECOMP_BUF_SIZE  (1 << 22)
+#define DECOMP_NUM_BUFS  8
+#define DECOMP_READ_SIZE (1 << 20)
+
+#define GZIP_MAGIC 0x8b1f     /* 1f 8b */
+#define ZSTD_MAGIC 0xfd2fb528 /* 28 b5 2f fd */
+
+#define DECOMP_GZIP 1
+#define DECOMP_ZSTD 2
+
+#define READER_MMAP   1
+#define READER_PCAP   2
+#define READER_PCAPNG 3
+#define READER_LIVE   4
+
+typedef struct packet {
+    uint32_t ts_sec;
+    uint32_t ts_nsec;
+    uint32_t caplen;
+    uint32_t len;
+    const uint8_t *data;
+} packet_t;
+
+/* One pcapng interface, timestamps on it are in units per second plus offset seconds */
+typedef struct pcapng_iface {
+    uint32_t linktype;
+    uint32_t snaplen;
+    uint64_t units;
+    int64_t offset;
+} pcapng_iface_t;
+
+typedef struct reader {
+    int kind;
+    int shared;
+
+    /* Native reader, only part of the file is mapped at a time */
+    int fd;
+    int swapped;
+    int nsec;
+    uint32_t snaplen;
+    uint32_t linktype;
+    off_t file_size;
+    off_t pos;
+    off_t map_off;
+    size_t map_len;
+    uint8_t *map;
+
+    /* Compressed, the decompressed bytes stand in for the mapping and pos counts them */
+    struct decomp *zs;
+
+    /* pcapng, interfaces of the current section */
+    pcapng_iface_t *ifaces;
+    uint32_t num_ifaces;
+    uint32_t max_ifaces;
+
+    /* Live capture, a TPACKET_V3 ring shared with the kernel */
+    uint8_t *ring;
+    size_t ring_len;
+    uint32_t block_size;
+    uint32_t num_blocks;
+    uint32_t cur_block;
+    uint32_t pkts_left;
+    const uint8_t *next_pkt;
+    int held;
+    int loopback;
+    uint64_t received;
+    uint64_t dropped;
+
+    /* libpcap fallback, for anything the native reader doesn't handle */
+    pcap_t *pcap;
+
+    char errbuf[PCAP_ERRBUF_SIZE];
+} reader_t;
+
+/* Returns 0 on success, otherwise -1 with the reason in r->errbuf */
+int reader_open(reader_t *r, const char *path);
+
+/*
+ * Returns 1 with the next packet, 0 at the end of the capture, or -1 with the
+ * reason in r->errbuf. pkt->data points into the mapping and stays valid until
+ * the next call.
+ */
+int reader_next(reader_t *r, packet_t *pkt);
+
+/*
+ * Sets up sub to read the records in [start, end) of a classic capture on its
+ * own mapping. start and end must be record boundaries, e.g. r->pos between
+ * calls to reader_next(). sub shares r's file, so close it before r.
+ */
+void reader_slice(const reader_t *r, reader_t *sub, off_t start, off_t end);
+
+/* Moves a classic capture's reader to pos, a record boundary such as r->pos between calls to reader_next() */
+void reader_seek(reader_t *r, off_t pos);
+
+void reader_close(reader_t *r);
+
+/*
+ * True if the next reader_next() is sure to leave a classic capture's mapping
+ * where it is, so the data of earlier packets stays valid as well. Each
+ * record's header sits right before pkt->data.
+ */
+int reader_keeps_map(const reader_t *r);
+
+/* True if the next reader_next() may have to wait for packets, a good time to flush output */
+int reader_idle(const reader_t *r);
+
+/*
+ * Starts decompressing r->fd on a thread of its own, format is DECOMP_GZIP or
+ * DECOMP_ZSTD. Returns -1 with the reason in r->errbuf if it can't, e.g. when
+ * trace was built without that library.
+ */
+int decomp_open(reader_t *r, int format);
+
+/* Decompressed bytes left from r->pos, up to want. Fewer means the data ends first, -1 that it's corrupt */
+off_t decomp_remaining(reader_t *r, off_t want);
+
+/*
+ * The decompressed bytes [offset, offset + len) in one piece, pieced together
+ * if they straddle buffers. offset can't go back past where the last call
+ * started. Valid until the next call.
+ */
+const uint8_t *decomp_range(reader_t *r, off_t offset, size_t len);
+
+void decomp_close(reader_t *r);
+
+/* Captures from an interface instead of a file, read with reader_next() */
+int live_open(reader_t *r, const char *ifname);
+
+int live_next(reader_t *r, packet_t *pkt);
+
+/* Packets the kernel has seen and dropped so far */
+void live_stats(reader_t *r, uint64_t *received, uint64_t *dropped);
+
+void live_close(reader_t *r);
+
+/* Makes reader_next() end the capture, safe to call from a signal handler */
+void live_stop(void);
+
+#endif /* PROJECT_1_READER_H */
@@ -0,0 +1,401 @@
+
+#include "trace.h"
+
+static const char *proto_names[STATS_NUM] = {
+        "Ethernet", "VLAN", "ARP", "IP", "IPv6", "TCP", "UDP", "ICMP", "Other IP", "Other"
+};
+
+stats_t *stats_new(int num) {
+
+    stats_t *stats = calloc(num, sizeof(stats_t));
+
+    if (stats == NULL) {
+        perror("calloc");
+        exit(1);
+    }
+
+    return stats;
+}
+
+static void count(stats_t *stats, int proto, uint32_t len) {
+    stats->proto_packets[proto]++;
+    stats->proto_bytes[proto] += len;
+}
+
+static void count_ports(uint64_t *ports, uint16_t src, uint16_t dst) {
+
+    ports[ntohs(src)]++;
+
+    if (dst != src) ports[ntohs(dst)]++;
+}
+
+/* Bit per STATS_ protocol the packet counts towards */
+static uint32_t packet_protos(const packet_info_t *info) {
+
+    uint32_t protos;
+
+    if (info->eth == NULL) return 0;
+
+    protos = 1 << STATS_ETH;
+
+    if (info->num_vlans > 0) protos |= 1 << STATS_VLAN;
+
+    if (info->arp != NULL) return protos | 1 << STATS_ARP;
+
+    if (info->ip != NULL) {
+        protos |= 1 << STATS_IP;
+    } else if (info->ip6 != NULL) {
+        protos |= 1 << STATS_IPV6;
+    } else {
+        return protos | 1 << STATS_OTHER;
+    }
+
+    if (info->tcp != NULL) {
+        protos |= 1 << STATS_TCP;
+    } else if (info->udp != NULL) {
+        protos |= 1 << STATS_UDP;
+    } else if (info->icmp != NULL) {
+        protos |= 1 << STATS_ICMP;
+    } else {
+        protos |= 1 << STATS_OTHER_IP;
+    }
+
+    return protos;
+}
+
+void stats_add(stats_t *stats, const packet_info_t *info) {
+
+    uint32_t len = info->pkt->len, protos = packet_protos(info);
+    uint64_t ts = (uint64_t) info->pkt->ts_sec * 1000000000 + info->pkt->ts_nsec;
+    int i;
+
+    if (stats->packets == 0 || ts < stats->first_ts) stats->first_ts = ts;
+    if (stats->packets == 0 || ts > stats->last_ts) stats->last_ts = ts;
+
+    stats->packets++;
+    stats->bytes += len;
+
+    for (i = 0; i < STATS_NUM; i++) {
+        if (protos & 1 << i) count(stats, i, len);
+    }
+
+    if (protos & 1 << STATS_IP && !info->ip_cksum_ok) stats->bad_ip_cksum++;
+
+    if (protos & 1 << STATS_TCP) {
+        count_ports(stats->tcp_ports, info->tcp->src_port, info->tcp->dst_port);
+        if (!info->tcp_cksum_ok) stats->bad_tcp_cksum++;
+    } else if (protos & 1 << STATS_UDP) {
+        count_ports(stats->udp_ports, info->udp->src_port, info->udp->dst_port);
+        if (!info->udp_cksum_ok) stats->bad_udp_cksum++;
+    } else if (protos & 1 << STATS_ICMP) {
+        if (!info->icmp_cksum_ok) stats->bad_icmp_cksum++;
+    }
+}
+
+void stats_packet(void *arg, int worker, outbuf_t *out, uint32_t pkt_num, const packet_t *pkt) {
+
+    packet_info_t info;
+
+    (void) out;
+    (void) pkt_num;
+
+    dissect_packet(pkt, &info);
+    stats_add(&((stats_t *) arg)[worker], &info);
+}
+
+void stats_merge(stats_t *dst, const stats_t *src) {
+
+    int i;
+
+    if (src->packets == 0) return;
+
+    if (dst->packets == 0 || src->first_ts < dst->first_ts) dst->first_ts = src->first_ts;
+    if (dst->packets == 0 || src->last_ts > dst->last_ts) dst->last_ts = src->last_ts;
+
+    dst->packets += src->packets;
+    dst->bytes += src->bytes;
+    dst->bad_ip_cksum += src->bad_ip_cksum;
+    dst->bad_tcp_cksum += src->bad_tcp_cksum;
+    dst->bad_udp_cksum += src->bad_udp_cksum;
+    dst->bad_icmp_cksum += src->bad_icmp_cksum;
+
+    for (i = 0; i < STATS_NUM; i++) {
+        dst->proto_packets[i] += src->proto_packets[i];
+        dst->proto_bytes[i] += src->proto_bytes[i];
+    }
+
+    for (i = 0; i < (1 << 16); i++) {
+        dst->tcp_ports[i] += src->tcp_ports[i];
+        dst->udp_ports[i] += src->udp_ports[i];
+    }
+}
+
+/* Busiest ports first, ties go to the lower port number */
+static void report_ports(outbuf_t *out, const char *label, const uint64_t *ports) {
+
+    uint8_t used[1 << 16] = {0};
+    int i, j, best;
+
+    ob_str(out, label);
+
+    for (i = 0; i < STATS_TOP_PORTS; i++) {
+
+        best = -1;
+
+        for (j = 0; j < (1 << 16); j++) {
+            if (ports[j] && !used[j] && (best < 0 || ports[j] > ports[best])) best = j;
+        }
+
+        if (best < 0) break;
+
+        used[best] = 1;
+
+        if (i) OB_LIT(out, ",");
+
+        OB_LIT(out, " ");
+        ob_dec(out, (uint32_t) best);
+        OB_LIT(out, " (");
+        ob_dec64(out, ports[best]);
+        OB_LIT(out, ")");
+    }
+
+    if (i == 0) OB_LIT(out, " none");
+
+    OB_LIT(out, "\n");
+}
+
+void stats_report(const stats_t *stats, outbuf_t *out) {
+
+    uint64_t duration = stats->last_ts - stats->first_ts;
+    int i;
+
+    OB_LIT(out, "\tCapture Statistics\n\t\tPackets: ");
+    ob_dec64(out, stats->packets);
+    OB_LIT(out, "\n\t\tBytes: ");
+    ob_dec64(out, stats->bytes);
+    OB_LIT(out, "\n\t\tDuration: ");
+    ob_dec64(out, duration / 1000000000);
+    OB_LIT(out, ".");
+    ob_dec_pad(out, (uint32_t) (duration % 1000000000), 9);
+    OB_LIT(out, " (s)\n\n\tProtocols\n");
+
+    for (i = 0; i < STATS_NUM; i++) {
+        OB_LIT(out, "\t\t");
+        ob_str(out, proto_names[i]);
+        OB_LIT(out, ": ");
+        ob_dec64(out, stats->proto_packets[i]);
+        OB_LIT(out, " packets, ");
+        ob_dec64(out, stats->proto_bytes[i]);
+        OB_LIT(out, " bytes\n");
+    }
+
+    OB_LIT(out, "\n\tBad Checksums\n\t\tIP: ");
+    ob_dec64(out, stats->bad_ip_cksum);
+    OB_LIT(out, "\n\t\tTCP: ");
+    ob_dec64(out, stats->bad_tcp_cksum);
+    OB_LIT(out, "\n\t\tUDP: ");
+    ob_dec64(out, stats->bad_udp_cksum);
+    OB_LIT(out, "\n\t\tICMP: ");
+    ob_dec64(out, stats->bad_icmp_cksum);
+    OB_LIT(out, "\n\n\tTop Ports\n");
+
+    report_ports(out, "\t\tTCP:", stats->tcp_ports);
+    report_ports(out, "\t\tUDP:", stats->udp_ports);
+}
+
+static void counters_line(counters_t *counters, outbuf_t *out) {
+
+    uint64_t received, dropped;
+
+    OB_LIT(out, "\t");
+    ob_dec(out, counters->second);
+    OB_LIT(out, "  Packets: ");
+    ob_dec64(out, counters->packets);
+    OB_LIT(out, "  Bytes: ");
+    ob_dec64(out, counters->bytes);
+
+    /* Only a live capture can fall behind */
+    if (counters->reader->kind == READER_LIVE) {
+        live_stats(counters->reader, &received, &dropped);
+        OB_LIT(out, "  Dropped: ");
+        ob_dec64(out, dropped);
+    }
+
+    ob_char(out, '\n');
+}
+
+void counters_packet(void *arg, int worker, outbuf_t *out, uint32_t pkt_num, const packet_t *pkt) {
+
+    counters_t *counters = (counters_t *) arg;
+
+    (void) worker;
+    (void) pkt_num;
+
+    /* Nothing is dissected, a new second just closes off the last one */
+    if (pkt->ts_sec != counters->second) {
+
+        if (counters->packets) counters_line(counters, out);
+
+        counters->second = pkt->ts_sec;
+        counters->packets = counters->bytes = 0;
+    }
+
+    counters->packets++;
+    counters->bytes += pkt->len;
+    counters->total_packets++;
+    counters->total_bytes += pkt->len;
+}
+
+void counters_report(counters_t *counters, outbuf_t *out) {
+
+    uint64_t received, dropped;
+
+    if (counters->packets) counters_line(counters, out);
+
+    OB_LIT(out, "\tTotal  Packets: ");
+    ob_dec64(out, counters->total_packets);
+    OB_LIT(out, "  Bytes: ");
+    ob_dec64(out, counters->total_bytes);
+
+    if (counters->reader->kind == READER_LIVE) {
+        live_stats(counters->reader, &received, &dropped);
+        OB_LIT(out, "  Received: ");
+        ob_dec64(out, received);
+        OB_LIT(out, "  Dropped: ");
+        ob_dec64(out, dropped);
+    }
+
+    ob_char(out, '\n');
+}
+
+void timeline_init(timeline_t *timeline, uint64_t width) {
+    memset(timeline, 0, sizeof(timeline_t));
+    timeline->width = width;
+}
+
+/* Seconds with as many decimals as the bucket width needs */
+static void timeline_time(outbuf_t *out, uint64_t ns, uint64_t width) {
+
+    uint32_t frac = (uint32_t) (ns % 1000000000);
+    int digits = 9;
+
+    while (digits > 0 && width % 10 == 0) {
+        width /= 10;
+        frac /= 10;
+        digits--;
+    }
+
+    ob_dec64(out, ns / 1000000000);
+
+    if (digits > 0) {
+        ob_char(out, '.');
+        ob_dec_pad(out, frac, digits);
+    }
+}
+
+/* Writes out every bucket before end, the slots are left empty for reuse */
+static void timeline_flush(timeline_t *timeline, outbuf_t *out, uint64_t end) {
+
+    timeline_bucket_t *bucket;
+    int i;
+
+    for (; timeline->oldest < end && timeline->oldest <= timeline->newest; timeline->oldest++) {
+
+        bucket = &timeline->buckets[timeline->oldest % TIMELINE_WINDOW];
+
+        if (bucket->packets == 0) continue;
+
+        OB_LIT(out, "\t");
+        timeline_time(out, timeline->oldest * timeline->width, timeline->width);
+        OB_LIT(out, "  Packets: ");
+        ob_dec64(out, bucket->packets);
+        OB_LIT(out, "  Bytes: ");
+        ob_dec64(out, bucket->bytes);
+        OB_LIT(out, "  bit/s: ");
+        ob_dec64(out, (uint64_t) ((double) bucket->bytes * 8e9 / (double) timeline->width));
+
+        for (i = 0; i < STATS_NUM; i++) {
+
+            if (bucket->proto_packets[i] == 0) continue;
+
+            OB_LIT(out, "  ");
+            ob_str(out, proto_names[i]);
+            OB_LIT(out, ": ");
+            ob_dec64(out, bucket->proto_packets[i]);
+        }
+
+        ob_char(out, '\n');
+
+        memset(bucket, 0, sizeof(timeline_bucket_t));
+        timeline->written++;
+    }
+}
+
+void timeline_packet(void *arg, int worker, outbuf_t *out, uint32_t pkt_num, const packet_t *pkt) {
+
+    timeline_t *timeline = (timeline_t *) arg;
+    timeline_bucket_t *bucket;
+    packet_info_t info;
+    uint64_t n = ((uint64_t) pkt->ts_sec * 1000000000 + pkt->ts_nsec) / timeline->width;
+    uint32_t protos;
+    int i;
+
+    (void) worker;
+    (void) pkt_num;
+
+    timeline->total_packets++;
+    timeline->total_bytes += pkt->len;
+
+    if (!timeline->open) {
+
+        timeline->oldest = timeline->newest = n;
+        timeline->open = 1;
+
+    } else if (n > timeline->newest) {
+
+        /* The window moves up to n, the buckets that fall out of it are done */
+        if (n - timeline->newest >= TIMELINE_WINDOW) {
+            timeline_flush(timeline, out, timeline->newest + 1);
+            timeline->oldest = n;
+        } else if (n >= TIMELINE_WINDOW) {
+            timeline_flush(timeline, out, n - TIMELINE_WINDOW + 1);
+        }
+
+        timeline->newest = n;
+
+    } else if (timeline->newest - n >= TIMELINE_WINDOW) {
+        timeline->late++;
+        return;
+    } else if (n < timeline->oldest) {
+        /* Nothing from here up to the oldest has been written out yet */
+        timeline->oldest = n;
+    }
+
+    dissect_packet(pkt, &info);
+    protos = packet_protos(&info);
+
+    bucket = &timeline->buckets[n % TIMELINE_WINDOW];
+    bucket->packets++;
+    bucket->bytes += pkt->len;
+
+    for (i = 0; i < STATS_NUM; i++) {
+        if (protos & 1 << i) bucket->proto_packets[i]++;
+    }
+}
+
+void timeline_report(timeline_t *timeline, outbuf_t *out) {
+
+    if (timeline->open) timeline_flush(timeline, out, timeline->newest + 1);
+
+    OB_LIT(out, "\tTotal  Packets: ");
+    ob_dec64(out, timeline->total_packets);
+    OB_LIT(out, "  Bytes: ");
+    ob_dec64(out, timeline->total_bytes);
+    OB_LIT(out, "  Buckets: ");
+    ob_dec64(out, timeline->written);
+    OB_LIT(out, "  Width: ");
+    timeline_time(out, timeline->width, timeline->width);
+    OB_LIT(out, " (s)  Late: ");
+    ob_dec64(out, timeline->late);
+    ob_char(out, '\n');
+}
@@ -0,0 +1,114 @@
+
+#ifndef PROJECT_1_STATS_H
+#define PROJECT_1_STATS_H
+
+#include <stdint.h>
+
+#include "libs/outbuf.h"
+#include "reader.h"
+
+/* Ports listed per protocol in the report */
+#define STATS_TOP_PORTS 10
+
+#define STATS_ETH      0
+#define STATS_VLAN     1
+#define STATS_ARP      2
+#define STATS_IP       3
+#define STATS_IPV6     4
+#define STATS_TCP      5
+#define STATS_UDP      6
+#define STATS_ICMP     7
+#define STATS_OTHER_IP 8
+#define STATS_OTHER    9
+#define STATS_NUM      10
+
+struct packet_info;
+
+typedef struct stats {
+    uint64_t packets;
+    uint64_t bytes;
+
+    uint64_t proto_packets[STATS_NUM];
+    uint64_t proto_bytes[STATS_NUM];
+
+    uint64_t bad_ip_cksum;
+    uint64_t bad_tcp_cksum;
+    uint64_t bad_udp_cksum;
+    uint64_t bad_icmp_cksum;
+
+    /* Capture time of the first and last packet, in nanoseconds */
+    uint64_t first_ts;
+    uint64_t last_ts;
+
+    /* Packets seen on each port, as either source or destination */
+    uint64_t tcp_ports[1 << 16];
+    uint64_t udp_ports[1 << 16];
+} stats_t;
+
+/* Running totals for --counters, one line per second of capture */
+typedef struct counters {
+    reader_t *reader;
+    uint32_t second;
+    uint64_t packets;
+    uint64_t bytes;
+    uint64_t total_packets;
+    uint64_t total_bytes;
+} counters_t;
+
+/* Buckets held open for packets that come in out of order, older ones are written out */
+#define TIMELINE_WINDOW 16
+
+typedef struct timeline_bucket {
+    uint64_t packets;
+    uint64_t bytes;
+    uint64_t proto_packets[STATS_NUM];
+} timeline_bucket_t;
+
+/* Totals for --timeline, one line per bucket of capture time that saw any packets */
+typedef struct timeline {
+
+    /* Bucket width in nanoseconds */
+    uint64_t width;
+
+    /* Bucket n covers capture times n * width up to (n + 1) * width and lives in slot n % TIMELINE_WINDOW */
+    timeline_bucket_t buckets[TIMELINE_WINDOW];
+    uint64_t oldest;
+    uint64_t newest;
+    int open;
+
+    uint64_t total_packets;
+    uint64_t total_bytes;
+    uint64_t written;
+
+    /* Packets whose bucket was already written out, only in the totals */
+    uint64_t late;
+} timeline_t;
+
+/* Returns zeroed stats for num copies, e.g. one per worker */
+stats_t *stats_new(int num);
+
+void stats_add(stats_t *stats, const struct packet_info *info);
+
+/* packet_fn_t that counts into ((stats_t *) arg)[worker] instead of printing */
+void stats_packet(void *arg, int worker, outbuf_t *out, uint32_t pkt_num, const packet_t *pkt);
+
+/* Adds src into dst */
+void stats_merge(stats_t *dst, const stats_t *src);
+
+void stats_report(const stats_t *stats, outbuf_t *out);
+
+/* packet_fn_t for --counters, arg is a counters_t. Serial only */
+void counters_packet(void *arg, int worker, outbuf_t *out, uint32_t pkt_num, const packet_t *pkt);
+
+/* Prints the last partial second and the totals */
+void counters_report(counters_t *counters, outbuf_t *out);
+
+void timeline_init(timeline_t *timeline, uint64_t width);
+
+/* packet_fn_t for --timeline, arg is a timeline_t. Serial only */
+void timeline_packet(void *arg, int worker, outbuf_t *out, uint32_t pkt_num, const packet_t *pkt);
+
+/* Writes out the buckets still open and the totals */
+void timeline_report(timeline_t *timeline, outbuf_t *out);
+
+#endif /* PROJECT_1_STATS_H */
@@ -0,0 +1,396 @@
+
+#include "trace.h"
+
+#define STREAM_MIN_BUCKETS 1024
+
+#define TCP_FIN 0x01
+#define TCP_SYN 0x02
+#define TCP_RST 0x04
+
+/* A held segment's bytes, straight after its header */
+#define SEG_DATA(seg) ((const uint8_t *) ((seg) + 1))
+
+/* Sequence numbers wrap, so they're compared by their signed distance */
+#define SEQ_DIFF(a, b) ((int32_t) ((uint32_t) (a) - (uint32_t) (b)))
+
+static void *stream_alloc(size_t size) {
+
+    void *p = malloc(size);
+
+    if (p == NULL) {
+        perror("malloc");
+        exit(1);
+    }
+
+    return p;
+}
+
+static void mem_add(stream_table_t *table, size_t bytes) {
+    table->mem += bytes;
+    if (table->mem > table->peak_mem) table->peak_mem = table->mem;
+}
+
+void streams_init(stream_table_t *table, size_t flow_cap, size_t total_cap, int policy) {
+
+    memset(table, 0, sizeof(stream_table_t));
+
+    table->buckets = calloc(STREAM_MIN_BUCKETS, sizeof(stream_t *));
+
+    if (table->buckets == NULL) {
+        perror("calloc");
+        exit(1);
+    }
+
+    table->mask = STREAM_MIN_BUCKETS - 1;
+    table->flow_cap = flow_cap;
+    table->total_cap = total_cap;
+    table->policy = policy;
+}
+
+static void lru_unlink(stream_table_t *table, stream_t *s) {
+
+    if (s->prev != NULL) s->prev->next = s->next;
+    else table->lru_head = s->next;
+
+    if (s->next != NULL) s->next->prev = s->prev;
+    else table->lru_tail = s->prev;
+}
+
+static void lru_push(stream_table_t *table, stream_t *s) {
+
+    s->prev = NULL;
+    s->next = table->lru_head;
+
+    if (table->lru_head != NULL) table->lru_head->prev = s;
+    else table->lru_tail = s;
+
+    table->lru_head = s;
+}
+
+/* Doubles the bucket count, keeping the chains short */
+static void streams_grow(stream_table_t *table) {
+
+    uint32_t size = (table->mask + 1) * 2, i;
+    stream_t **buckets = calloc(size, sizeof(stream_t *));
+    stream_t *s, *next;
+
+    /* Longer chains still work, so just carry on if there's no room */
+    if (buckets == NULL) return;
+
+    for (i = 0; i <= table->mask; i++) {
+        for (s = table->buckets[i]; s != NULL; s = next) {
+            next = s->hash_next;
+            s->hash_next = buckets[flow_hash(&s->key) & (size - 1)];
+            buckets[flow_hash(&s->key) & (size - 1)] = s;
+        }
+    }
+
+    free(table->buckets);
+    table->buckets = buckets;
+    table->mask = size - 1;
+}
+
+/* Finds the stream for key, adding it if create is set, and marks it most recently seen */
+static stream_t *stream_lookup(stream_table_t *table, const flow_key_t *key, int create) {
+
+    stream_t **bucket = &table->buckets[flow_hash(key) & table->mask];
+    stream_t *s;
+
+    for (s = *bucket; s != NULL; s = s->hash_next) {
+        if (memcmp(&s->key, key, sizeof(flow_key_t)) == 0) {
+            lru_unlink(table, s);
+            lru_push(table, s);
+            return s;
+        }
+    }
+
+    if (!create) return NULL;
+
+    s = stream_alloc(sizeof(stream_t));
+
+    memset(s, 0, sizeof(stream_t));
+    s->key = *key;
+    http_init(&s->http);
+
+    s->hash_next = *bucket;
+    *bucket = s;
+    lru_push(table, s);
+
+    table->count++;
+    table->streams++;
+    mem_add(table, sizeof(stream_t));
+
+    if (table->count > table->mask + 1) streams_grow(table);
+
+    return s;
+}
+
+/* Passes the part of [seq, seq + len) past next_seq to the parser */
+static void deliver(stream_table_t *table, stream_t *s, outbuf_t *out, uint32_t pkt_num,
+                    uint32_t seq, const uint8_t *data, uint32_t len) {
+
+    int32_t seen = SEQ_DIFF(s->next_seq, seq);
+
+    if (seen > 0) {
+
+        if ((uint32_t) seen >= len) {
+            table->retransmitted += len;
+            return;
+        }
+
+        table->retransmitted += seen;
+        data += seen;
+        len -= seen;
+    }
+
+    table->delivered += len;
+    s->next_seq += len;
+
+    http_parse(&s->http, out, &s->key, pkt_num, data, len);
+}
+
+/* Skips len bytes that will never arrive */
+static void skip(stream_table_t *table, stream_t *s, outbuf_t *out, uint32_t len) {
+
+    table->gaps++;
+    table->gap_bytes += len;
+    s->next_seq += len;
+
+    http_gap(&s->http, out, len);
+}
+
+/* Skips what the snap length cut off the end of [seq, cut), once delivery has got as far as the cut */
+static void skip_lost(stream_table_t *table, stream_t *s, outbuf_t *out, uint32_t cut, uint32_t lost) {
+    if (lost > 0 && SEQ_DIFF(cut, s->next_seq) == 0) skip(table, s, out, lost);
+}
+
+static void segment_free(stream_table_t *table, stream_t *s, segment_t *seg) {
+
+    s->pending_bytes -= seg->len;
+    table->mem -= sizeof(segment_t) + seg->len;
+
+    free(seg);
+}
+
+/* Keeps a copy of a segment that arrived ahead of next_seq */
+static void segment_hold(stream_table_t *table, stream_t *s, uint32_t seq, const uint8_t *data, uint32_t len,
+                         uint32_t lost) {
+
+    segment_t **pos = &s->pending, *seg;
+
+    while (*pos != NULL && SEQ_DIFF((*pos)->seq, seq) < 0) pos = &(*pos)->next;
+
+    /* The same segment again */
+    if (*pos != NULL && (*pos)->seq == seq && (*pos)->len >= len && (*pos)->len + (*pos)->lost >= len + lost) {
+        table->retransmitted += len;
+        return;
+    }
+
+    seg = stream_alloc(sizeof(segment_t) + len);
+    seg->seq = seq;
+    seg->len = len;
+    seg->lost = lost;
+    memcpy(seg + 1, data, len);
+
+    seg->next = *pos;
+    *pos = seg;
+
+    s->pending_bytes += len;
+    mem_add(table, sizeof(segment_t) + len);
+}
+
+/* Delivers the held segments that are now in order */
+static void stream_drain(stream_table_t *table, stream_t *s, outbuf_t *out, uint32_t pkt_num) {
+
+    segment_t *seg;
+
+    while ((seg = s->pending) != NULL && SEQ_DIFF(seg->seq, s->next_seq) <= 0) {
+        s->pending = seg->next;
+        deliver(table, s, out, pkt_num, seg->seq, SEG_DATA(seg), seg->len);
+        skip_lost(table, s, out, seg->seq + seg->len, seg->lost);
+        segment_free(table, s, seg);
+    }
+}
+
+/* Empties a stream's held segments without waiting for the holes to fill, as the policy says */
+static void stream_release(stream_table_t *table, stream_t *s, outbuf_t *out) {
+
+    segment_t *seg;
+    int32_t ahead;
+
+    while ((seg = s->pending) != NULL) {
+
+        s->pending = seg->next;
+
+        if (table->policy == REASM_FLUSH) {
+
+            if ((ahead = SEQ_DIFF(seg->seq, s->next_seq)) > 0) skip(table, s, out, (uint32_t) ahead);
+
+            deliver(table, s, out, s->last_pkt, seg->seq, SEG_DATA(seg), seg->len);
+            skip_lost(table, s, out, seg->seq + seg->len, seg->lost);
+
+        } else {
+
+            if ((ahead = SEQ_DIFF(seg->seq + seg->len + seg->lost, s->next_seq)) > 0) skip(table, s, out, (uint32_t) ahead);
+
+            table->dropped += seg->len;
+        }
+
+        segment_free(table, s, seg);
+    }
+}
+
+static void stream_close(stream_table_t *table, stream_t *s, outbuf_t *out) {
+
+    stream_t **pos = &table->buckets[flow_hash(&s->key) & table->mask];
+
+    stream_release(table, s, out);
+    http_close(&s->http, out);
+
+    while (*pos != s) pos = &(*pos)->hash_next;
+    *pos = s->hash_next;
+
+    lru_unlink(table, s);
+
+    table->count--;
+    table->mem -= sizeof(stream_t);
+
+    free(s);
+}
+
+void streams_add(stream_table_t *table, outbuf_t *out, uint32_t pkt_num, const packet_info_t *info) {
+
+    const tcp_header_t *tcp = info->tcp;
+    const uint8_t *data;
+    flow_key_t key;
+    stream_t *s;
+    uint16_t flags, header_len;
+    uint32_t seq, len, captured, lost = 0;
+
+    if (tcp == NULL) return;
+
+    flags = ntohs(tcp->flags);
+    header_len = (flags >> 12) * 4;
+
+    if (header_len < TCP_HEADER_LEN || info->ip_len < info->ip_header_len + header_len) return;
+
+    data = (const uint8_t *) tcp + header_len;
+    len = info->ip_len - info->ip_header_len - header_len;
+
+    /* Pure ACKs carry nothing to reassemble */
+    if (len == 0 && !(flags & (TCP_SYN | TCP_FIN | TCP_RST))) return;
+
+    /* Whatever the snap length cut off is lost */
+    captured = data < info->pkt->data + info->pkt->caplen ? (uint32_t) (info->pkt->data + info->pkt->caplen - data) : 0;
+
+    if (len > captured) {
+        lost = len - captured;
+        len = captured;
+    }
+
+    /*
+     * Corrupt segments would feed the parser garbage. The checksum only covers
+     * what was captured, so it can only be held against a whole segment
+     */
+    if (lost == 0 && !info->tcp_cksum_ok) return;
+
+    flow_key(&key, info);
+
+    if ((s = stream_lookup(table, &key, !(flags & TCP_RST))) == NULL) return;
+
+    if (flags & TCP_RST) {
+        stream_close(table, s, out);
+        return;
+    }
+
+    seq = ntohl(tcp->seq);
+
+    /* The SYN takes up one sequence number before the data */
+    if (flags & TCP_SYN) {
+        seq++;
+        if (!s->has_seq) s->next_seq = seq;
+        s->has_seq = 1;
+    }
+
+    /* Picked up mid-stream, start from here */
+    if (!s->has_seq) {
+        s->next_seq = seq;
+        s->has_seq = 1;
+    }
+
+    if (len > 0 || lost > 0) s->last_pkt = pkt_num;
+
+    if (SEQ_DIFF(seq, s->next_seq) <= 0) {
+
+        /* In order data goes straight from the packet to the parser */
+        deliver(table, s, out, pkt_num, seq, data, len);
+
+        skip_lost(table, s, out, seq + len, lost);
+
+        stream_drain(table, s, out, pkt_num);
+
+    } else if (len > 0 || lost > 0) {
+
+        table->out_of_order++;
+        segment_hold(table, s, seq, data, len, lost);
+
+        if (s->pending_bytes > table->flow_cap) stream_release(table, s, out);
+    }
+
+    /* Over the total, make room from the streams seen longest ago, then from this one */
+    while (table->mem > table->total_cap && table->lru_tail != s) {
+        table->evicted++;
+        stream_close(table, table->lru_tail, out);
+    }
+
+    if (table->mem > table->total_cap) stream_release(table, s, out);
+
+    if (flags & TCP_FIN) {
+        s->fin = 1;
+        s->fin_seq = seq + len + lost;
+    }
+
+    if (s->fin && SEQ_DIFF(s->next_seq, s->fin_seq) >= 0) stream_close(table, s, out);
+}
+
+void streams_packet(void *arg, int worker, outbuf_t *out, uint32_t pkt_num, const packet_t *pkt) {
+
+    packet_info_t info;
+
+    (void) worker;
+
+    dissect_packet(pkt, &info);
+    streams_add((stream_table_t *) arg, out, pkt_num, &info);
+}
+
+void streams_free(stream_table_t *table, outbuf_t *out) {
+
+    /* Oldest first */
+    while (table->lru_tail != NULL) stream_close(table, table->lru_tail, out);
+
+    free(table->buckets);
+    table->buckets = NULL;
+}
+
+void streams_report(const stream_table_t *table, outbuf_t *out) {
+
+    OB_LIT(out, "\n\tReassembly\n\t\tStreams: ");
+    ob_dec64(out, table->streams);
+    OB_LIT(out, "\n\t\tDelivered: ");
+    ob_dec64(out, table->delivered);
+    OB_LIT(out, " (bytes)\n\t\tRetransmitted: ");
+    ob_dec64(out, table->retransmitted);
+    OB_LIT(out, " (bytes)\n\t\tOut of Order: ");
+    ob_dec64(out, table->out_of_order);
+    OB_LIT(out, " (segments)\n\t\tGaps: ");
+    ob_dec64(out, table->gaps);
+    OB_LIT(out, " (");
+    ob_dec64(out, table->gap_bytes);
+    OB_LIT(out, " bytes)\n\t\tDropped: ");
+    ob_dec64(out, table->dropped);
+    OB_LIT(out, " (bytes)\n\t\tEvicted: ");
+    ob_dec64(out, table->evicted);
+    OB_LIT(out, " (streams)\n\t\tPeak Memory: ");
+    ob_dec64(out, table->peak_mem);
+    OB_LIT(out, " (bytes)\n");
+}
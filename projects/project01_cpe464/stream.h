@@ -0,0 +1,99 @@
+
+#ifndef PROJECT_1_STREAM_H
+#define PROJECT_1_STREAM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "libs/outbuf.h"
+#include "reader.h"
+#include "flows.h"
+#include "http.h"
+
+/* Out-of-order bytes held per stream and in total unless --reasm-flow-cap / --reasm-cap say otherwise */
+#define REASM_DEFAULT_FLOW_CAP ((size_t) 1 << 20)
+#define REASM_DEFAULT_CAP      ((size_t) 256 << 20)
+
+/* What happens to a stream's held segments when a cap is hit */
+#define REASM_FLUSH 0   /* Hand them to the parser as they are, with the holes reported as gaps */
+#define REASM_DROP  1   /* Throw them away and skip past them */
+
+struct packet_info;
+
+/* An out-of-order segment, its data follows the struct */
+typedef struct segment {
+    struct segment *next;
+    uint32_t seq;
+    uint32_t len;
+
+    /* Bytes past len that the snap length cut off */
+    uint32_t lost;
+} segment_t;
+
+/* One direction of a TCP connection */
+typedef struct stream {
+    flow_key_t key;
+    struct stream *hash_next;
+
+    /* Neighbours in the LRU list, most recently seen first */
+    struct stream *prev;
+    struct stream *next;
+
+    /* Sequence number of the next byte the parser expects */
+    uint32_t next_seq;
+    uint8_t has_seq;
+
+    /* Set once a FIN is seen, the stream closes when next_seq reaches fin_seq */
+    uint8_t fin;
+    uint32_t fin_seq;
+
+    /* Last packet with data for this stream, credited with anything flushed later */
+    uint32_t last_pkt;
+
+    /* Held segments, sorted by sequence number */
+    segment_t *pending;
+    size_t pending_bytes;
+
+    http_parser_t http;
+} stream_t;
+
+typedef struct stream_table {
+    stream_t **buckets;
+    uint32_t mask;
+    uint32_t count;
+
+    stream_t *lru_head;
+    stream_t *lru_tail;
+
+    size_t flow_cap;
+    size_t total_cap;
+    int policy;
+
+    /* Bytes used by streams and held segments, now and at most */
+    size_t mem;
+    size_t peak_mem;
+
+    uint64_t streams;
+    uint64_t delivered;
+    uint64_t retransmitted;
+    uint64_t out_of_order;
+    uint64_t gaps;
+    uint64_t gap_bytes;
+    uint64_t dropped;
+    uint64_t evicted;
+} stream_table_t;
+
+void streams_init(stream_table_t *table, size_t flow_cap, size_t total_cap, int policy);
+
+/* Adds a dissected packet's TCP payload, passing whatever is now in order to the parser */
+void streams_add(stream_table_t *table, outbuf_t *out, uint32_t pkt_num, const struct packet_info *info);
+
+/* packet_fn_t for --http, arg is a stream_table_t. Serial only */
+void streams_packet(void *arg, int worker, outbuf_t *out, uint32_t pkt_num, const packet_t *pkt);
+
+/* Flushes and closes every stream left open */
+void streams_free(stream_table_t *table, outbuf_t *out);
+
+void streams_report(const stream_table_t *table, outbuf_t *out);
+
+#endif /* PROJECT_1_STREAM_H */
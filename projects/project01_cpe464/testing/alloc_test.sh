@@ -0,0 +1,59 @@
+#!/bin/bash
+
+# Runs trace over every reference capture with a malloc counter preloaded and
+# checks the number of allocations doesn't grow with the number of packets.
+# Linux only, see malloc_count.c
+
+NUM_ERRS=0
+
+# Ensure program is up to date
+make trace -C ../ || exit 1
+
+# Build the allocation counter
+gcc -shared -fPIC -o malloc_count.so malloc_count.c || exit 1
+
+# Grab our test files' names
+cd ../ref_pcap/ || exit 1
+TEST_FILES=(*.pcap)
+
+cd ../testing || exit 1
+
+echo "-----"
+
+BASELINE=""
+
+for FILE in "${TEST_FILES[@]}"; do
+
+    # Count the packets and the allocations made while dissecting them
+    ALLOCS=$(LD_PRELOAD=./malloc_count.so ../trace "../ref_pcap/$FILE" 2>&1 >/dev/null | sed -n 's/^malloc_count: //p')
+    PACKETS=$(../trace "../ref_pcap/$FILE" | grep -c "Packet number")
+
+    printf "%-24s %6d packets %6d allocations\n" "$FILE" "$PACKETS" "$ALLOCS"
+
+    if [ -z "$ALLOCS" ]; then
+        echo "  no malloc_count report, is LD_PRELOAD supported?"
+        NUM_ERRS=$((NUM_ERRS + 1))
+        continue
+    fi
+
+    # Setup costs are the same for every file, so any difference is per-packet
+    if [ -z "$BASELINE" ]; then
+        BASELINE=$ALLOCS
+    elif [ "$ALLOCS" -ne "$BASELINE" ]; then
+        echo "  expected $BASELINE allocations, the same as every other capture"
+        NUM_ERRS=$((NUM_ERRS + 1))
+    fi
+done
+
+# Report results to the user
+if [ $NUM_ERRS -eq 0 ]; then
+    printf "No per-packet allocations!\n"
+else
+    printf "There where %d captures with per-packet allocations :( \n" $NUM_ERRS
+fi
+
+# Clean up after ourselves
+rm -f malloc_count.so
+make clean -C ../ > /dev/null
+
+[ $NUM_ERRS -eq 0 ]
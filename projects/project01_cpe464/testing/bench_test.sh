@@ -0,0 +1,226 @@
+#!/bin/bash
+
+# Runs trace over every reference capture in every output mode, checks the
+# output byte for byte against the golden files and reports packets/s, MB/s,
+# peak RSS and allocations. Then times each mode over a large synthetic
+# capture from pcap_gen (seed 1), and fails if any is more than THRESHOLD
+# percent (default 10) slower than bench_baseline.txt. The first run, or one
+# with --update, records the baseline instead. It's only meaningful on the
+# machine it was recorded on, so it isn't checked in.
+#
+# Usage: ./bench_test.sh [--update] [size in MB of the large capture, default 2048]
+# Linux only, see malloc_count.c
+
+UPDATE=0
+if [ "$1" = "--update" ]; then
+    UPDATE=1
+    shift
+fi
+
+SIZE_MB=${1:-2048}
+THRESHOLD=${THRESHOLD:-10}
+BASELINE=bench_baseline.txt
+CAPTURE=/tmp/trace_bench.pcap
+NUM_ERRS=0
+
+# Golden output of each mode is in ref_output/<mode>/, except text which is ref_output/ itself
+MODES=(text ndjson csv stats flows counters http top timeline write)
+
+mode_args() {
+    case $1 in
+        text) ;;
+        ndjson|csv) echo "--format $1" ;;
+        top) echo "--top 10" ;;
+        timeline) echo "--timeline 10ms" ;;
+        write) echo "-w $CAPTURE.w" ;;
+        *) echo "--$1" ;;
+    esac
+}
+
+golden() {
+    if [ "$1" = text ]; then
+        echo "../ref_output/$2.out"
+    else
+        echo "../ref_output/$1/$2.out"
+    fi
+}
+
+# Runs trace with the allocation counter loaded, output to $1, and sets MS, ALLOCS and RSS_KB
+run() {
+
+    local OUT=$1
+    shift
+
+    START=$(date +%s%N)
+    LD_PRELOAD=./malloc_count.so ../trace "$@" > "$OUT" 2> $CAPTURE.err
+    END=$(date +%s%N)
+
+    MS=$(((END - START) / 1000000))
+    [ $MS -gt 0 ] || MS=1
+
+    ALLOCS=$(sed -n 's/^malloc_count: //p' $CAPTURE.err)
+    RSS_KB=$(sed -n 's/^max_rss_kb: //p' $CAPTURE.err)
+}
+
+report() {
+    printf "%-24s %-9s %8d packets %6d ms %9d pkt/s %6d MB/s %7d KB RSS %5d allocations\n" \
+           "$1" "$2" "$3" $MS $(($3 * 1000 / MS)) $(($4 / 1000 / MS)) "$RSS_KB" "$ALLOCS"
+}
+
+# Ensure programs are up to date
+make trace pcap_gen -C ../ || exit 1
+
+# Build the allocation counter
+gcc -shared -fPIC -o malloc_count.so malloc_count.c || exit 1
+
+# Grab our test files' names
+cd ../ref_pcap/ || exit 1
+TEST_FILES=(*.pcap)
+
+cd ../testing || exit 1
+
+echo "-----"
+
+for FILE in "${TEST_FILES[@]}"; do
+
+    PACKETS=$(../trace --counters "../ref_pcap/$FILE" | sed -n 's/^\tTotal  Packets: \([0-9]*\).*/\1/p')
+    SIZE=$(stat -c %s "../ref_pcap/$FILE")
+
+    for MODE in "${MODES[@]}"; do
+
+        run $CAPTURE.out $(mode_args $MODE) "../ref_pcap/$FILE"
+        report "$FILE" $MODE "$PACKETS" "$SIZE"
+
+        if ! cmp -s "$(golden $MODE "$FILE")" $CAPTURE.out; then
+            echo "  output differs from $(golden $MODE "$FILE")"
+            NUM_ERRS=$((NUM_ERRS + 1))
+        fi
+    done
+
+    # The parallel reader has to give the same output as the serial one
+    run $CAPTURE.out -j 4 "../ref_pcap/$FILE"
+
+    if ! cmp -s "$(golden text "$FILE")" $CAPTURE.out; then
+        echo "  -j 4 output differs from $(golden text "$FILE")"
+        NUM_ERRS=$((NUM_ERRS + 1))
+    fi
+
+    # So does reading it compressed
+    gzip -c "../ref_pcap/$FILE" > $CAPTURE.gz
+    run $CAPTURE.out $CAPTURE.gz
+
+    if ! cmp -s "$(golden text "$FILE")" $CAPTURE.out; then
+        echo "  gzip output differs from $(golden text "$FILE")"
+        NUM_ERRS=$((NUM_ERRS + 1))
+    fi
+
+    # Everything written back out is a copy of the capture
+    if ! cmp -s "../ref_pcap/$FILE" $CAPTURE.w; then
+        echo "  -w copy differs from $FILE"
+        NUM_ERRS=$((NUM_ERRS + 1))
+    fi
+done
+
+# pcapng in both byte orders, over two sections and two timestamp resolutions, and IDBs that have to be refused
+for FILE in ../ref_pcap/*.pcapng; do
+
+    GOLDEN="../ref_output/pcapng/$(basename "$FILE").out"
+    ../trace "$FILE" > $CAPTURE.out 2>&1
+
+    if ! cmp -s "$GOLDEN" $CAPTURE.out; then
+        echo "  output differs from $GOLDEN"
+        NUM_ERRS=$((NUM_ERRS + 1))
+    fi
+done
+
+# pcap_gen -n writes the same packets as pcapng, it just fits fewer of them in the size
+../pcap_gen -s 1 -S 4 $CAPTURE > /dev/null || exit 1
+../pcap_gen -s 1 -S 4 -n $CAPTURE.ng > /dev/null || exit 1
+
+PACKETS=$(../trace --counters $CAPTURE.ng | sed -n 's/^\tTotal  Packets: \([0-9]*\).*/\1/p')
+../trace $CAPTURE > $CAPTURE.out
+
+# Up to the blank line before the first packet the pcapng doesn't have
+LINE=$(grep -n "^Packet number: $((PACKETS + 1))  " $CAPTURE.out | cut -d: -f1)
+if [ -n "$LINE" ]; then
+    head -n $((LINE - 2)) $CAPTURE.out > $CAPTURE.head
+else
+    cp $CAPTURE.out $CAPTURE.head
+fi
+
+if ! ../trace $CAPTURE.ng | cmp -s - $CAPTURE.head; then
+    echo "  pcap_gen -n output differs from its classic capture"
+    NUM_ERRS=$((NUM_ERRS + 1))
+fi
+
+# A 64 MB record, more than the decompression buffers hold between them, then the packets of Http.pcap
+{
+    printf '\xd4\xc3\xb2\xa1\x02\x00\x04\x00\x00\x00\x00\x00\x00\x00\x00\x00\xff\xff\xff\xff\x01\x00\x00\x00'
+    printf '\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x04\x00\x00\x00\x04'
+    head -c $((64 << 20)) /dev/zero
+    tail -c +25 ../ref_pcap/Http.pcap
+} > $CAPTURE
+gzip -c $CAPTURE > $CAPTURE.gz
+
+../trace $CAPTURE > $CAPTURE.out
+
+if ! timeout 60 ../trace $CAPTURE.gz | cmp -s - $CAPTURE.out; then
+    echo "  gzip output of a record bigger than the buffers differs"
+    NUM_ERRS=$((NUM_ERRS + 1))
+fi
+
+# The same capture every time, so runs compare against the baseline
+../pcap_gen -s 1 -S "$SIZE_MB" $CAPTURE || exit 1
+
+SIZE=$(stat -c %s $CAPTURE)
+PACKETS=$(../trace --counters $CAPTURE | sed -n 's/^\tTotal  Packets: \([0-9]*\).*/\1/p')
+
+echo "-----"
+printf "%d bytes, %d packets, %d cores\n" "$SIZE" "$PACKETS" "$(nproc)"
+
+[ -f $BASELINE ] || UPDATE=1
+[ $UPDATE -eq 0 ] || : > $BASELINE.new
+
+for MODE in "${MODES[@]}" text-j stats-j flows-j; do
+
+    # The -j variants use every core
+    if [ "${MODE%-j}" != "$MODE" ]; then
+        run /dev/null -j "$(nproc)" $(mode_args ${MODE%-j}) $CAPTURE
+    else
+        run /dev/null $(mode_args $MODE) $CAPTURE
+    fi
+
+    report trace_bench.pcap $MODE "$PACKETS" "$SIZE"
+
+    MBPS=$((SIZE / 1000 / MS))
+
+    if [ $UPDATE -eq 1 ]; then
+        echo "$MODE $MBPS" >> $BASELINE.new
+        continue
+    fi
+
+    BASE=$(sed -n "s/^$MODE //p" $BASELINE)
+
+    if [ -n "$BASE" ] && [ $((MBPS * 100)) -lt $((BASE * (100 - THRESHOLD))) ]; then
+        echo "  $MBPS MB/s is more than $THRESHOLD% under the baseline of $BASE MB/s"
+        NUM_ERRS=$((NUM_ERRS + 1))
+    fi
+done
+
+if [ $UPDATE -eq 1 ]; then
+    mv $BASELINE.new $BASELINE
+    echo "Baseline saved to $BASELINE"
+fi
+
+# Report results to the user
+if [ $NUM_ERRS -eq 0 ]; then
+    printf "No regressions!\n"
+else
+    printf "There where %d regressions :( \n" $NUM_ERRS
+fi
+
+# Clean up after ourselves
+rm -f $CAPTURE $CAPTURE.gz $CAPTURE.w $CAPTURE.ng $CAPTURE.head $CAPTURE.out $CAPTURE.err malloc_count.so
+make clean -C ../ > /dev/null
+
+[ $NUM_ERRS -eq 0 ]
@@ -0,0 +1,263 @@
+/*
+ * Checks every in_cksum() kernel against in_cksum_scalar(), then compares
+ * their throughput across payload sizes. The second table compares building
+ * a PDU the old way (memset, memcpy, in_cksum) against the fused
+ * in_cksum_partial_copy() path, in payload bytes per cycle.
+ *
+ * Usage: cksum_bench [seconds per run]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "../libs/checksum.h"
+
+#define MAX_LEN 65535
+#define VERIFY_LEN 2048
+
+/* Same layout as the project 3 PDU */
+#define PDU_HEADER_LEN 7
+#define MAX_PAYLOAD_LEN 1400
+
+typedef unsigned short (*cksum_fn_t)(unsigned short *, int);
+
+typedef struct kernel {
+    const char *name;
+    cksum_fn_t fn;
+    int supported;
+} kernel_t;
+
+static double now(void) {
+
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (double) ts.tv_sec + (double) ts.tv_nsec / 1e9;
+}
+
+static int verify(kernel_t *k, uint8_t *buf) {
+
+    int len, offset;
+
+    /* Every length and alignment over random data */
+    for (offset = 0; offset < 4; offset++) {
+        for (len = 0; len <= VERIFY_LEN; len++) {
+            if (k->fn((unsigned short *) &buf[offset], len) !=
+                in_cksum_scalar((unsigned short *) &buf[offset], len)) {
+                fprintf(stderr, "%s: mismatch at offset %d, len %d\n", k->name, offset, len);
+                return 1;
+            }
+        }
+    }
+
+    /* Largest sizes, including the worst case for carries */
+    for (len = MAX_LEN - 3; len <= MAX_LEN; len++) {
+        if (k->fn((unsigned short *) buf, len) != in_cksum_scalar((unsigned short *) buf, len)) {
+            fprintf(stderr, "%s: mismatch at len %d\n", k->name, len);
+            return 1;
+        }
+    }
+
+    memset(buf, 0xff, MAX_LEN + 4);
+
+    for (len = MAX_LEN - 3; len <= MAX_LEN; len++) {
+        if (k->fn((unsigned short *) buf, len) != in_cksum_scalar((unsigned short *) buf, len)) {
+            fprintf(stderr, "%s: mismatch at len %d (all ones)\n", k->name, len);
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/* Cycle counter, or nanoseconds where there isn't one */
+static double cycles(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return (double) __rdtsc();
+#else
+    return now() * 1e9;
+#endif
+}
+
+static unsigned short pdu_old(uint8_t *pdu, const uint8_t *data, int len) {
+
+    memset(&pdu[PDU_HEADER_LEN], 0, MAX_PAYLOAD_LEN);
+    memcpy(&pdu[PDU_HEADER_LEN], data, len);
+
+    return in_cksum((unsigned short *) pdu, PDU_HEADER_LEN + len);
+}
+
+static unsigned short pdu_fused(uint8_t *pdu, const uint8_t *data, int len) {
+
+    unsigned int sum = in_cksum_partial(pdu, PDU_HEADER_LEN, 0);
+
+    sum = in_cksum_block_add(sum, in_cksum_partial_copy(&pdu[PDU_HEADER_LEN], data, len, 0), PDU_HEADER_LEN);
+
+    return in_cksum_fold(sum);
+}
+
+static int verify_copy(uint8_t *buf) {
+
+    uint8_t pdu_a[PDU_HEADER_LEN + MAX_PAYLOAD_LEN], pdu_b[PDU_HEADER_LEN + MAX_PAYLOAD_LEN];
+    int len, offset;
+
+    for (offset = 0; offset < 4; offset++) {
+        for (len = 0; len <= MAX_PAYLOAD_LEN; len++) {
+
+            memcpy(pdu_a, &buf[offset + 2000], PDU_HEADER_LEN);
+            memcpy(pdu_b, &buf[offset + 2000], PDU_HEADER_LEN);
+
+            if (pdu_old(pdu_a, &buf[offset], len) != pdu_fused(pdu_b, &buf[offset], len) ||
+                memcmp(pdu_a, pdu_b, PDU_HEADER_LEN + len) != 0) {
+                fprintf(stderr, "in_cksum_partial_copy: mismatch at offset %d, len %d\n", offset, len);
+                return 1;
+            }
+        }
+    }
+
+    return 0;
+}
+
+/* Payload bytes per cycle for building one PDU */
+static double bench_pdu(unsigned short (*build)(uint8_t *, const uint8_t *, int),
+                        uint8_t *pdu, const uint8_t *data, int len, double seconds) {
+
+    volatile unsigned short sink = 0;
+    unsigned long iters = 0, i, batch = 1 + (1 << 20) / (unsigned long) len;
+    double start = now(), start_cycles = cycles();
+
+    do {
+        for (i = 0; i < batch; i++) {
+            sink ^= build(pdu, data, len);
+        }
+        iters += batch;
+    } while (now() - start < seconds);
+
+    (void) sink;
+
+    return (double) iters * len / (cycles() - start_cycles);
+}
+
+static double bench(cksum_fn_t fn, uint8_t *buf, int len, double seconds) {
+
+    volatile unsigned short sink = 0;
+    unsigned long iters = 0, i, batch = 1 + (1 << 20) / (unsigned long) len;
+    double start = now(), elapsed;
+
+    do {
+        for (i = 0; i < batch; i++) {
+            sink ^= fn((unsigned short *) buf, len);
+        }
+        iters += batch;
+        elapsed = now() - start;
+    } while (elapsed < seconds);
+
+    (void) sink;
+
+    /* MB/s */
+    return (double) iters * len / elapsed / 1e6;
+}
+
+int main(int argc, char *argv[]) {
+
+    int sizes[] = {20, 40, 64, 128, 576, 1400, 1500, 4096, 9000, 16384, 32768, 65535};
+    int pdu_sizes[] = {4, 64, 256, 512, 1000, 1400};
+    int num_sizes = sizeof(sizes) / sizeof(sizes[0]), i, j, failed = 0;
+    int num_pdu_sizes = sizeof(pdu_sizes) / sizeof(pdu_sizes[0]);
+    uint8_t pdu[PDU_HEADER_LEN + MAX_PAYLOAD_LEN] = {0};
+    double seconds = argc > 1 ? atof(argv[1]) : 0.2, base, rate;
+
+    kernel_t kernels[] = {
+            {"scalar", in_cksum_scalar, 1},
+#if defined(__x86_64__) || defined(__i386__)
+            {"sse2",   in_cksum_sse2,   0},
+            {"avx2",   in_cksum_avx2,   0},
+#endif
+            {"in_cksum", in_cksum,      1}
+    };
+    int num_kernels = sizeof(kernels) / sizeof(kernels[0]);
+
+    uint8_t *buf = malloc(MAX_LEN + 4);
+
+    if (buf == NULL) {
+        perror("malloc");
+        return 1;
+    }
+
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    kernels[1].supported = __builtin_cpu_supports("sse2");
+    kernels[2].supported = __builtin_cpu_supports("avx2");
+#endif
+
+    printf("in_cksum() dispatches to: %s\n\n", in_cksum_kernel());
+
+    /* Bit-for-bit comparison against the reference */
+    for (i = 1; i < num_kernels; i++) {
+
+        if (!kernels[i].supported) continue;
+
+        srand(464);
+        for (j = 0; j < MAX_LEN + 4; j++) buf[j] = (uint8_t) rand();
+
+        if (verify(&kernels[i], buf)) {
+            failed = 1;
+        } else {
+            printf("%-8s matches scalar\n", kernels[i].name);
+        }
+    }
+
+    for (j = 0; j < MAX_LEN + 4; j++) buf[j] = (uint8_t) rand();
+
+    if (verify_copy(buf)) {
+        failed = 1;
+    } else {
+        printf("%-8s matches memcpy + in_cksum\n", "copy");
+    }
+
+    if (failed) return 1;
+
+    /* Throughput table, MB/s with the speedup over scalar in brackets */
+    printf("\n%8s", "bytes");
+    for (i = 0; i < num_kernels; i++) {
+        if (kernels[i].supported) printf("  %18s", kernels[i].name);
+    }
+    printf("\n");
+
+    for (j = 0; j < num_sizes; j++) {
+
+        base = bench(in_cksum_scalar, buf, sizes[j], seconds);
+
+        printf("%8d  %10.0f MB/s (1.0x)", sizes[j], base);
+
+        for (i = 1; i < num_kernels; i++) {
+            if (!kernels[i].supported) continue;
+            rate = bench(kernels[i].fn, buf, sizes[j], seconds);
+            printf("  %7.0f MB/s (%.1fx)", rate, rate / base);
+        }
+        printf("\n");
+    }
+
+    /* PDU construction, payload bytes per cycle */
+    printf("\n%8s  %20s  %20s\n", "payload", "memset+memcpy+cksum", "partial_copy");
+
+    for (j = 0; j < num_pdu_sizes; j++) {
+
+        base = bench_pdu(pdu_old, pdu, buf, pdu_sizes[j], seconds);
+        rate = bench_pdu(pdu_fused, pdu, buf, pdu_sizes[j], seconds);
+
+        printf("%8d  %11.2f B/cycle  %11.2f B/cycle (%.1fx)\n", pdu_sizes[j], base, rate, rate / base);
+    }
+
+    free(buf);
+
+    return 0;
+}
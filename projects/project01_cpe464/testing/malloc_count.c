@@ -0,0 +1,54 @@
+/*
+ * LD_PRELOAD shim that counts heap allocations and reports the total, and
+ * the peak resident set size, to stderr when the program exits. Used by
+ * alloc_test.sh and bench_test.sh.
+ *
+ * Linux/glibc only, it forwards to glibc's own __libc_* allocators.
+ *
+ * Build: gcc -shared -fPIC -o malloc_count.so malloc_count.c
+ */
+
+#include <stddef.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+extern void *__libc_malloc(size_t size);
+
+extern void *__libc_calloc(size_t count, size_t size);
+
+extern void *__libc_realloc(void *ptr, size_t size);
+
+static unsigned long num_allocs = 0;
+
+void *malloc(size_t size) {
+    num_allocs++;
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size) {
+    num_allocs++;
+    return __libc_calloc(count, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+    num_allocs++;
+    return __libc_realloc(ptr, size);
+}
+
+__attribute__((destructor))
+static void report(void) {
+
+    char buf[96];
+    int len;
+    struct rusage usage;
+
+    if (getrusage(RUSAGE_SELF, &usage)) usage.ru_maxrss = 0;
+
+    /* Format on the stack so reporting doesn't allocate */
+    len = snprintf(buf, sizeof(buf), "malloc_count: %lu\nmax_rss_kb: %ld\n", num_allocs, usage.ru_maxrss);
+
+    if (write(STDERR_FILENO, buf, len) < 0) {
+        _exit(1);
+    }
+}
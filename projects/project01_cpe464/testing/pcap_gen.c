@@ -0,0 +1,485 @@
+/*
+ * Writes a synthetic capture for scale testing, the same one for the same
+ * seed. Frames are ARP, ICMP echo, TCP on the ports trace names (HTTP,
+ * Telnet, FTP, POP3, SMTP) and UDP in the proportions given by -m. A share
+ * of them get bad IP or TCP checksums or IP options. Payloads are slices of
+ * one random pool, copied and checksummed in a single pass, so a capture is
+ * written at about the speed of memory.
+ *
+ * Usage: pcap_gen [-n] [-s seed] [-c packets | -S megabytes] [-m arp,icmp,tcp,udp]
+ *                 [-i bad IP %] [-t bad TCP %] [-o IP options %] out.pcap
+ *        -n writes pcapng instead of classic pcap
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "../libs/checksum.h"
+
+#define POOL_LEN (1 << 20)
+#define OUT_LEN (4 << 20)
+#define NUM_HOSTS 256
+
+/* Ethernet without the FCS */
+#define MIN_FRAME 60
+#define MAX_FRAME 1514
+
+/* Largest record, a pcapng EPB around the largest frame */
+#define MAX_RECORD (32 + MAX_FRAME + 3)
+
+#define ETH_LEN 14
+#define ARP_LEN 28
+#define IP_LEN 20
+#define TCP_LEN 20
+#define UDP_LEN 8
+#define ICMP_LEN 8
+
+#define MIX_ARP  0
+#define MIX_ICMP 1
+#define MIX_TCP  2
+#define MIX_UDP  3
+#define MIX_NUM  4
+
+/* xorshift64* multiplier, built up this way to stay valid C89 */
+#define RNG_MULT ((uint64_t) 0x2545f491 << 32 | 0x4f6cdd1d)
+
+static const uint16_t tcp_ports[] = {80, 80, 80, 23, 20, 21, 110, 25};
+static const uint16_t udp_ports[] = {53, 67, 123, 161, 514};
+
+static uint64_t rng_state;
+
+static uint8_t pool[POOL_LEN];
+static uint8_t out[OUT_LEN];
+static size_t out_len;
+static int out_fd;
+
+static uint8_t host_mac[NUM_HOSTS][6];
+static uint8_t host_ip[NUM_HOSTS][4];
+
+static uint64_t rng(void) {
+
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+
+    return rng_state * RNG_MULT;
+}
+
+/* Uniform in [0, n) */
+static uint32_t rand_below(uint32_t n) {
+    return (uint32_t) (((rng() >> 32) * n) >> 32);
+}
+
+static void put16(uint8_t *p, uint16_t val) {
+    p[0] = (uint8_t) (val >> 8);
+    p[1] = (uint8_t) val;
+}
+
+static void put32(uint8_t *p, uint32_t val) {
+    put16(p, (uint16_t) (val >> 16));
+    put16(&p[2], (uint16_t) val);
+}
+
+/* Little-endian, for the file headers */
+static void put32le(uint8_t *p, uint32_t val) {
+    p[0] = (uint8_t) val;
+    p[1] = (uint8_t) (val >> 8);
+    p[2] = (uint8_t) (val >> 16);
+    p[3] = (uint8_t) (val >> 24);
+}
+
+static void out_flush(void) {
+
+    size_t done = 0;
+    ssize_t n;
+
+    while (done < out_len) {
+
+        n = write(out_fd, &out[done], out_len - done);
+
+        if (n < 0 && errno != EINTR) {
+            perror("write");
+            exit(1);
+        }
+
+        if (n > 0) done += (size_t) n;
+    }
+
+    out_len = 0;
+}
+
+static void eth(uint8_t *f, int src, int dst, uint16_t type) {
+    memcpy(f, host_mac[dst], 6);
+    memcpy(&f[6], host_mac[src], 6);
+    put16(&f[12], type);
+}
+
+/* Stores a checksum as in_cksum_fold() returns it, spoiled if bad is set */
+static void put_cksum(uint8_t *p, unsigned int sum, int bad) {
+
+    unsigned short cksum = in_cksum_fold(sum);
+
+    /* Never maps 0 onto 0xffff, which would still check out */
+    if (bad) cksum ^= 0x5555;
+
+    memcpy(p, &cksum, 2);
+}
+
+static uint32_t build_arp(uint8_t *f, int src, int dst) {
+
+    int reply = rand_below(2);
+
+    eth(f, src, reply ? dst : src, 0x0806);
+
+    if (!reply) memset(f, 0xff, 6);
+
+    f += ETH_LEN;
+
+    put16(f, 1);
+    put16(&f[2], 0x0800);
+    f[4] = 6;
+    f[5] = 4;
+    put16(&f[6], reply ? 2 : 1);
+    memcpy(&f[8], host_mac[src], 6);
+    memcpy(&f[14], host_ip[src], 4);
+
+    if (reply) memcpy(&f[18], host_mac[dst], 6);
+    else memset(&f[18], 0, 6);
+
+    memcpy(&f[24], host_ip[dst], 4);
+
+    /* Padded out to the smallest frame */
+    memset(&f[ARP_LEN], 0, MIN_FRAME - ETH_LEN - ARP_LEN);
+
+    return MIN_FRAME;
+}
+
+/* Fills in an IPv4 header with opt_len bytes of options, returns its length */
+static uint32_t build_ip(uint8_t *p, int src, int dst, uint8_t protocol, uint32_t opt_len,
+                         uint32_t payload_len, int bad) {
+
+    uint32_t header_len = IP_LEN + opt_len;
+
+    p[0] = (uint8_t) (0x40 | header_len / 4);
+    p[1] = 0;
+    put16(&p[2], (uint16_t) (header_len + payload_len));
+    put16(&p[4], (uint16_t) rng());
+    put16(&p[6], 0x4000);
+    p[8] = 64;
+    p[9] = protocol;
+    put16(&p[10], 0);
+    memcpy(&p[12], host_ip[src], 4);
+    memcpy(&p[16], host_ip[dst], 4);
+
+    /* Router Alert, then NOPs */
+    if (opt_len > 0) {
+        p[20] = 0x94;
+        p[21] = 4;
+        put16(&p[22], 0);
+        memset(&p[24], 1, opt_len - 4);
+    }
+
+    put_cksum(&p[10], in_cksum_partial(p, (int) header_len, 0), bad);
+
+    return header_len;
+}
+
+/* Sum of the IPv4 pseudo header */
+static unsigned int pseudo_sum(int src, int dst, uint8_t protocol, uint32_t len) {
+
+    uint8_t pseudo[12];
+
+    memcpy(pseudo, host_ip[src], 4);
+    memcpy(&pseudo[4], host_ip[dst], 4);
+    pseudo[8] = 0;
+    pseudo[9] = protocol;
+    put16(&pseudo[10], (uint16_t) len);
+
+    return in_cksum_partial(pseudo, sizeof(pseudo), 0);
+}
+
+static uint32_t build_ip_packet(uint8_t *f, int kind, int src, int dst, int bad_ip, int bad_tcp, int options) {
+
+    uint8_t *ip = &f[ETH_LEN], *l4;
+    uint32_t opt_len = options ? 4 * (1 + rand_below(10)) : 0;
+    uint32_t header_len, l4_len, max, len;
+    uint16_t port;
+    uint8_t protocol = kind == MIX_ICMP ? 1 : kind == MIX_TCP ? 6 : 17;
+    unsigned int sum;
+
+    l4_len = kind == MIX_ICMP ? ICMP_LEN : kind == MIX_TCP ? TCP_LEN : UDP_LEN;
+    max = MAX_FRAME - ETH_LEN - IP_LEN - opt_len - l4_len;
+
+    /* Plenty of small packets, the rest spread up to the largest */
+    len = rand_below(4) ? rand_below(65) : rand_below(max + 1);
+
+    eth(f, src, dst, 0x0800);
+    header_len = build_ip(ip, src, dst, protocol, opt_len, l4_len + len, bad_ip);
+    l4 = &ip[header_len];
+
+    switch (kind) {
+
+        case MIX_ICMP:
+            l4[0] = rand_below(2) ? 8 : 0;
+            l4[1] = 0;
+            put16(&l4[2], 0);
+            put32(&l4[4], (uint32_t) rng());
+            sum = 0;
+            break;
+
+        case MIX_TCP:
+            port = tcp_ports[rand_below(sizeof(tcp_ports) / sizeof(tcp_ports[0]))];
+
+            /* Client to server or back */
+            if (rand_below(2)) {
+                put16(l4, (uint16_t) (32768 + rand_below(28232)));
+                put16(&l4[2], port);
+            } else {
+                put16(l4, port);
+                put16(&l4[2], (uint16_t) (32768 + rand_below(28232)));
+            }
+
+            put32(&l4[4], (uint32_t) rng());
+            put32(&l4[8], (uint32_t) rng());
+
+            /* Mostly ACK or PSH ACK, now and then SYN, FIN or RST */
+            switch (rand_below(16)) {
+                case 0:  put16(&l4[12], 0x5002); break;
+                case 1:  put16(&l4[12], 0x5012); break;
+                case 2:  put16(&l4[12], 0x5011); break;
+                case 3:  put16(&l4[12], 0x5004); break;
+                default: put16(&l4[12], len ? 0x5018 : 0x5010); break;
+            }
+
+            put16(&l4[14], (uint16_t) (1024 + rand_below(64512)));
+            put16(&l4[16], 0);
+            put16(&l4[18], 0);
+            sum = pseudo_sum(src, dst, protocol, l4_len + len);
+            break;
+
+        default:
+            port = udp_ports[rand_below(sizeof(udp_ports) / sizeof(udp_ports[0]))];
+            put16(l4, (uint16_t) (32768 + rand_below(28232)));
+            put16(&l4[2], port);
+            put16(&l4[4], (uint16_t) (l4_len + len));
+            put16(&l4[6], 0);
+            sum = pseudo_sum(src, dst, protocol, l4_len + len);
+            break;
+    }
+
+    /* Header, then the payload copied and summed in one go */
+    sum = in_cksum_partial(l4, (int) l4_len, sum);
+    sum = in_cksum_partial_copy(&l4[l4_len], &pool[rand_below(POOL_LEN - MAX_FRAME)], (int) len, sum);
+
+    switch (kind) {
+        case MIX_ICMP:
+            put_cksum(&l4[2], sum, 0);
+            break;
+        case MIX_TCP:
+            put_cksum(&l4[16], sum, bad_tcp);
+            break;
+        default:
+            /* A UDP checksum that comes out as 0 is sent as all ones */
+            put_cksum(&l4[6], sum, 0);
+            if (l4[6] == 0 && l4[7] == 0) put16(&l4[6], 0xffff);
+            break;
+    }
+
+    len += ETH_LEN + header_len + l4_len;
+
+    if (len < MIN_FRAME) {
+        memset(&f[len], 0, MIN_FRAME - len);
+        len = MIN_FRAME;
+    }
+
+    return len;
+}
+
+static void usage(void) {
+    fprintf(stderr, "Usage: pcap_gen [-n] [-s seed] [-c packets | -S megabytes] [-m arp,icmp,tcp,udp]\n"
+                    "                [-i bad IP %%] [-t bad TCP %%] [-o IP options %%] out.pcap\n");
+}
+
+int main(int argc, char *argv[]) {
+
+    uint64_t seed = 1, count = 1000, size = 0, written, packets, word;
+    uint32_t mix[MIX_NUM] = {2, 8, 70, 20}, total = 0, pick, len, ts_sec, ts_usec;
+    int opt, pcapng = 0, bad_ip = 1, bad_tcp = 1, options = 5, kind, src, dst, i;
+    uint8_t *rec, *f;
+    char *end;
+
+    while ((opt = getopt(argc, argv, "ns:c:S:m:i:t:o:")) != -1) {
+        switch (opt) {
+            case 'n':
+                pcapng = 1;
+                break;
+            case 's':
+                seed = strtoul(optarg, NULL, 0);
+                break;
+            case 'c':
+                count = strtoul(optarg, NULL, 0);
+                break;
+            case 'S':
+                size = (uint64_t) strtoul(optarg, NULL, 0) << 20;
+                count = 0;
+                break;
+            case 'm':
+                for (i = 0, end = optarg; i < MIX_NUM; i++) {
+                    mix[i] = (uint32_t) strtoul(end, &end, 10);
+                    if (*end == ',') end++;
+                }
+
+                if (*end != '\0') {
+                    usage();
+                    return 1;
+                }
+                break;
+            case 'i':
+                bad_ip = atoi(optarg);
+                break;
+            case 't':
+                bad_tcp = atoi(optarg);
+                break;
+            case 'o':
+                options = atoi(optarg);
+                break;
+            default:
+                usage();
+                return 1;
+        }
+    }
+
+    for (i = 0; i < MIX_NUM; i++) total += mix[i];
+
+    if (optind != argc - 1 || total == 0) {
+        usage();
+        return 1;
+    }
+
+    out_fd = open(argv[optind], O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+    if (out_fd < 0) {
+        perror(argv[optind]);
+        return 1;
+    }
+
+    /* Zero would stick at zero */
+    rng_state = seed ^ RNG_MULT;
+
+    for (i = 0; i < POOL_LEN; i += 8) {
+        word = rng();
+        memcpy(&pool[i], &word, 8);
+    }
+
+    /* Locally administered MACs, addresses in 10.0.0.0/16 */
+    for (i = 0; i < NUM_HOSTS; i++) {
+        put32(host_mac[i], (uint32_t) rng());
+        put16(&host_mac[i][4], (uint16_t) i);
+        host_mac[i][0] = (uint8_t) ((host_mac[i][0] & 0xfc) | 0x02);
+        host_ip[i][0] = 10;
+        host_ip[i][1] = 0;
+        host_ip[i][2] = (uint8_t) rand_below(256);
+        host_ip[i][3] = (uint8_t) (1 + i % 254);
+    }
+
+    ts_sec = 1700000000 + rand_below(86400);
+    ts_usec = 0;
+
+    if (pcapng) {
+
+        /* Section header, then one Ethernet interface with microsecond timestamps */
+        put32le(out, 0x0a0d0d0a);
+        put32le(&out[4], 28);
+        put32le(&out[8], 0x1a2b3c4d);
+        put32le(&out[12], 1);
+        put32le(&out[16], 0xffffffff);
+        put32le(&out[20], 0xffffffff);
+        put32le(&out[24], 28);
+        put32le(&out[28], 0x00000001);
+        put32le(&out[32], 20);
+        put32le(&out[36], 1);
+        put32le(&out[40], 65535);
+        put32le(&out[44], 20);
+        out_len = 48;
+
+    } else {
+
+        put32le(out, 0xa1b2c3d4);
+        put32le(&out[4], 2 | 4 << 16);
+        put32le(&out[8], 0);
+        put32le(&out[12], 0);
+        put32le(&out[16], 65535);
+        put32le(&out[20], 1);
+        out_len = 24;
+    }
+
+    written = out_len;
+
+    for (packets = 0; count ? packets < count : written < size; packets++) {
+
+        if (out_len + MAX_RECORD > OUT_LEN) out_flush();
+
+        rec = &out[out_len];
+        f = &rec[pcapng ? 28 : 16];
+
+        for (pick = rand_below(total), kind = 0; pick >= mix[kind]; kind++) pick -= mix[kind];
+
+        src = (int) rand_below(NUM_HOSTS);
+        dst = (int) rand_below(NUM_HOSTS);
+
+        if (kind == MIX_ARP) {
+            len = build_arp(f, src, dst);
+        } else {
+            len = build_ip_packet(f, kind, src, dst, (int) rand_below(100) < bad_ip,
+                                  kind == MIX_TCP && (int) rand_below(100) < bad_tcp,
+                                  (int) rand_below(100) < options);
+        }
+
+        /* Up to a millisecond apart */
+        ts_usec += rand_below(1000);
+
+        if (ts_usec >= 1000000) {
+            ts_sec++;
+            ts_usec -= 1000000;
+        }
+
+        if (pcapng) {
+
+            /* Enhanced packet block, padded to 32 bits with its length at both ends */
+            memset(&f[len], 0, 3);
+            put32le(rec, 0x00000006);
+            put32le(&rec[4], 32 + ((len + 3) & ~3u));
+            put32le(&rec[8], 0);
+            put32le(&rec[12], (uint32_t) (((uint64_t) ts_sec * 1000000 + ts_usec) >> 32));
+            put32le(&rec[16], (uint32_t) ((uint64_t) ts_sec * 1000000 + ts_usec));
+            put32le(&rec[20], len);
+            put32le(&rec[24], len);
+            put32le(&f[(len + 3) & ~3u], 32 + ((len + 3) & ~3u));
+            len = 32 + ((len + 3) & ~3u);
+
+        } else {
+
+            put32le(rec, ts_sec);
+            put32le(&rec[4], ts_usec);
+            put32le(&rec[8], len);
+            put32le(&rec[12], len);
+            len += 16;
+        }
+
+        out_len += len;
+        written += len;
+    }
+
+    out_flush();
+    close(out_fd);
+
+    fprintf(stderr, "%lu packets, %lu bytes, seed %lu\n", (unsigned long) packets, (unsigned long) written,
+            (unsigned long) seed);
+
+    return 0;
+}
@@ -0,0 +1,49 @@
+#!/bin/bash
+
+# Times trace -j over a large capture at 1, 2, 4 and 8 threads and checks the
+# output is identical to the serial run. The capture is largeMix.pcap with its
+# records repeated, pass the number of copies to make it bigger (default 1000,
+# about 110MB).
+
+COPIES=${1:-1000}
+CAPTURE=/tmp/trace_scaling.pcap
+NUM_ERRS=0
+
+# Ensure program is up to date
+make trace -C ../ || exit 1
+
+# Global header once, then the records over and over
+head -c 24 ../ref_pcap/largeMix.pcap > $CAPTURE
+tail -c +25 ../ref_pcap/largeMix.pcap > $CAPTURE.records
+for ((i = 0; i < COPIES; i++)); do
+    cat $CAPTURE.records
+done >> $CAPTURE
+rm -f $CAPTURE.records
+
+SIZE=$(stat -c %s $CAPTURE)
+
+echo "-----"
+printf "%d bytes, %d cores\n" "$SIZE" "$(nproc)"
+
+../trace $CAPTURE > $CAPTURE.serial
+
+for THREADS in 1 2 4 8; do
+
+    START=$(date +%s%N)
+    ../trace -j $THREADS $CAPTURE > $CAPTURE.out
+    END=$(date +%s%N)
+
+    MS=$(((END - START) / 1000000))
+    printf "%2d threads %6d ms %6d MB/s\n" $THREADS $MS $((SIZE / 1000 / (MS > 0 ? MS : 1)))
+
+    if ! cmp -s $CAPTURE.serial $CAPTURE.out; then
+        echo "  output differs from the serial run"
+        NUM_ERRS=$((NUM_ERRS + 1))
+    fi
+done
+
+# Clean up after ourselves
+rm -f $CAPTURE $CAPTURE.serial $CAPTURE.out
+make clean -C ../ > /dev/null
+
+[ $NUM_ERRS -eq 0 ]
@@ -0,0 +1,419 @@
+
+#include "trace.h"
+
+/* Row i of the sketch uses h + i * h2, two hashes are as good as TOP_DEPTH independent ones */
+#define ROW(h, h2, i) (((h) + (uint32_t) (i) * (h2)) & (TOP_WIDTH - 1))
+
+/* e / TOP_WIDTH of the bytes, rounded up, e taken as a touch over 2.718 */
+#define SKETCH_ERROR(bytes) ((bytes) / 1000 * 2719 / TOP_WIDTH + 1)
+
+static const char *list_names[TOP_NUM] = {"Talkers", "Destination Ports", "Conversations"};
+
+static uint32_t second_hash(uint32_t h) {
+    return ((h >> 16 | h << 16) * 0x9e3779b1) | 1;
+}
+
+static void list_init(top_list_t *list, uint32_t max) {
+
+    uint32_t size = 2;
+
+    while (size < max * 2) size *= 2;
+
+    list->max = max;
+    list->mask = size - 1;
+    list->heap = malloc(max * sizeof(top_entry_t));
+    list->index = malloc(size * sizeof(uint32_t));
+
+    if (list->heap == NULL || list->index == NULL) {
+        perror("malloc");
+        exit(1);
+    }
+
+    memset(list->index, 0xff, size * sizeof(uint32_t));
+}
+
+top_t *top_new(int num, uint32_t n) {
+
+    top_t *top = calloc(num, sizeof(top_t));
+    uint32_t max = n * 8 > TOP_MIN_SLOTS ? n * 8 : TOP_MIN_SLOTS;
+    int i, j;
+
+    if (top == NULL) {
+        perror("calloc");
+        exit(1);
+    }
+
+    for (i = 0; i < num; i++) {
+
+        top[i].n = n;
+
+        for (j = 0; j < TOP_NUM; j++) list_init(&top[i].lists[j], max);
+    }
+
+    return top;
+}
+
+void top_free(top_t *top, int num) {
+
+    int i, j;
+
+    for (i = 0; i < num; i++) {
+        for (j = 0; j < TOP_NUM; j++) {
+            free(top[i].lists[j].heap);
+            free(top[i].lists[j].index);
+        }
+    }
+
+    free(top);
+}
+
+/* Adds bytes to the sketch and returns the key's estimate after */
+static uint64_t sketch_add(top_list_t *list, uint32_t hash, uint64_t bytes) {
+
+    uint32_t h2 = second_hash(hash);
+    uint64_t est = UINT64_MAX, *counter;
+    int i;
+
+    for (i = 0; i < TOP_DEPTH; i++) {
+        counter = &list->sketch[i][ROW(hash, h2, i)];
+        *counter += bytes;
+        if (*counter < est) est = *counter;
+    }
+
+    return est;
+}
+
+static uint64_t sketch_estimate(const top_list_t *list, uint32_t hash) {
+
+    uint32_t h2 = second_hash(hash);
+    uint64_t est = UINT64_MAX;
+    int i;
+
+    for (i = 0; i < TOP_DEPTH; i++) {
+        if (list->sketch[i][ROW(hash, h2, i)] < est) est = list->sketch[i][ROW(hash, h2, i)];
+    }
+
+    return est;
+}
+
+/* Heap position of the key, or TOP_EMPTY if it isn't tracked */
+static uint32_t find(const top_list_t *list, const flow_key_t *key, uint32_t hash) {
+
+    const top_entry_t *entry;
+    uint32_t i;
+
+    for (i = hash & list->mask; list->index[i] != TOP_EMPTY; i = (i + 1) & list->mask) {
+
+        entry = &list->heap[list->index[i]];
+
+        if (entry->hash == hash && memcmp(&entry->key, key, sizeof(flow_key_t)) == 0) return list->index[i];
+    }
+
+    return TOP_EMPTY;
+}
+
+static void index_insert(top_list_t *list, uint32_t pos) {
+
+    uint32_t i = list->heap[pos].hash & list->mask;
+
+    while (list->index[i] != TOP_EMPTY) i = (i + 1) & list->mask;
+
+    list->index[i] = pos;
+    list->heap[pos].slot = i;
+}
+
+/* Empties slot i, moving back any later key in the run that would be lost behind the hole */
+static void index_remove(top_list_t *list, uint32_t i) {
+
+    uint32_t j = i, home;
+
+    for (;;) {
+
+        j = (j + 1) & list->mask;
+
+        if (list->index[j] == TOP_EMPTY) break;
+
+        home = list->heap[list->index[j]].hash & list->mask;
+
+        if (((j - home) & list->mask) >= ((j - i) & list->mask)) {
+            list->index[i] = list->index[j];
+            list->heap[list->index[i]].slot = i;
+            i = j;
+        }
+    }
+
+    list->index[i] = TOP_EMPTY;
+}
+
+static void heap_swap(top_list_t *list, uint32_t a, uint32_t b) {
+
+    top_entry_t tmp = list->heap[a];
+
+    list->heap[a] = list->heap[b];
+    list->heap[b] = tmp;
+
+    list->index[list->heap[a].slot] = a;
+    list->index[list->heap[b].slot] = b;
+}
+
+static void sift_down(top_list_t *list, uint32_t pos) {
+
+    uint32_t child;
+
+    while ((child = pos * 2 + 1) < list->count) {
+
+        if (child + 1 < list->count && list->heap[child + 1].bytes < list->heap[child].bytes) child++;
+
+        if (list->heap[pos].bytes <= list->heap[child].bytes) break;
+
+        heap_swap(list, pos, child);
+        pos = child;
+    }
+}
+
+static void sift_up(top_list_t *list, uint32_t pos) {
+
+    while (pos > 0 && list->heap[pos].bytes < list->heap[(pos - 1) / 2].bytes) {
+        heap_swap(list, pos, (pos - 1) / 2);
+        pos = (pos - 1) / 2;
+    }
+}
+
+/* Starts tracking a key, in place of the lightest one if it's full and the key is heavier */
+static void admit(top_list_t *list, const flow_key_t *key, uint32_t hash, uint64_t bytes, uint64_t err) {
+
+    uint32_t pos = list->count;
+
+    if (list->count == list->max) {
+
+        list->lossy = 1;
+
+        if (bytes <= list->heap[0].bytes) return;
+
+        index_remove(list, list->heap[0].slot);
+        pos = 0;
+
+    } else {
+        list->count++;
+    }
+
+    list->heap[pos].key = *key;
+    list->heap[pos].hash = hash;
+    list->heap[pos].bytes = bytes;
+    list->heap[pos].err = err;
+
+    index_insert(list, pos);
+
+    sift_up(list, pos);
+    sift_down(list, pos);
+}
+
+static void list_add(top_list_t *list, const flow_key_t *key, uint64_t bytes) {
+
+    uint32_t hash = flow_hash(key), pos;
+    uint64_t est = sketch_add(list, hash, bytes);
+
+    if ((pos = find(list, key, hash)) != TOP_EMPTY) {
+        list->heap[pos].bytes += bytes;
+        sift_down(list, pos);
+        return;
+    }
+
+    /* Until a key is turned away every key is tracked from its first packet, and exact */
+    if (!list->lossy && list->count < list->max) {
+        admit(list, key, hash, bytes, 0);
+    } else {
+        admit(list, key, hash, est, est - bytes);
+    }
+}
+
+void top_add(top_t *top, const packet_info_t *info) {
+
+    flow_key_t flow, key;
+    uint32_t len = info->pkt->len;
+
+    top->packets++;
+    top->bytes += len;
+
+    if (flow_key(&flow, info)) return;
+
+    memset(&key, 0, sizeof(flow_key_t));
+    key.version = flow.version;
+    memcpy(key.src_addr, flow.src_addr, 16);
+    list_add(&top->lists[TOP_TALKERS], &key, len);
+
+    if (info->tcp != NULL || info->udp != NULL) {
+        memset(&key, 0, sizeof(flow_key_t));
+        key.protocol = flow.protocol;
+        key.dst_port = flow.dst_port;
+        list_add(&top->lists[TOP_PORTS], &key, len);
+    }
+
+    flow_conversation(&flow);
+    list_add(&top->lists[TOP_CONVERSATIONS], &flow, len);
+}
+
+void top_packet(void *arg, int worker, outbuf_t *out, uint32_t pkt_num, const packet_t *pkt) {
+
+    packet_info_t info;
+
+    (void) out;
+    (void) pkt_num;
+
+    dissect_packet(pkt, &info);
+    top_add(&((top_t *) arg)[worker], &info);
+}
+
+/*
+ * A key missing from one side has anywhere from nothing up to that side's
+ * sketch estimate there, unless that side never turned a key away, in which
+ * case it's nothing.
+ */
+static void list_merge(top_list_t *dst, const top_list_t *src) {
+
+    top_entry_t *entry;
+    uint64_t extra;
+    uint32_t i, pos, count = dst->count;
+    int lossy = dst->lossy;
+
+    for (i = 0; i < count; i++) {
+
+        entry = &dst->heap[i];
+
+        if (src->lossy && find(src, &entry->key, entry->hash) == TOP_EMPTY) {
+            extra = sketch_estimate(src, entry->hash);
+            entry->bytes += extra;
+            entry->err += extra;
+        }
+    }
+
+    /* Only ever heavier, so moving down from the bottom up puts it back in order */
+    for (i = count / 2; i-- > 0;) sift_down(dst, i);
+
+    for (i = 0; i < src->count; i++) {
+
+        entry = &src->heap[i];
+
+        if ((pos = find(dst, &entry->key, entry->hash)) != TOP_EMPTY) {
+            dst->heap[pos].bytes += entry->bytes;
+            dst->heap[pos].err += entry->err;
+            sift_down(dst, pos);
+            continue;
+        }
+
+        extra = lossy ? sketch_estimate(dst, entry->hash) : 0;
+
+        admit(dst, &entry->key, entry->hash, entry->bytes + extra, entry->err + extra);
+    }
+
+    for (i = 0; i < TOP_DEPTH; i++) {
+        for (pos = 0; pos < TOP_WIDTH; pos++) dst->sketch[i][pos] += src->sketch[i][pos];
+    }
+
+    dst->lossy |= src->lossy;
+}
+
+void top_merge(top_t *dst, const top_t *src) {
+
+    int i;
+
+    dst->packets += src->packets;
+    dst->bytes += src->bytes;
+
+    for (i = 0; i < TOP_NUM; i++) list_merge(&dst->lists[i], &src->lists[i]);
+}
+
+/* Largest first, the guaranteed part breaks ties, then the key so the order is fixed */
+static int cmp_entries(const void *a, const void *b) {
+
+    const top_entry_t *ea = (const top_entry_t *) a, *eb = (const top_entry_t *) b;
+
+    if (ea->bytes != eb->bytes) return ea->bytes < eb->bytes ? 1 : -1;
+    if (ea->err != eb->err) return ea->err < eb->err ? -1 : 1;
+
+    return memcmp(&ea->key, &eb->key, sizeof(flow_key_t));
+}
+
+static void report_key(outbuf_t *out, int list, const flow_key_t *key) {
+
+    int has_ports = key->protocol == 0x6 || key->protocol == 0x11;
+
+    switch (list) {
+        case TOP_TALKERS:
+            flow_endpoint(out, key->version, key->src_addr, 0, 0);
+            break;
+        case TOP_PORTS:
+            ob_str(out, PROTO_BY_IP_PROTO(key->protocol)->name);
+            ob_char(out, ' ');
+            ob_dec(out, ntohs(key->dst_port));
+            break;
+        default:
+            ob_str(out, PROTO_BY_IP_PROTO(key->protocol)->name);
+            ob_char(out, ' ');
+            flow_endpoint(out, key->version, key->src_addr, key->src_port, has_ports);
+            OB_LIT(out, " <-> ");
+            flow_endpoint(out, key->version, key->dst_addr, key->dst_port, has_ports);
+            break;
+    }
+}
+
+void top_report(const top_t *top, outbuf_t *out) {
+
+    const top_list_t *list;
+    top_entry_t *sorted;
+    uint64_t est;
+    uint32_t i;
+    int l;
+
+    OB_LIT(out, "\tTop ");
+    ob_dec(out, top->n);
+    OB_LIT(out, "\n\t\tPackets: ");
+    ob_dec64(out, top->packets);
+    OB_LIT(out, "  Bytes: ");
+    ob_dec64(out, top->bytes);
+    OB_LIT(out, "\n\t\tSketch Error: ");
+    ob_dec64(out, SKETCH_ERROR(top->bytes));
+    OB_LIT(out, " (bytes, 98% of the time)\n\t\tBytes are upper bounds, at most Error over\n");
+
+    for (l = 0; l < TOP_NUM; l++) {
+
+        list = &top->lists[l];
+        sorted = malloc((list->count + 1) * sizeof(top_entry_t));
+
+        if (sorted == NULL) {
+            perror("malloc");
+            exit(1);
+        }
+
+        memcpy(sorted, list->heap, list->count * sizeof(top_entry_t));
+
+        /* Whichever bound is tighter, the sketch's or the tracked one. The lower bound stays put */
+        for (i = 0; i < list->count; i++) {
+
+            est = sketch_estimate(list, sorted[i].hash);
+
+            if (est < sorted[i].bytes) {
+                sorted[i].err -= sorted[i].bytes - est;
+                sorted[i].bytes = est;
+            }
+        }
+
+        qsort(sorted, list->count, sizeof(top_entry_t), cmp_entries);
+
+        OB_LIT(out, "\n\tTop ");
+        ob_str(out, list_names[l]);
+        ob_char(out, '\n');
+
+        for (i = 0; i < list->count && i < top->n; i++) {
+            OB_LIT(out, "\t\t");
+            report_key(out, l, &sorted[i].key);
+            OB_LIT(out, "  Bytes: ");
+            ob_dec64(out, sorted[i].bytes);
+            OB_LIT(out, "  Error: ");
+            ob_dec64(out, sorted[i].err);
+            ob_char(out, '\n');
+        }
+
+        free(sorted);
+    }
+}
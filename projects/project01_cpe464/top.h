@@ -0,0 +1,85 @@
+#ifndef PROJECT_1_TOP_H
+#define PROJECT_1_TOP_H
+
+#include <stdint.h>
+
+#include "libs/outbuf.h"
+#include "reader.h"
+#include "flows.h"
+
+/*
+ * --top N, the heaviest talkers, destination ports and conversations by bytes
+ * in fixed memory. Each list is a count-min sketch, which overestimates any
+ * key by at most e / TOP_WIDTH of all bytes with probability 1 - e^-TOP_DEPTH,
+ * plus a space-saving set of the heaviest keys seen so far. A key that isn't
+ * tracked takes the lightest one's place once the sketch puts it above it,
+ * starting from the sketch's estimate and counted exactly from then on.
+ */
+#define TOP_DEPTH 4
+#define TOP_WIDTH (1 << 15)
+
+/* Keys tracked per list, at least this many and 8 per key reported */
+#define TOP_MIN_SLOTS 1024
+
+#define TOP_TALKERS       0
+#define TOP_PORTS         1
+#define TOP_CONVERSATIONS 2
+#define TOP_NUM           3
+
+struct packet_info;
+
+/* Talkers only use the source address, ports only the protocol and destination port */
+typedef struct top_entry {
+    flow_key_t key;
+    uint32_t hash;
+
+    /* Where it is in the index */
+    uint32_t slot;
+
+    /* An upper bound on the key's bytes, at most err over */
+    uint64_t bytes;
+    uint64_t err;
+} top_entry_t;
+
+typedef struct top_list {
+    uint64_t sketch[TOP_DEPTH][TOP_WIDTH];
+
+    /* Min-heap on bytes, the lightest key is the one to go */
+    top_entry_t *heap;
+    uint32_t count;
+    uint32_t max;
+
+    /* Open addressing on the key hash, heap positions or TOP_EMPTY */
+    uint32_t *index;
+    uint32_t mask;
+
+    /* Set once a key goes untracked, after that a missing key may have bytes the sketch knows of */
+    int lossy;
+} top_list_t;
+
+#define TOP_EMPTY UINT32_MAX
+
+typedef struct top {
+    top_list_t lists[TOP_NUM];
+    uint32_t n;
+
+    uint64_t packets;
+    uint64_t bytes;
+} top_t;
+
+/* One per worker, each listing the top n */
+top_t *top_new(int num, uint32_t n);
+
+void top_free(top_t *top, int num);
+
+void top_add(top_t *top, const struct packet_info *info);
+
+/* packet_fn_t that adds to ((top_t *) arg)[worker] instead of printing */
+void top_packet(void *arg, int worker, outbuf_t *out, uint32_t pkt_num, const packet_t *pkt);
+
+/* Adds src's counts to dst, bounds still hold but can get looser */
+void top_merge(top_t *dst, const top_t *src);
+
+void top_report(const top_t *top, outbuf_t *out);
+
+#endif /* PROJECT_1_TOP_H */
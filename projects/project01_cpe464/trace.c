@@ -1,350 +1,931 @@
 
 #include "trace.h"
 
+static void usage(void) {
+    fprintf(stderr, "Usage: trace [-j threads] [--stats | --flows[=max] | --counters | --http | --top N | --timeline T | --format fmt] file.pcap [filter]\n"
+                    "       trace --live iface [--stats | --flows[=max] | --counters | --http | --top N | --timeline T | --format fmt] [filter]\n"
+                    "Formats: text (default), ndjson, csv\n"
+                    "Timeline buckets: seconds, or a number followed by s, ms, us or ns\n"
+                    "Reassembly (--http): --reasm-flow-cap bytes, --reasm-cap bytes, --reasm-policy flush|drop\n");
+    fprintf(stderr, "Writing: -w out.pcap [--split-time T | --split-size bytes[k|M|G] | --split-flow] [--dedupe[=frames]]\n"
+                    "         only writes unless a mode or --format is given, --packet, --range and --time extract\n");
+    fprintf(stderr, "Seeking: --packet N, --range A-B or --time T1..T2 (seconds), through file.pcap" INDEX_SUFFIX "\n"
+                    "         trace --index[=stride] file.pcap builds or extends it\n"
+                    "Filters: ip ip6 vlan arp tcp udp icmp, [tcp|udp] [src|dst] port N, [src|dst] host A,\n"
+                    "         fields such as ip.src == A or tcp.port != N, joined by and/or/not/()\n");
+}
+
+/* "A-B" with either end left out for the first or last packet, packets count from 1 */
+static int parse_range(const char *s, uint32_t *first, uint32_t *last) {
+
+    char *end;
+
+    *first = 1;
+    *last = UINT32_MAX;
+
+    if (*s != '-') {
+        *first = (uint32_t) strtoul(s, &end, 10);
+        s = end;
+    }
+
+    if (*s == '-' && *++s != '\0') {
+        *last = (uint32_t) strtoul(s, &end, 10);
+        s = end;
+    }
+
+    return *s != '\0' || *first < 1 || *last < *first ? -1 : 0;
+}
+
+/* Seconds since the epoch with an optional fraction, returns where it stopped or NULL */
+static const char *parse_time(const char *s, uint64_t *ts) {
+
+    uint64_t sec = 0, frac = 0, scale = 1000000000;
+
+    if (*s < '0' || *s > '9') return NULL;
+
+    while (*s >= '0' && *s <= '9') sec = sec * 10 + (*s++ - '0');
+
+    /* "1.." is a whole second followed by the range separator */
+    if (s[0] == '.' && s[1] >= '0' && s[1] <= '9') {
+        for (s++; *s >= '0' && *s <= '9'; s++) {
+            if (scale > 1) {
+                scale /= 10;
+                frac += (*s - '0') * scale;
+            }
+        }
+    }
+
+    *ts = sec * 1000000000 + frac;
+
+    return s;
+}
+
+/* "T1..T2" with either end left out for the start or end of the capture */
+static int parse_times(const char *s, uint64_t *from, uint64_t *to) {
+
+    *from = 0;
+    *to = UINT64_MAX;
+
+    if (strncmp(s, "..", 2) != 0 && (s = parse_time(s, from)) == NULL) return -1;
+
+    if (strncmp(s, "..", 2) != 0) return -1;
+
+    s += 2;
+
+    if (*s != '\0' && ((s = parse_time(s, to)) == NULL || *s != '\0')) return -1;
+
+    return *to < *from ? -1 : 0;
+}
+
+/* Bucket width such as 1s, 10ms, 100us or 0.5, seconds if there's no unit */
+static int parse_width(const char *s, uint64_t *width) {
+
+    if ((s = parse_time(s, width)) == NULL) return -1;
+
+    if (strcmp(s, "ms") == 0) {
+        *width /= 1000;
+    } else if (strcmp(s, "us") == 0) {
+        *width /= 1000000;
+    } else if (strcmp(s, "ns") == 0) {
+        *width /= 1000000000;
+    } else if (*s != '\0' && strcmp(s, "s") != 0) {
+        return -1;
+    }
+
+    return *width == 0 ? -1 : 0;
+}
+
+/* Bytes, or with k, M or G after them for KiB, MiB or GiB */
+static int parse_size(const char *s, uint64_t *size) {
+
+    char *end;
+
+    *size = (uint64_t) strtoul(s, &end, 10);
+
+    if (end == s) return -1;
+
+    switch (*end) {
+        case 'k':
+            *size <<= 10;
+            end++;
+            break;
+        case 'M':
+            *size <<= 20;
+            end++;
+            break;
+        case 'G':
+            *size <<= 30;
+            end++;
+            break;
+    }
+
+    /* Room for at least the file header and a record header */
+    return *end != '\0' || *size < PCAP_HEADER_LEN + PACKET_HEADER_LEN ? -1 : 0;
+}
+
+/* Ctrl-C ends a live capture cleanly so the summary modes still report */
+static void handle_signal(int sig) {
+    (void) sig;
+    live_stop();
+}
+
 int main(int argc, char *argv[]) {
 
-    uint32_t pkt_num = 1;
-    uint8_t *packet_data = NULL;
+    int ret, opt, i, num_threads = 1, mode = MODE_PRINT, format = FORMAT_TEXT;
+    uint32_t pkt_num = 1, max_flows = FLOWS_DEFAULT_MAX, top_n = 0;
+    size_t reasm_flow_cap = REASM_DEFAULT_FLOW_CAP, reasm_cap = REASM_DEFAULT_CAP;
+    int reasm_policy = REASM_FLUSH;
+
+    /* --packet, --range and --time, packets outside them are skipped over */
+    int build_index = 0, selection = 0;
+    uint32_t index_stride = 0, first_pkt = 1, last_pkt = UINT32_MAX;
+    uint64_t ts, time_from = 0, time_to = UINT64_MAX, timeline_width = 0;
+    index_t index;
+    const char *live_iface = NULL;
+
+    /* -w, --split-* and --dedupe */
+    const char *write_path = NULL;
+    int split = SPLIT_NONE, serial;
+    uint64_t split_arg = 0;
+    uint32_t dedupe = 0;
+    writer_t writer;
+
+    char *expr = NULL, errbuf[PCAP_ERRBUF_SIZE];
+    size_t expr_len = 0;
+
+    reader_t reader;
+    packet_t packet;
+    outbuf_t out;
+
+    /* Per-packet work, printing unless another mode is picked */
+    packet_fn_t handle_packet = print_packet;
+    void *arg = NULL;
+    stats_t *stats = NULL;
+    top_t *top = NULL;
+    flow_table_t *flows = NULL, merged;
+    counters_t counters;
+    timeline_t timeline;
+    stream_table_t streams;
+    filter_t filter;
+    filter_run_t filter_run;
+
+    static const struct option long_options[] = {
+            {"jobs",     required_argument, NULL, 'j'},
+            {"stats",    no_argument,       NULL, 's'},
+            {"flows",    optional_argument, NULL, 'f'},
+            {"counters", no_argument,       NULL, 'c'},
+            {"live",     required_argument, NULL, 'l'},
+            {"format",   required_argument, NULL, 'o'},
+            {"http",     no_argument,       NULL, 'h'},
+            {"top",      required_argument, NULL, 'k'},
+            {"timeline", required_argument, NULL, 'b'},
+            {"reasm-flow-cap", required_argument, NULL, 'F'},
+            {"reasm-cap",      required_argument, NULL, 'C'},
+            {"reasm-policy",   required_argument, NULL, 'P'},
+            {"index",    optional_argument, NULL, 'x'},
+            {"packet",   required_argument, NULL, 'n'},
+            {"range",    required_argument, NULL, 'r'},
+            {"time",     required_argument, NULL, 't'},
+            {"write",    required_argument, NULL, 'w'},
+            {"split-time", required_argument, NULL, 'T'},
+            {"split-size", required_argument, NULL, 'Z'},
+            {"split-flow", no_argument,       NULL, 'L'},
+            {"dedupe",   optional_argument, NULL, 'D'},
+            {NULL, 0, NULL, 0}
+    };
+
+    while ((opt = getopt_long(argc, argv, "j:w:", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'j':
+                num_threads = atoi(optarg);
+
+                if (num_threads < 1) {
+                    fprintf(stderr, "ERR: -j needs at least one thread\n");
+                    return 1;
+                }
+                break;
+            case 'l':
+                live_iface = optarg;
+                break;
+            case 'o':
+                if (strcmp(optarg, "text") == 0) {
+                    format = FORMAT_TEXT;
+                } else if (strcmp(optarg, "ndjson") == 0) {
+                    format = FORMAT_NDJSON;
+                } else if (strcmp(optarg, "csv") == 0) {
+                    format = FORMAT_CSV;
+                } else {
+                    fprintf(stderr, "ERR: Unknown format '%s'\n", optarg);
+                    usage();
+                    return 1;
+                }
+                break;
+            case 'F':
+            case 'C':
+                if (atol(optarg) < 1) {
+                    fprintf(stderr, "ERR: --%s needs at least one byte\n", opt == 'F' ? "reasm-flow-cap" : "reasm-cap");
+                    return 1;
+                }
+
+                if (opt == 'F') reasm_flow_cap = (size_t) atol(optarg);
+                else reasm_cap = (size_t) atol(optarg);
+                break;
+            case 'P':
+                if (strcmp(optarg, "flush") == 0) {
+                    reasm_policy = REASM_FLUSH;
+                } else if (strcmp(optarg, "drop") == 0) {
+                    reasm_policy = REASM_DROP;
+                } else {
+                    fprintf(stderr, "ERR: Unknown reassembly policy '%s'\n", optarg);
+                    usage();
+                    return 1;
+                }
+                break;
+            case 'x':
+                build_index = 1;
+
+                if (optarg != NULL && (index_stride = (uint32_t) atol(optarg)) < 1) {
+                    fprintf(stderr, "ERR: --index needs a stride of at least one\n");
+                    return 1;
+                }
+                break;
+            case 'n':
+            case 'r':
+            case 't':
+                if (selection) {
+                    fprintf(stderr, "ERR: Only one of --packet, --range and --time can be given\n");
+                    return 1;
+                }
+
+                selection = opt;
+
+                if (opt == 'n' && (first_pkt = last_pkt = (uint32_t) atol(optarg)) < 1) {
+                    fprintf(stderr, "ERR: Packets count from 1\n");
+                    return 1;
+                }
+
+                if (opt == 'r' && parse_range(optarg, &first_pkt, &last_pkt)) {
+                    fprintf(stderr, "ERR: Bad packet range '%s'\n", optarg);
+                    return 1;
+                }
+
+                if (opt == 't' && parse_times(optarg, &time_from, &time_to)) {
+                    fprintf(stderr, "ERR: Bad time range '%s'\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'w':
+                write_path = optarg;
+                break;
+            case 'T':
+            case 'Z':
+            case 'L':
+                if (split != SPLIT_NONE) {
+                    fprintf(stderr, "ERR: Only one of --split-time, --split-size and --split-flow can be given\n");
+                    return 1;
+                }
+
+                split = opt == 'T' ? SPLIT_TIME : opt == 'Z' ? SPLIT_SIZE : SPLIT_FLOW;
+
+                if (opt == 'T' && parse_width(optarg, &split_arg)) {
+                    fprintf(stderr, "ERR: Bad split interval '%s'\n", optarg);
+                    return 1;
+                }
+
+                if (opt == 'Z' && parse_size(optarg, &split_arg)) {
+                    fprintf(stderr, "ERR: Bad split size '%s'\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'D':
+                dedupe = DEDUPE_DEFAULT_WINDOW;
+
+                if (optarg != NULL && (dedupe = (uint32_t) atol(optarg)) < 1) {
+                    fprintf(stderr, "ERR: --dedupe needs a window of at least one frame\n");
+                    return 1;
+                }
+                break;
+            case 's':
+            case 'f':
+            case 'c':
+            case 'h':
+            case 'k':
+            case 'b':
+                if (mode != MODE_PRINT) {
+                    fprintf(stderr, "ERR: Only one of --stats, --flows, --counters, --http, --top and --timeline can be given\n");
+                    return 1;
+                }
+
+                mode = opt == 's' ? MODE_STATS : opt == 'f' ? MODE_FLOWS : opt == 'c' ? MODE_COUNTERS :
+                       opt == 'h' ? MODE_HTTP : opt == 'k' ? MODE_TOP : MODE_TIMELINE;
+
+                if (opt == 'k' && (top_n = (uint32_t) atol(optarg)) < 1) {
+                    fprintf(stderr, "ERR: --top needs to list at least one\n");
+                    return 1;
+                }
+
+                if (opt == 'b' && parse_width(optarg, &timeline_width)) {
+                    fprintf(stderr, "ERR: Bad timeline bucket '%s'\n", optarg);
+                    return 1;
+                }
+
+                if (opt == 'f' && optarg != NULL && (max_flows = (uint32_t) atol(optarg)) < 1) {
+                    fprintf(stderr, "ERR: --flows needs room for at least one flow\n");
+                    return 1;
+                }
+                break;
+            default:
+                usage();
+                return 1;
+        }
+    }
+
+    if (format != FORMAT_TEXT && mode != MODE_PRINT) {
+        fprintf(stderr, "ERR: --format only applies to per-packet output\n");
+        return 1;
+    }
 
-    char errBuf[PCAP_ERRBUF_SIZE];
+    if (split != SPLIT_NONE && write_path == NULL) {
+        fprintf(stderr, "ERR: Splitting needs -w to name the files\n");
+        return 1;
+    }
 
-    pcap_t *fp;
-    struct pcap_pkthdr *pcap_header = malloc(PCAP_HEADER_LEN);
+    if ((build_index || selection) && live_iface != NULL) {
+        fprintf(stderr, "ERR: Live captures can't be indexed\n");
+        return 1;
+    }
 
     /* Check for single input */
-    if (argc != 2) {
+    if (live_iface == NULL && optind == argc) {
         fprintf(stderr, "ERR: Please provide an input *.pcap file!\n");
+        usage();
         return 1;
     }
 
-    /* Open the pcap file */
-    fp = pcap_open_offline(argv[1], errBuf);
+    /* Anything after the input is the filter, so it can be given unquoted */
+    for (i = optind + (live_iface == NULL); i < argc; i++) {
+        expr_len += strlen(argv[i]) + 1;
+    }
+
+    if (expr_len > 0) {
+
+        expr = malloc(expr_len);
+
+        if (expr == NULL) {
+            perror("malloc");
+            return 1;
+        }
+
+        expr[0] = '\0';
+
+        for (i = optind + (live_iface == NULL); i < argc; i++) {
+            if (expr[0] != '\0') strcat(expr, " ");
+            strcat(expr, argv[i]);
+        }
+
+        if (filter_compile(&filter, expr, errbuf, sizeof(errbuf))) {
+            fprintf(stderr, "ERR: Bad filter: %s\n", errbuf);
+            free(expr);
+            return 1;
+        }
+
+        free(expr);
+    }
+
+    if (live_iface != NULL) {
+
+        if (live_open(&reader, live_iface)) {
+            fprintf(stderr, "\nlive capture on %s failed: %s\n", live_iface, reader.errbuf);
+            return 1;
+        }
+
+        signal(SIGINT, handle_signal);
+        signal(SIGTERM, handle_signal);
 
-    /* Verify file pointer */
-    if (fp == NULL) {
-        fprintf(stderr, "\npcap_open_offline() failed: %s\n", errBuf);
+    } else if (reader_open(&reader, argv[optind])) {
+
+        /* Open the pcap file, mapped directly where possible */
+        fprintf(stderr, "\npcap_open_offline() failed: %s\n", reader.errbuf);
         return 1;
     }
 
-    /* Iterate through each packet */
-    while (pcap_next_ex(fp, &pcap_header, (const u_char **) &packet_data) >= 0) {
+    /* Lookup tables for the dissectors, before any packet is read */
+    proto_init();
+
+    /* All output goes through one buffer, written to stdout as it fills */
+    ob_init(&out, STDOUT_FILENO, OB_DEFAULT_CAP);
 
-        /* Display packet info */
-        printf("\nPacket number: %d  Frame Len: %d\n\n", pkt_num++, pcap_header->len);
+    /* Brought up to date first, so only records appended since the last run get read */
+    if (build_index || selection) {
 
-        /* Begin parsing eth packet */
-        process_eth_h(packet_data);
+        if (index_update(&index, argv[optind], index_stride, errbuf, sizeof(errbuf))) {
+            fprintf(stderr, "ERR: Can't index %s: %s\n", argv[optind], errbuf);
+            return 1;
+        }
 
+        if (selection == 't') {
+            pkt_num = (uint32_t) index_seek_time(&index, &reader, time_from) + 1;
+        } else if (selection && index_seek_packet(&index, &reader, first_pkt - 1) == 0) {
+            pkt_num = first_pkt;
+        } else if (selection) {
+            /* Starts past the end of the capture */
+            last_pkt = 0;
+        }
     }
 
-    /* Clean up */
-    pcap_close(fp);
+    if (build_index && !selection && expr_len == 0 && mode == MODE_PRINT && write_path == NULL && !dedupe) {
 
-    return 0;
-}
+        OB_LIT(&out, "\tIndex\n\t\tPackets: ");
+        ob_dec64(&out, index.header.packets);
+        OB_LIT(&out, "\n\t\tEntries: ");
+        ob_dec64(&out, index.num_entries);
+        OB_LIT(&out, " (stride ");
+        ob_dec(&out, index.header.stride);
+        OB_LIT(&out, ")\n\t\tNew Entries: ");
+        ob_dec64(&out, index.added);
+        ob_char(&out, '\n');
 
-char *iptostr(uint32_t ip_addr) {
+        index_free(&index);
+        ob_free(&out);
+        reader_close(&reader);
 
-    char *str_addr = malloc(16);
+        return 0;
+    }
 
-    inet_ntop(AF_INET, &(ip_addr), str_addr, INET_ADDRSTRLEN);
+    /* Machine-readable records instead of the text dump */
+    if (format == FORMAT_NDJSON) {
+        handle_packet = export_ndjson;
+    }
 
-    return str_addr;
-}
+    if (format == FORMAT_CSV) {
+        export_csv_header(&out);
+        handle_packet = export_csv;
+    }
 
-char *get_type(uint8_t protocol, uint16_t type) {
-
-    char *buffer;
-
-    switch (protocol) {
-        case ETH_HEADER:
-        case IPV4_HEADER:
-            switch (type) {
-                case 0x0008:
-                    return "IP";
-                case 0x0608:
-                    return "ARP";
-                case 0x0006:
-                    return "TCP";
-                case 0x0011:
-                    return "UDP";
-                case 0x0001:
-                    return "ICMP";
-                default:
-                    return strdup("Unknown");
-            }
+    /* Anything that needs the packets in capture order stays on one thread, as does a stream or one core */
+    serial = mode == MODE_COUNTERS || mode == MODE_HTTP || mode == MODE_TIMELINE || selection ||
+             write_path != NULL || dedupe || num_threads == 1 || reader.kind != READER_MMAP || reader.zs != NULL;
 
-        case ARP_HEADER:
-            switch (type) {
-                case 0x0100:
-                    return "Request";
-                case 0x0200:
-                    return "Reply";
-                default:
-                    return strdup("Unknown");
-            }
+    /* Per-worker state is only made for the workers that will run */
+    if (serial) num_threads = 1;
+
+    /* One set of counters per worker, merged at the end */
+    if (mode == MODE_STATS) {
+        stats = stats_new(num_threads);
+        handle_packet = stats_packet;
+        arg = stats;
+    }
+
+    /* The flow limit is shared out between the workers, with the remainder on the first */
+    if (mode == MODE_FLOWS) {
+
+        flows = malloc(num_threads * sizeof(flow_table_t));
+
+        if (flows == NULL) {
+            perror("malloc");
+            return 1;
+        }
+
+        flows_init(&flows[0], max_flows / num_threads + max_flows % num_threads);
+
+        for (i = 1; i < num_threads; i++) {
+            flows_init(&flows[i], max_flows / num_threads);
+        }
+
+        handle_packet = flows_packet;
+        arg = flows;
+    }
+
+    if (mode == MODE_COUNTERS) {
+        memset(&counters, 0, sizeof(counters_t));
+        counters.reader = &reader;
+        handle_packet = counters_packet;
+        arg = &counters;
+    }
 
-        case TCP_HEADER:
-            switch (type) {
-                case 0x5000:
-                    return " HTTP";
-                case 0x1700:
-                    return " Telnet";
-                case 0x1400:
-                    return " FTP Data";
-                case 0x1500:
-                    return " FTP";
-                case 0x6E00:
-                    return " POP3";
-                case 0x1900:
-                    return " SMTP";
-                default:
-                    buffer = malloc(10);
-                    snprintf(buffer, 8, ": %d", ntohs(type));
-                    return buffer;
+    /* Streams have to see their segments in capture order */
+    if (mode == MODE_HTTP) {
+        streams_init(&streams, reasm_flow_cap, reasm_cap, reasm_policy);
+        handle_packet = streams_packet;
+        arg = &streams;
+    }
+
+    /* Buckets are written out as the capture goes by, so packets have to come in order */
+    if (mode == MODE_TIMELINE) {
+        timeline_init(&timeline, timeline_width);
+        handle_packet = timeline_packet;
+        arg = &timeline;
+    }
+
+    /* Fixed-size sketches per worker, merged at the end */
+    if (mode == MODE_TOP) {
+        top = top_new(num_threads, top_n);
+        handle_packet = top_packet;
+        arg = top;
+    }
+
+    /* Repeats are dropped and the rest written out before the mode sees them, which only -w on its own skips */
+    if (write_path != NULL || dedupe) {
+
+        if (writer_open(&writer, &reader, write_path, split, split_arg, dedupe,
+                        write_path != NULL && mode == MODE_PRINT && format == FORMAT_TEXT ? NULL : handle_packet,
+                        arg, errbuf, sizeof(errbuf))) {
+            fprintf(stderr, "ERR: Can't write %s: %s\n", write_path, errbuf);
+            return 1;
+        }
+
+        handle_packet = writer_packet;
+        arg = &writer;
+    }
+
+    /* Rejected packets never reach the mode's handler */
+    if (expr_len > 0) {
+        filter_run.filter = &filter;
+        filter_run.fn = handle_packet;
+        filter_run.arg = arg;
+        handle_packet = filter_packet;
+        arg = &filter_run;
+    }
+
+    PROF_INIT();
+
+    if (!serial) {
+
+        /* Chunks are dissected in parallel and written out in order */
+        ret = run_parallel(&reader, num_threads, handle_packet, arg, &out);
+
+    } else {
+
+        /* Iterate through each packet */
+        for (;;) {
+
+            PROF_BEGIN(PROF_READ);
+            ret = reader_next(&reader, &packet);
+            PROF_END();
+
+            if (ret <= 0 || pkt_num > last_pkt) break;
+
+            /* In a capture that's in time order, the first record past the end finishes */
+            if (selection == 't') {
+
+                ts = (uint64_t) packet.ts_sec * 1000000000 + packet.ts_nsec;
+
+                if (ts > time_to && !(index.header.flags & INDEX_UNORDERED)) break;
+
+                if (ts < time_from || ts > time_to) {
+                    pkt_num++;
+                    continue;
+                }
             }
 
-        case ICMP_HEADER:
-            switch (type) {
-                case 0x0000:
-                    return "Reply";
-                case 0x0008:
-                    return "Request";
-                default:
-                    buffer = malloc(10);
-                    snprintf(buffer, 8, "%d", type);
-                    return buffer;
+#ifdef TRACE_PROFILE
+            /* Written out ahead of time, so the handler isn't charged for the write */
+            if (out.len > out.cap / 2) {
+                PROF_BEGIN(PROF_WRITE);
+                ob_flush(&out);
+                PROF_END();
             }
+#endif
+
+            PROF_BEGIN(PROF_HANDLE);
+            handle_packet(arg, 0, &out, pkt_num++, &packet);
+            PROF_END();
 
-        default:
-            fprintf(stderr, "function 'get_type()' received an unknown protocol: %d", protocol);
-            exit(1);
+            /* Live output goes out a ring block at a time instead of waiting for a full buffer */
+            if (reader_idle(&reader)) ob_flush(&out);
+        }
     }
-}
 
-void process_eth_h(uint8_t *packet_data) {
+    if (write_path != NULL || dedupe) {
+        writer_close(&writer);
 
-    uint16_t type;
+        if (writer.fn == NULL) writer_report(&writer, &out);
+    }
 
-    /* Copy header data into a struct */
-    eth_header_t *eth_header = malloc(ETH_HEADER_LEN);
-    memcpy(eth_header, packet_data, ETH_HEADER_LEN);
+    if (mode == MODE_COUNTERS) {
+        counters_report(&counters, &out);
+    }
 
-    type = eth_header->type;
+    if (mode == MODE_TIMELINE) {
+        timeline_report(&timeline, &out);
+    }
 
-    /* Advance the packet data pointer to the next header */
-    packet_data = &packet_data[ETH_HEADER_LEN];
+    if (mode == MODE_HTTP) {
+        streams_free(&streams, &out);
+        streams_report(&streams, &out);
+    }
 
-    /* Parse header */
-    printf(
-            "\tEthernet Header\n"
-            "\t\tDest MAC: %s\n"
-            "\t\tSource MAC: %s\n"
-            "\t\tType: %s\n\n",
-            strdup(ether_ntoa((const struct ether_addr *) eth_header->dst_addr)),
-            strdup(ether_ntoa((const struct ether_addr *) eth_header->src_addr)),
-            get_type(ETH_HEADER, type)
-    );
+    if (stats != NULL) {
 
-    /* Continue to the next header */
-    switch (type) {
-        case 0x0608:
-            process_arp_h(packet_data);
-            break;
-        case 0x0008:
-            process_ip_h(packet_data);
-            break;
-        default:
-            break;
+        for (i = 1; i < num_threads; i++) {
+            stats_merge(&stats[0], &stats[i]);
+        }
+
+        stats_report(&stats[0], &out);
+        free(stats);
     }
 
-}
+    if (top != NULL) {
 
-void process_arp_h(uint8_t *packet_data) {
+        for (i = 1; i < num_threads; i++) {
+            top_merge(&top[0], &top[i]);
+        }
 
-    arp_header_t *arp_header = malloc(ARP_HEADER_LEN);
+        top_report(&top[0], &out);
+        top_free(top, num_threads);
+    }
 
-    /* Fill header */
-    memcpy(arp_header, packet_data, ARP_HEADER_LEN);
+    if (flows != NULL) {
 
-    /* Parse info */
-    printf(
-            "\tARP header\n"
-            "\t\tOpcode: %s\n"
-            "\t\tSender MAC: %s\n"
-            "\t\tSender IP: %s\n"
-            "\t\tTarget MAC: %s\n"
-            "\t\tTarget IP: %s\n\n",
-            get_type(ARP_HEADER, arp_header->OPER),
-            /* ether_ntoa() uses a buffer as its output, so the value is copied before using it again */
-            strdup(ether_ntoa((const struct ether_addr *) arp_header->SHA)),
-            iptostr(arp_header->SPA),
-            strdup(ether_ntoa((const struct ether_addr *) arp_header->THA)),
-            iptostr(arp_header->TPA)
-    );
+        /* Each worker only kept its share, the merged table gets the whole limit back */
+        if (!serial) {
+            flows_init(&merged, max_flows);
+            flows_merge(&merged, &flows[0]);
+            flows_free(&flows[0]);
+            flows[0] = merged;
+        }
+
+        for (i = 1; i < num_threads; i++) {
+            flows_merge(&flows[0], &flows[i]);
+            flows_free(&flows[i]);
+        }
+
+        flows_report(&flows[0], &out);
+        flows_free(&flows[0]);
+        free(flows);
+    }
+
+    /* Clean up */
+    if (expr_len > 0) filter_free(&filter);
+    if (build_index || selection) index_free(&index);
+
+    PROF_BEGIN(PROF_WRITE);
+    ob_flush(&out);
+    PROF_END();
+    PROF_REPORT();
+
+    ob_free(&out);
+    reader_close(&reader);
+
+    if (ret < 0) {
+        fprintf(stderr, "%s: %s\n", live_iface != NULL ? live_iface : argv[optind], reader.errbuf);
+        return 1;
+    }
+
+    return 0;
 }
 
-void process_ip_h(uint8_t *packet_data) {
+void print_packet(void *arg, int worker, outbuf_t *out, uint32_t pkt_num, const packet_t *pkt) {
 
-    uint16_t header_len, ip_len;
-    uint8_t protocol;
+    packet_info_t info;
 
-    char verify[10] = "Correct";
+    (void) arg;
+    (void) worker;
 
-    ip_v4_header_t *ip_header = malloc(IPV4_HEADER_LEN);
-    pseudo_header_t *pseudo_header = malloc(PSEUDO_HEADER_LEN);
+    /* Display packet info */
+    OB_LIT(out, "\nPacket number: ");
+    ob_dec(out, pkt_num);
+    OB_LIT(out, "  Frame Len: ");
+    ob_dec(out, pkt->len);
+    OB_LIT(out, "\n\n");
 
-    /* Move packet data into a struct */
-    memcpy(ip_header, packet_data, IPV4_HEADER_LEN);
+    /* Begin parsing eth packet */
+    dissect_packet(pkt, &info);
 
-    header_len = (ip_header->Ver_IHL & 0xf) * 4;
-    protocol = ip_header->protocol;
-    ip_len = ntohs(ip_header->len);
+    if (info.eth != NULL) {
+        process_eth_h(out, &info);
+    }
+}
 
-    /* Verify checksum */
-    if (in_cksum((unsigned short *) packet_data, header_len)) {
-        snprintf(verify, 10, "Incorrect");
+/* Well-known ports by name, anything else as a number */
+static void print_port(outbuf_t *out, uint16_t port) {
+
+    const char *name = tcp_port_name(ntohs(port));
+
+    if (name != NULL) {
+        ob_char(out, ' ');
+        ob_str(out, name);
+    } else {
+        OB_LIT(out, ": ");
+        ob_dec(out, ntohs(port));
     }
+}
 
-    /* Advance the packet data pointer to the next header */
-    packet_data = &packet_data[header_len];
+void process_eth_h(outbuf_t *out, const packet_info_t *info) {
 
-    /* Unpack data */
-    printf(
-            "\tIP Header\n"
-            "\t\tHeader Len: %d (bytes)\n"
-            "\t\tTOS: 0x%x\n"
-            "\t\tTTL: %d\n"
-            "\t\tIP PDU Len: %d (bytes)\n"
-            "\t\tProtocol: %s\n"
-            "\t\tChecksum: %s (0x%x)\n"
-            "\t\tSender IP: %s\n"
-            "\t\tDest IP: %s\n",
-            header_len,
-            ip_header->TOS,
-            ip_header->TTL,
-            ip_len,
-            get_type(IPV4_HEADER, protocol),
-            verify, ip_header->cksum,
-            iptostr(ip_header->src_addr),
-            iptostr(ip_header->dst_addr)
-    );
+    const eth_header_t *eth_header = info->eth;
+    const vlan_header_t *vlan_header;
+    int i;
 
-    /* Go to the next header unpacker */
-    switch (protocol) {
-        case 0x1:
-            process_icmp_h(packet_data);
-            break;
-        case 0x6:
+    PROF_BEGIN(PROF_ETH);
 
-            /* Fill pseudo-header for TCP checksum */
-            pseudo_header->src_addr = ip_header->src_addr;
-            pseudo_header->dst_addr = ip_header->dst_addr;
-            pseudo_header->type = 0x0600;
-            pseudo_header->tcp_len = htons(ip_len - header_len);
+    /* Parse header */
+    OB_LIT(out, "\tEthernet Header\n\t\tDest MAC: ");
+    ob_mac(out, eth_header->dst_addr);
+    OB_LIT(out, "\n\t\tSource MAC: ");
+    ob_mac(out, eth_header->src_addr);
+    OB_LIT(out, "\n\t\tType: ");
+    ob_str(out, PROTO_BY_ETHERTYPE(ntohs(eth_header->type))->name);
+    OB_LIT(out, "\n\n");
+
+    /* Outer tag first */
+    for (i = 0; i < info->num_vlans; i++) {
+
+        vlan_header = info->vlan[i];
+
+        OB_LIT(out, "\tVLAN Tag\n\t\tID: ");
+        ob_dec(out, ntohs(vlan_header->TCI) & 0xfff);
+        OB_LIT(out, "\n\t\tPriority: ");
+        ob_dec(out, ntohs(vlan_header->TCI) >> 13);
+        OB_LIT(out, "\n\t\tType: ");
+        ob_str(out, PROTO_BY_ETHERTYPE(ntohs(vlan_header->type))->name);
+        OB_LIT(out, "\n\n");
+    }
 
-            process_tcp_h(packet_data, pseudo_header);
-            break;
-        case 0x11:
-            process_udp_h(packet_data);
-            break;
-        default:
-            break;
+    /* Continue to the next header */
+    if (info->net_proto != PROTO_UNKNOWN) {
+        protos[info->net_proto].print(out, info);
     }
+
+    PROF_END();
+}
+
+void process_arp_h(outbuf_t *out, const packet_info_t *info) {
+
+    const arp_header_t *arp_header = info->arp;
+    const char *op = arp_op_name(ntohs(arp_header->OPER));
+
+    PROF_BEGIN(PROF_ARP);
+
+    /* Parse info */
+    OB_LIT(out, "\tARP header\n\t\tOpcode: ");
+    ob_str(out, op != NULL ? op : "Unknown");
+    OB_LIT(out, "\n\t\tSender MAC: ");
+    ob_mac(out, arp_header->SHA);
+    OB_LIT(out, "\n\t\tSender IP: ");
+    ob_ipv4(out, arp_header->SPA);
+    OB_LIT(out, "\n\t\tTarget MAC: ");
+    ob_mac(out, arp_header->THA);
+    OB_LIT(out, "\n\t\tTarget IP: ");
+    ob_ipv4(out, arp_header->TPA);
+    OB_LIT(out, "\n\n");
+
+    PROF_END();
 }
 
-void process_tcp_h(uint8_t *packet_data, pseudo_header_t *pseudo_header) {
+void process_ip_h(outbuf_t *out, const packet_info_t *info) {
 
-    uint8_t ack_flag;
-    uint16_t flags, tcp_pkt_len = ntohs(pseudo_header->tcp_len);
+    const ip_v4_header_t *ip_header = info->ip;
 
-    unsigned short *checksum_packet;
+    PROF_BEGIN(PROF_IP);
 
-    char ack[21] = "<not valid>";
-    char verify[21] = "Correct";
+    /* Unpack data */
+    OB_LIT(out, "\tIP Header\n\t\tHeader Len: ");
+    ob_dec(out, info->ip_header_len);
+    OB_LIT(out, " (bytes)\n\t\tTOS: 0x");
+    ob_hex(out, ip_header->TOS);
+    OB_LIT(out, "\n\t\tTTL: ");
+    ob_dec(out, ip_header->TTL);
+    OB_LIT(out, "\n\t\tIP PDU Len: ");
+    ob_dec(out, info->ip_len);
+    OB_LIT(out, " (bytes)\n\t\tProtocol: ");
+    ob_str(out, PROTO_BY_IP_PROTO(ip_header->protocol)->name);
+
+    if (info->ip_cksum_ok) {
+        OB_LIT(out, "\n\t\tChecksum: Correct (0x");
+    } else {
+        OB_LIT(out, "\n\t\tChecksum: Incorrect (0x");
+    }
 
-    tcp_header_t *tcp_header = malloc(TCP_HEADER_LEN);
+    ob_hex(out, ip_header->cksum);
+    OB_LIT(out, ")\n\t\tSender IP: ");
+    ob_ipv4(out, ip_header->src_addr);
+    OB_LIT(out, "\n\t\tDest IP: ");
+    ob_ipv4(out, ip_header->dst_addr);
+    OB_LIT(out, "\n");
 
-    /* Move data into a struct */
-    memcpy(tcp_header, packet_data, TCP_HEADER_LEN);
+    /* Go to the next header unpacker */
+    if (info->transport_proto != PROTO_UNKNOWN) {
+        protos[info->transport_proto].print(out, info);
+    }
 
-    /* Pack together the pseudo-header with the TCP header for the checksum */
-    checksum_packet = malloc(PSEUDO_HEADER_LEN + tcp_pkt_len);
-    memcpy(checksum_packet, pseudo_header, PSEUDO_HEADER_LEN);
-    memcpy(&checksum_packet[6], packet_data, tcp_pkt_len);
+    PROF_END();
+}
 
-    /* Run checksum */
-    if (in_cksum(checksum_packet, PSEUDO_HEADER_LEN + tcp_pkt_len)) {
-        snprintf(verify, 20, "Incorrect");
+void process_ip6_h(outbuf_t *out, const packet_info_t *info) {
+
+    const ip_v6_header_t *ip6_header = info->ip6;
+    uint32_t ver_tc_flow = ntohl(ip6_header->Ver_TC_Flow);
+
+    PROF_BEGIN(PROF_IP6);
+
+    OB_LIT(out, "\tIPv6 Header\n\t\tHeader Len: ");
+    ob_dec(out, info->ip_header_len);
+    OB_LIT(out, " (bytes)\n\t\tTraffic Class: 0x");
+    ob_hex(out, (ver_tc_flow >> 20) & 0xff);
+    OB_LIT(out, "\n\t\tFlow Label: 0x");
+    ob_hex(out, ver_tc_flow & 0xfffff);
+    OB_LIT(out, "\n\t\tHop Limit: ");
+    ob_dec(out, ip6_header->hop_limit);
+    OB_LIT(out, "\n\t\tPayload Len: ");
+    ob_dec(out, ntohs(ip6_header->payload_len));
+    OB_LIT(out, " (bytes)\n\t\tNext Header: ");
+    ob_str(out, PROTO_BY_IP_PROTO(info->ip_proto)->name);
+    OB_LIT(out, "\n\t\tSender IP: ");
+    ob_ipv6(out, ip6_header->src_addr);
+    OB_LIT(out, "\n\t\tDest IP: ");
+    ob_ipv6(out, ip6_header->dst_addr);
+    OB_LIT(out, "\n");
+
+    if (info->transport_proto != PROTO_UNKNOWN) {
+        protos[info->transport_proto].print(out, info);
     }
 
-    flags = ntohs(tcp_header->flags);
-    ack_flag = flags & (0x10);
+    PROF_END();
+}
+
+void process_tcp_h(outbuf_t *out, const packet_info_t *info) {
+
+    const tcp_header_t *tcp_header = info->tcp;
+    uint16_t flags = ntohs(tcp_header->flags);
+
+    PROF_BEGIN(PROF_TCP);
+
+    /* Data time */
+    OB_LIT(out, "\n\tTCP Header\n\t\tSource Port: ");
+    print_port(out, tcp_header->src_port);
+    OB_LIT(out, "\n\t\tDest Port: ");
+    print_port(out, tcp_header->dst_port);
+    OB_LIT(out, "\n\t\tSequence Number: ");
+    ob_dec(out, ntohl(tcp_header->seq));
 
     /* Check ACK status */
-    if (ack_flag) {
-        snprintf(ack, 20, "%u", htonl(tcp_header->ack));
+    OB_LIT(out, "\n\t\tACK Number: ");
+    if (flags & (0x10)) {
+        ob_dec(out, ntohl(tcp_header->ack));
+        OB_LIT(out, "\n\t\tACK Flag: Yes");
+    } else {
+        OB_LIT(out, "<not valid>\n\t\tACK Flag: No");
     }
 
-    /* Data time */
-    printf(
-            "\n"
-            "\tTCP Header\n"
-            "\t\tSource Port: %s\n"
-            "\t\tDest Port: %s\n"
-            "\t\tSequence Number: %u\n"
-            "\t\tACK Number: %s\n"
-            "\t\tACK Flag: %s\n"
-            "\t\tSYN Flag: %s\n"
-            "\t\tRST Flag: %s\n"
-            "\t\tFIN Flag: %s\n"
-            "\t\tWindow Size: %u\n"
-            "\t\tChecksum: %s (0x%x)\n",
-            get_type(TCP_HEADER, tcp_header->src_port),
-            get_type(TCP_HEADER, tcp_header->dst_port),
-            ntohl(tcp_header->seq),
-            ack,
-            ack_flag ? "Yes" : "No",
-            flags & (0x02) ? "Yes" : "No",
-            flags & (0x04) ? "Yes" : "No",
-            flags & (0x01) ? "Yes" : "No",
-            ntohs(tcp_header->win_size),
-            verify, ntohs(tcp_header->cksum)
-    );
+    OB_LIT(out, "\n\t\tSYN Flag: ");
+    ob_str(out, flags & (0x02) ? "Yes" : "No");
+    OB_LIT(out, "\n\t\tRST Flag: ");
+    ob_str(out, flags & (0x04) ? "Yes" : "No");
+    OB_LIT(out, "\n\t\tFIN Flag: ");
+    ob_str(out, flags & (0x01) ? "Yes" : "No");
+    OB_LIT(out, "\n\t\tWindow Size: ");
+    ob_dec(out, ntohs(tcp_header->win_size));
+
+    if (info->tcp_cksum_ok) {
+        OB_LIT(out, "\n\t\tChecksum: Correct (0x");
+    } else {
+        OB_LIT(out, "\n\t\tChecksum: Incorrect (0x");
+    }
+
+    ob_hex(out, ntohs(tcp_header->cksum));
+    OB_LIT(out, ")\n");
+
+    PROF_END();
 }
 
-void process_icmp_h(uint8_t *packet_data) {
+void process_icmp_h(outbuf_t *out, const packet_info_t *info) {
 
-    icmp_header_t *icmp_header = malloc(ICMP_HEADER_LEN);
+    int v6 = info->transport_proto == PROTO_ICMP6;
+    const char *type = v6 ? icmp6_type_name(info->icmp->type) : icmp_type_name(info->icmp->type);
 
-    /* Move data into a struct */
-    memcpy(icmp_header, packet_data, ICMP_HEADER_LEN);
+    PROF_BEGIN(PROF_ICMP);
 
     /* Display data */
-    printf(
-            "\n"
-            "\tICMP Header\n"
-            "\t\tType: %s\n",
-            get_type(ICMP_HEADER, icmp_header->type)
-    );
+    if (v6) {
+        OB_LIT(out, "\n\tICMPv6 Header\n\t\tType: ");
+    } else {
+        OB_LIT(out, "\n\tICMP Header\n\t\tType: ");
+    }
+
+    if (type != NULL) {
+        ob_str(out, type);
+    } else {
+        ob_dec(out, info->icmp->type);
+    }
+
+    OB_LIT(out, "\n");
 
+    PROF_END();
 }
 
-void process_udp_h(uint8_t *packet_data) {
+void process_udp_h(outbuf_t *out, const packet_info_t *info) {
 
-    udp_header_t *udp_header = malloc(UDP_HEADER_LEN);
+    const udp_header_t *udp_header = info->udp;
 
-    /* Move data to struct */
-    memcpy(udp_header, packet_data, UDP_HEADER_LEN);
+    PROF_BEGIN(PROF_UDP);
 
     /* Print data */
-    printf(
-            "\n"
-            "\tUDP Header\n"
-            "\t\tSource Port: : %u\n"
-            "\t\tDest Port: : %u\n",
-            ntohs(udp_header->src_port),
-            ntohs(udp_header->dst_port)
-    );
+    OB_LIT(out, "\n\tUDP Header\n\t\tSource Port: : ");
+    ob_dec(out, ntohs(udp_header->src_port));
+    OB_LIT(out, "\n\t\tDest Port: : ");
+    ob_dec(out, ntohs(udp_header->dst_port));
+    OB_LIT(out, "\n");
 
+    PROF_END();
 }
@@ -2,31 +2,45 @@
 #ifndef PROJECT_1_TRACE_H
 #define PROJECT_1_TRACE_H
 
-/* Needed due to M1 Mac */
-#if __APPLE__
-
-#include <net/ethernet.h>
-
-#else
-#include <netinet/ether.h>
-#endif
-
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <signal.h>
 #include <pcap/pcap.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
+#include <unistd.h>
+#include <getopt.h>
 
 #include "libs/checksum.h"
+#include "libs/outbuf.h"
+#include "reader.h"
+#include "parallel.h"
+#include "stats.h"
+#include "flows.h"
+#include "filter.h"
+#include "export.h"
+#include "proto.h"
+#include "http.h"
+#include "stream.h"
+#include "index.h"
+#include "top.h"
+#include "writer.h"
+#include "prof.h"
+
+/* Output modes, one per run */
+#define MODE_PRINT 0
+#define MODE_STATS 1
+#define MODE_FLOWS 2
+#define MODE_COUNTERS 3
+#define MODE_HTTP 4
+#define MODE_TOP 5
+#define MODE_TIMELINE 6
 
-#define ETH_HEADER  1
-#define ARP_HEADER  2
-#define IPV4_HEADER 3
-#define TCP_HEADER  4
-#define ICMP_HEADER 5
 
 #define PCAP_HEADER_LEN   sizeof(pcap_header_t   )
+#define PACKET_HEADER_LEN sizeof(packet_header_t )
 #define ETH_HEADER_LEN    sizeof(eth_header_t    )
 #define ARP_HEADER_LEN    sizeof(arp_header_t    )
 #define IPV4_HEADER_LEN   sizeof(ip_v4_header_t  )
@@ -34,6 +48,14 @@
 #define ICMP_HEADER_LEN   sizeof(icmp_header_t   )
 #define UDP_HEADER_LEN    sizeof(udp_header_t    )
 #define PSEUDO_HEADER_LEN sizeof(pseudo_header_t )
+#define VLAN_HEADER_LEN   sizeof(vlan_header_t   )
+#define IPV6_HEADER_LEN   sizeof(ip_v6_header_t  )
+
+/* 802.1Q tags read per frame, two covers 802.1ad (QinQ) */
+#define VLAN_MAX_TAGS 2
+
+/* IPv6 extension headers walked before giving up on finding the payload */
+#define IPV6_MAX_EXT 8
 
 /* 24 bytes (192 bits) */
 typedef struct __attribute__((packed)) pcap_header {    /* Offset */
@@ -74,6 +96,12 @@ typedef struct __attribute__((packed)) arp_header {     /* Offset */
     uint32_t TPA;                                       /*    192 */
 } arp_header_t;
 
+/* 4 bytes (32 bits), sits between the MAC addresses and the real type */
+typedef struct __attribute__((packed)) vlan_header {    /* Offset */
+    uint16_t TCI;                                       /*      0 */
+    uint16_t type;                                      /*     16 */
+} vlan_header_t;
+
 /* 20 bytes (160 bits) */
 typedef struct __attribute__((packed)) ip_v4_header {   /* Offset */
     uint8_t Ver_IHL;                                    /*    0/4 */
@@ -100,6 +128,16 @@ typedef struct __attribute__((packed)) tcp_header {     /* Offset */
     uint16_t urg_ptr;                                   /*    144 */
 } tcp_header_t;
 
+/* 40 bytes (320 bits) */
+typedef struct __attribute__((packed)) ip_v6_header {   /* Offset */
+    uint32_t Ver_TC_Flow;                               /*  0/4/12 */
+    uint16_t payload_len;                               /*     32 */
+    uint8_t next_header;                                /*     48 */
+    uint8_t hop_limit;                                  /*     56 */
+    uint8_t src_addr[16];                               /*     64 */
+    uint8_t dst_addr[16];                               /*    192 */
+} ip_v6_header_t;
+
 /* 12 bytes (96 bits) */
 typedef struct __attribute__((packed)) pseudo_header {  /* Offset */
     uint32_t src_addr;                                  /*      0 */
@@ -124,20 +162,67 @@ typedef struct __attribute__((packed)) udp_header {     /* Offset */
     uint16_t cksum;                                     /*     48 */
 } udp_header_t;
 
-char *iptostr(uint32_t ip_addr);
+/* Headers found in one packet, pointing into its data. NULL if absent or cut short */
+typedef struct packet_info {
+    const packet_t *pkt;
+    const eth_header_t *eth;
+    const vlan_header_t *vlan[VLAN_MAX_TAGS];
+    const arp_header_t *arp;
+    const ip_v4_header_t *ip;
+    const ip_v6_header_t *ip6;
+    const tcp_header_t *tcp;
+    const udp_header_t *udp;
+    const icmp_header_t *icmp;
+    uint8_t num_vlans;
+
+    /* For IPv6 the header length includes extension headers and ip_len the fixed header */
+    uint16_t ip_header_len;
+    uint16_t ip_len;
+
+    /* IPv4 protocol, or the IPv6 next header after the extension headers */
+    uint8_t ip_proto;
+    uint8_t ip_cksum_ok;
+    uint8_t tcp_cksum_ok;
+    uint8_t udp_cksum_ok;
+    uint8_t icmp_cksum_ok;
+
+    /* Index into protos[] of the headers found after Ethernet and after IP, or PROTO_UNKNOWN */
+    uint8_t net_proto;
+    uint8_t transport_proto;
+} packet_info_t;
+
+void dissect_packet(const packet_t *pkt, packet_info_t *info);
+
+/* Per-layer dissectors registered in protos[] */
+void dissect_arp(packet_info_t *info, const uint8_t *packet_data, uint32_t avail);
+
+void dissect_vlan(packet_info_t *info, const uint8_t *packet_data, uint32_t avail);
+
+void dissect_ip(packet_info_t *info, const uint8_t *packet_data, uint32_t avail);
+
+void dissect_ip6(packet_info_t *info, const uint8_t *packet_data, uint32_t avail);
+
+void dissect_icmp(packet_info_t *info, const uint8_t *packet_data, uint32_t avail);
+
+void dissect_tcp(packet_info_t *info, const uint8_t *packet_data, uint32_t avail);
+
+void dissect_udp(packet_info_t *info, const uint8_t *packet_data, uint32_t avail);
+
+/* Prints one packet, matches packet_fn_t so it can run on the -j workers */
+void print_packet(void *arg, int worker, outbuf_t *out, uint32_t pkt_num, const packet_t *pkt);
 
-char *get_type(uint8_t protocol, uint16_t type);
+void process_eth_h(outbuf_t *out, const packet_info_t *info);
 
-void process_eth_h(uint8_t *packet_data);
+void process_arp_h(outbuf_t *out, const packet_info_t *info);
 
-void process_arp_h(uint8_t *packet_data);
+void process_ip_h(outbuf_t *out, const packet_info_t *info);
 
-void process_ip_h(uint8_t *packet_data);
+void process_ip6_h(outbuf_t *out, const packet_info_t *info);
 
-void process_tcp_h(uint8_t *packet_data, pseudo_header_t *pseudo_header);
+void process_tcp_h(outbuf_t *out, const packet_info_t *info);
 
-void process_icmp_h(uint8_t *packet_data);
+void process_icmp_h(outbuf_t *out, const packet_info_t *info);
 
-void process_udp_h(uint8_t *packet_data);
+void process_udp_h(outbuf_t *out, const packet_info_t *info);
 
 #endif /* PROJECT_1_TRACE_H */
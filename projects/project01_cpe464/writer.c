@@ -0,0 +1,490 @@
+#include <fcntl.h>
+
+#include "trace.h"
+
+/* 64-bit multipliers from splitmix64, built up this way to stay valid C89 */
+#define MIX1 ((uint64_t) 0x9e3779b9 << 32 | 0x7f4a7c15)
+#define MIX2 ((uint64_t) 0xbf58476d << 32 | 0x1ce4e5b9)
+
+/* Conversations the SPLIT_FLOW table starts with room for, it doubles from there */
+#define WRITER_MIN_FLOWS 1024
+
+static uint32_t swap32(uint32_t val) {
+    return (val >> 24) | ((val >> 8) & 0xff00) | ((val << 8) & 0xff0000) | (val << 24);
+}
+
+/* The frame's bytes and lengths, but not its timestamp, a repeat is the same frame seen again */
+static uint64_t frame_hash(const packet_t *pkt) {
+
+    const uint8_t *p = pkt->data, *end = pkt->data + pkt->caplen;
+    uint64_t h = ((uint64_t) pkt->caplen << 32 | pkt->len) * MIX1, word;
+
+    for (; end - p >= 8; p += 8) {
+        memcpy(&word, p, 8);
+        h = (h ^ word) * MIX1;
+        h ^= h >> 32;
+    }
+
+    word = 0;
+    memcpy(&word, p, (size_t) (end - p));
+
+    h = (h ^ word) * MIX2;
+
+    return h ^ h >> 31;
+}
+
+static void dedupe_init(dedupe_t *d, uint32_t window) {
+
+    uint32_t size = 2;
+
+    memset(d, 0, sizeof(dedupe_t));
+
+    if (window == 0) return;
+
+    while (size < window * 2) size *= 2;
+
+    d->ring = malloc(window * sizeof(uint64_t));
+    d->index = malloc(size * sizeof(uint32_t));
+
+    if (d->ring == NULL || d->index == NULL) {
+        perror("malloc");
+        exit(1);
+    }
+
+    memset(d->index, 0xff, size * sizeof(uint32_t));
+
+    d->window = window;
+    d->mask = size - 1;
+}
+
+/* Empties slot i, moving back any later hash in the run that would be lost behind the hole */
+static void dedupe_remove(dedupe_t *d, uint32_t i) {
+
+    uint32_t j = i, home;
+
+    for (;;) {
+
+        j = (j + 1) & d->mask;
+
+        if (d->index[j] == WRITER_NONE) break;
+
+        home = (uint32_t) d->ring[d->index[j]] & d->mask;
+
+        if (((j - home) & d->mask) >= ((j - i) & d->mask)) {
+            d->index[i] = d->index[j];
+            i = j;
+        }
+    }
+
+    d->index[i] = WRITER_NONE;
+}
+
+/* True if the frame is one of the last window let through, otherwise it's remembered in place of the oldest */
+static int dedupe_seen(dedupe_t *d, uint64_t hash) {
+
+    uint32_t i;
+
+    for (i = (uint32_t) hash & d->mask; d->index[i] != WRITER_NONE; i = (i + 1) & d->mask) {
+        if (d->ring[d->index[i]] == hash) return 1;
+    }
+
+    if (d->count == d->window) {
+
+        for (i = (uint32_t) d->ring[d->head] & d->mask; d->index[i] != d->head; i = (i + 1) & d->mask);
+
+        dedupe_remove(d, i);
+
+    } else {
+        d->count++;
+    }
+
+    /* The removal may have opened up a slot earlier in the run */
+    for (i = (uint32_t) hash & d->mask; d->index[i] != WRITER_NONE; i = (i + 1) & d->mask);
+
+    d->index[i] = d->head;
+    d->ring[d->head] = hash;
+    d->head = (d->head + 1) % d->window;
+
+    return 0;
+}
+
+/* Puts file num's name in w->name, "out.pcap" becomes "out-00001.pcap" when splitting */
+static void file_name(writer_t *w, uint32_t num) {
+
+    const char *ext = strrchr(w->path, '.'), *slash = strrchr(w->path, '/');
+
+    if (w->split == SPLIT_NONE) {
+        strcpy(w->name, w->path);
+        return;
+    }
+
+    /* Only a dot inside the last part that isn't its first character starts an extension */
+    if (ext == NULL || ext == w->path || (slash != NULL && ext <= slash + 1)) {
+        ext = w->path + strlen(w->path);
+    }
+
+    sprintf(w->name, "%.*s-%05u%s", (int) (ext - w->path), w->path, num, ext);
+}
+
+/* Everything held from the mapping goes out, into the buffer if it's short */
+static void write_run(cap_file_t *file) {
+
+    if (file->run_len == 0) return;
+
+    ob_write(&file->ob, (const char *) file->run, file->run_len);
+
+    file->run = NULL;
+    file->run_len = 0;
+}
+
+static void file_close(writer_t *w, uint32_t num) {
+
+    cap_file_t *file = &w->files[num];
+    uint32_t i;
+
+    if (file->fd < 0) return;
+
+    write_run(file);
+    ob_free(&file->ob);
+
+    if (close(file->fd)) {
+        file_name(w, num);
+        fprintf(stderr, "%s: %s\n", w->name, strerror(errno));
+        exit(1);
+    }
+
+    file->fd = -1;
+
+    for (i = 0; i < w->num_open; i++) {
+        if (w->open[i] == num) {
+            w->open[i] = w->open[--w->num_open];
+            break;
+        }
+    }
+}
+
+/* File num, created if it's the next one, reopened to append if it was closed. NULL with errno set if it can't be */
+static cap_file_t *file_open(writer_t *w, uint32_t num) {
+
+    cap_file_t *file;
+    uint32_t i, lru = 0;
+
+    if (num < w->num_files && w->files[num].fd >= 0) return &w->files[num];
+
+    if (num == w->num_files) {
+
+        if (w->num_files == w->max_files) {
+
+            w->max_files = w->max_files ? w->max_files * 2 : 16;
+            w->files = realloc(w->files, w->max_files * sizeof(cap_file_t));
+
+            if (w->files == NULL) {
+                perror("realloc");
+                exit(1);
+            }
+        }
+
+        memset(&w->files[num], 0, sizeof(cap_file_t));
+        w->files[num].fd = -1;
+        w->num_files++;
+    }
+
+    if (w->num_open == WRITER_MAX_OPEN) {
+
+        for (i = 1; i < w->num_open; i++) {
+            if (w->files[w->open[i]].used < w->files[w->open[lru]].used) lru = i;
+        }
+
+        file_close(w, w->open[lru]);
+    }
+
+    file = &w->files[num];
+    file_name(w, num);
+
+    file->fd = open(w->name, O_WRONLY | (file->started ? O_APPEND : O_CREAT | O_TRUNC), 0644);
+
+    if (file->fd < 0) return NULL;
+
+    ob_init(&file->ob, file->fd, WRITER_BUF_SIZE);
+    w->open[w->num_open++] = num;
+
+    return file;
+}
+
+/* file_open() for files past the first, anything going wrong by then ends the run */
+static cap_file_t *file_use(writer_t *w, uint32_t num) {
+
+    cap_file_t *file = file_open(w, num);
+
+    if (file == NULL) {
+        fprintf(stderr, "%s: %s\n", w->name, strerror(errno));
+        exit(1);
+    }
+
+    return file;
+}
+
+/* The file header, in the input's byte order and time resolution when the records are copied as they are */
+static void file_start(writer_t *w, cap_file_t *file) {
+
+    const reader_t *r = w->reader;
+    pcap_header_t header;
+    uint32_t snaplen = r->snaplen, linktype = r->linktype;
+
+    if (r->kind == READER_PCAPNG && r->num_ifaces > 0) {
+        snaplen = r->ifaces[0].snaplen;
+        linktype = r->ifaces[0].linktype;
+    } else if (r->kind == READER_PCAP || r->kind == READER_LIVE) {
+        linktype = WRITER_LINKTYPE;
+    }
+
+    header.magic = !w->direct || r->nsec ? PCAP_MAGIC_NSEC : PCAP_MAGIC_USEC;
+    header.version_major = 2;
+    header.version_minor = 4;
+    header.thiszone = 0;
+    header.sigfigs = 0;
+    header.snaplen = snaplen ? snaplen : WRITER_SNAPLEN;
+    header.linktype = linktype;
+
+    if (w->direct && r->swapped) {
+        header.magic = swap32(header.magic);
+        header.version_major = (uint16_t) (header.version_major << 8);
+        header.version_minor = (uint16_t) (header.version_minor << 8);
+        header.snaplen = swap32(header.snaplen);
+        header.linktype = swap32(header.linktype);
+    }
+
+    ob_write(&file->ob, (const char *) &header, PCAP_HEADER_LEN);
+
+    file->size += PCAP_HEADER_LEN;
+    file->started = 1;
+}
+
+/* The current file is done, the next one is created */
+static void next_file(writer_t *w) {
+    file_close(w, w->cur);
+    file_use(w, ++w->cur);
+}
+
+static void grow_flows(writer_t *w) {
+
+    writer_flow_t *old = w->flows;
+    uint32_t old_size = old != NULL ? w->flow_mask + 1 : 0, size = old != NULL ? old_size * 2 : WRITER_MIN_FLOWS, i, j;
+
+    w->flows = malloc(size * sizeof(writer_flow_t));
+
+    if (w->flows == NULL) {
+        perror("malloc");
+        exit(1);
+    }
+
+    memset(w->flows, 0xff, size * sizeof(writer_flow_t));
+    w->flow_mask = size - 1;
+
+    for (i = 0; i < old_size; i++) {
+
+        if (old[i].file == WRITER_NONE) continue;
+
+        for (j = flow_hash(&old[i].key) & w->flow_mask; w->flows[j].file != WRITER_NONE; j = (j + 1) & w->flow_mask);
+
+        w->flows[j] = old[i];
+    }
+
+    free(old);
+}
+
+/* The conversation's file, a new one is handed out the first time it's seen */
+static uint32_t flow_file(writer_t *w, const flow_key_t *key) {
+
+    writer_flow_t *flow;
+    uint32_t i;
+
+    if (w->flows == NULL || w->num_flows * 2 >= w->flow_mask + 1) grow_flows(w);
+
+    for (i = flow_hash(key) & w->flow_mask; ; i = (i + 1) & w->flow_mask) {
+
+        flow = &w->flows[i];
+
+        if (flow->file == WRITER_NONE) {
+            flow->key = *key;
+            flow->file = w->cur++;
+            w->num_flows++;
+            return flow->file;
+        }
+
+        if (memcmp(&flow->key, key, sizeof(flow_key_t)) == 0) return flow->file;
+    }
+}
+
+/* Which file the packet goes to, moving on to the next one when the time or size is up */
+static uint32_t pick_file(writer_t *w, const packet_t *pkt) {
+
+    const cap_file_t *file;
+    packet_info_t info;
+    flow_key_t key;
+    uint64_t bucket;
+
+    switch (w->split) {
+        case SPLIT_TIME:
+            file = &w->files[w->cur];
+            bucket = ((uint64_t) pkt->ts_sec * 1000000000 + pkt->ts_nsec) / w->split_arg;
+
+            if (file->started && bucket != w->bucket) next_file(w);
+
+            w->bucket = bucket;
+            return w->cur;
+
+        case SPLIT_SIZE:
+            file = &w->files[w->cur];
+
+            if (file->started && file->size + PACKET_HEADER_LEN + pkt->caplen > w->split_arg) next_file(w);
+
+            return w->cur;
+
+        case SPLIT_FLOW:
+            dissect_packet(pkt, &info);
+
+            if (flow_key(&key, &info)) {
+                if (w->other == WRITER_NONE) w->other = w->cur++;
+                return w->other;
+            }
+
+            flow_conversation(&key);
+            return flow_file(w, &key);
+
+        default:
+            return w->cur;
+    }
+}
+
+static void writer_free(writer_t *w) {
+
+    free(w->files);
+    free(w->flows);
+    free(w->name);
+    free(w->dedupe.ring);
+    free(w->dedupe.index);
+
+    w->files = NULL;
+    w->flows = NULL;
+    w->name = NULL;
+    w->dedupe.ring = NULL;
+    w->dedupe.index = NULL;
+}
+
+int writer_open(writer_t *w, reader_t *reader, const char *path, int split, uint64_t split_arg,
+                uint32_t dedupe, packet_fn_t fn, void *arg, char *errbuf, size_t errlen) {
+
+    memset(w, 0, sizeof(writer_t));
+
+    w->reader = reader;
+    w->direct = reader->kind == READER_MMAP && reader->zs == NULL;
+    w->path = path;
+    w->split = split;
+    w->split_arg = split_arg;
+    w->other = WRITER_NONE;
+    w->fn = fn;
+    w->arg = arg;
+
+    dedupe_init(&w->dedupe, dedupe);
+
+    if (path == NULL) return 0;
+
+    w->name = malloc(strlen(path) + 16);
+
+    if (w->name == NULL) {
+        perror("malloc");
+        exit(1);
+    }
+
+    /* Created up front so a bad path is caught before anything is read, it's the first flow's with SPLIT_FLOW */
+    if (file_open(w, 0) == NULL) {
+        snprintf(errbuf, errlen, "%s", strerror(errno));
+        writer_free(w);
+        return -1;
+    }
+
+    return 0;
+}
+
+void writer_packet(void *arg, int worker, outbuf_t *out, uint32_t pkt_num, const packet_t *pkt) {
+
+    writer_t *w = (writer_t *) arg;
+    cap_file_t *file;
+    packet_header_t header;
+    const uint8_t *record = pkt->data - PACKET_HEADER_LEN;
+    size_t len = PACKET_HEADER_LEN + pkt->caplen;
+    uint32_t i;
+
+    if (w->dedupe.window && dedupe_seen(&w->dedupe, frame_hash(pkt))) {
+        w->duplicates++;
+        return;
+    }
+
+    if (w->path != NULL) {
+
+        file = file_use(w, pick_file(w, pkt));
+
+        if (!file->started) file_start(w, file);
+
+        file->used = ++w->tick;
+        file->size += len;
+        w->packets++;
+        w->bytes += len;
+
+        if (w->direct) {
+
+            /* Back to back with the run held so far, it only gets longer */
+            if (file->run_len > 0 && file->run + file->run_len != record) write_run(file);
+
+            if (file->run_len == 0) file->run = record;
+
+            file->run_len += len;
+
+        } else {
+
+            header.t_sec = pkt->ts_sec;
+            header.t_usec = pkt->ts_nsec;
+            header.cap_len = pkt->caplen;
+            header.org_len = pkt->len;
+
+            ob_write(&file->ob, (const char *) &header, PACKET_HEADER_LEN);
+            ob_write(&file->ob, (const char *) pkt->data, pkt->caplen);
+        }
+    }
+
+    if (w->fn != NULL) w->fn(w->arg, worker, out, pkt_num, pkt);
+
+    /* What's held points into the mapping, so it has to be out before the mapping moves on */
+    if (w->direct && !reader_keeps_map(w->reader)) {
+        for (i = 0; i < w->num_open; i++) write_run(&w->files[w->open[i]]);
+    }
+}
+
+void writer_close(writer_t *w) {
+
+    uint32_t i;
+
+    for (i = 0; i < w->num_files; i++) {
+
+        /* Nothing went to it, it's still a valid capture */
+        if (!w->files[i].started) file_start(w, file_use(w, i));
+
+        file_close(w, i);
+    }
+
+    writer_free(w);
+}
+
+void writer_report(const writer_t *w, outbuf_t *out) {
+
+    OB_LIT(out, "\tWritten\n\t\tPackets: ");
+    ob_dec64(out, w->packets);
+    OB_LIT(out, "\n\t\tBytes: ");
+    ob_dec64(out, w->bytes);
+    OB_LIT(out, "\n\t\tFiles: ");
+    ob_dec(out, w->num_files);
+    OB_LIT(out, "\n\t\tDuplicates: ");
+    ob_dec64(out, w->duplicates);
+    ob_char(out, '\n');
+}
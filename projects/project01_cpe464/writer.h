@@ -0,0 +1,136 @@
+#ifndef PROJECT_1_WRITER_H
+#define PROJECT_1_WRITER_H
+
+#include <stdint.h>
+
+#include "libs/outbuf.h"
+#include "reader.h"
+#include "flows.h"
+#include "parallel.h"
+
+/*
+ * --write, the packets that get through go out to classic pcap captures of
+ * their own. A classic capture read natively has its records written straight
+ * from the mapping, a run of back to back records at a time. Anything else
+ * gets a record header made up for it and is copied into the file's buffer.
+ */
+
+/* Buffer per open file, runs from the mapping at least this long skip it and go straight out */
+#define WRITER_BUF_SIZE (256 << 10)
+
+/* Files open at once when splitting by flow, the least recently used one is closed to make room */
+#define WRITER_MAX_OPEN 64
+
+/* Snapshot length written out when the input doesn't give one */
+#define WRITER_SNAPLEN 262144
+
+/* Link type written out when the input doesn't give one, Ethernet is all that gets dissected anyway */
+#define WRITER_LINKTYPE 1
+
+/* Frames --dedupe compares each one against, unless it's given a window */
+#define DEDUPE_DEFAULT_WINDOW 4096
+
+#define SPLIT_NONE 0
+#define SPLIT_TIME 1
+#define SPLIT_SIZE 2
+#define SPLIT_FLOW 3
+
+#define WRITER_NONE UINT32_MAX
+
+typedef struct cap_file {
+
+    /* -1 while it's closed */
+    int fd;
+
+    /* The file header has been written */
+    int started;
+    uint64_t size;
+
+    /* Tick of the last packet written to it, for closing the least recently used */
+    uint64_t used;
+
+    /* Copied records, only allocated while the file is open */
+    outbuf_t ob;
+
+    /* Back to back records in the mapping, not written out yet */
+    const uint8_t *run;
+    size_t run_len;
+} cap_file_t;
+
+/* The file each conversation's packets go to with SPLIT_FLOW */
+typedef struct writer_flow {
+    flow_key_t key;
+    uint32_t file;
+} writer_flow_t;
+
+/* Hashes of the last window frames let through, so a repeat of any of them can be dropped */
+typedef struct dedupe {
+    uint64_t *ring;
+    uint32_t window;
+    uint32_t head;
+    uint32_t count;
+
+    /* Open addressing on the hash, ring positions or WRITER_NONE */
+    uint32_t *index;
+    uint32_t mask;
+} dedupe_t;
+
+typedef struct writer {
+    reader_t *reader;
+
+    /* Records are written straight from the mapping, in the input's own byte order */
+    int direct;
+
+    /* NULL to only dedupe, with split the file number goes in before the extension */
+    const char *path;
+    char *name;
+
+    int split;
+
+    /* Nanoseconds per file for SPLIT_TIME, bytes per file for SPLIT_SIZE */
+    uint64_t split_arg;
+    uint64_t bucket;
+
+    cap_file_t *files;
+    uint32_t num_files;
+    uint32_t max_files;
+    uint32_t cur;
+
+    uint32_t open[WRITER_MAX_OPEN];
+    uint32_t num_open;
+    uint64_t tick;
+
+    /* SPLIT_FLOW, conversations and their files. Packets without IP share one file */
+    writer_flow_t *flows;
+    uint32_t flow_mask;
+    uint32_t num_flows;
+    uint32_t other;
+
+    dedupe_t dedupe;
+
+    /* Next stage, NULL if the packets are only written */
+    packet_fn_t fn;
+    void *arg;
+
+    uint64_t packets;
+    uint64_t bytes;
+    uint64_t duplicates;
+} writer_t;
+
+/*
+ * Writes to path, or only dedupes if it's NULL, against the last dedupe frames
+ * if that isn't 0. Packets that are let through go on to fn, unless it's NULL.
+ * Returns 0, or -1 with the reason in errbuf if the first file can't be created.
+ */
+int writer_open(writer_t *w, reader_t *reader, const char *path, int split, uint64_t split_arg,
+                uint32_t dedupe, packet_fn_t fn, void *arg, char *errbuf, size_t errlen);
+
+/* packet_fn_t that drops repeats, writes the packet out and passes it on. Serial only */
+void writer_packet(void *arg, int worker, outbuf_t *out, uint32_t pkt_num, const packet_t *pkt);
+
+/* Writes out everything still held and closes every file */
+void writer_close(writer_t *w);
+
+void writer_report(const writer_t *w, outbuf_t *out);
+
+#endif /* PROJECT_1_WRITER_H */
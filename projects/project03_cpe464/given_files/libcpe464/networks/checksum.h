@@ -15,6 +15,44 @@ extern "C" {
 
 unsigned short in_cksum(unsigned short *addr, int len);
 
+/*
+ * in_cksum() picks an SSE2 or AVX2 kernel at startup when the CPU has them.
+ * in_cksum_scalar() is the original one-word-at-a-time version and always
+ * returns the same result.
+ */
+unsigned short in_cksum_scalar(unsigned short *addr, int len);
+
+#if defined(__x86_64__) || defined(__i386__)
+unsigned short in_cksum_sse2(unsigned short *addr, int len);
+
+unsigned short in_cksum_avx2(unsigned short *addr, int len);
+#endif
+
+/* Name of the kernel in_cksum() dispatches to ("scalar", "sse2" or "avx2") */
+const char *in_cksum_kernel(void);
+
+/*
+ * RFC 1624 incremental updates, for when a few words of an already
+ * checksummed buffer change. Words are taken as they sit in memory, the
+ * same way in_cksum() reads them.
+ */
+unsigned short in_cksum_update(unsigned short cksum, unsigned short old_word, unsigned short new_word);
+
+unsigned short in_cksum_update32(unsigned short cksum, unsigned int old_val, unsigned int new_val);
+
+/*
+ * Partial sums, for checksumming a PDU in pieces or while copying it. Start
+ * from a sum of 0, add pieces in order and finish with in_cksum_fold(). A
+ * piece that starts on an odd byte of the PDU goes through in_cksum_block_add().
+ */
+unsigned int in_cksum_partial(const void *buf, int len, unsigned int sum);
+
+unsigned int in_cksum_partial_copy(void *dst, const void *src, int len, unsigned int sum);
+
+unsigned int in_cksum_block_add(unsigned int sum, unsigned int sum2, int offset);
+
+unsigned short in_cksum_fold(unsigned int sum);
+
 #ifdef __cplusplus
 }
 #endif
@@ -98,7 +98,8 @@ packet_t *initPacket(void) {
 
 size_t buildPacket(packet_t *packet, uint32_t seqNum, uint8_t flag, uint8_t *data, size_t dataLen) {
 
-    uint16_t checksum, pduLen = PDU_HEADER_LEN + dataLen;
+    uint16_t pduLen = PDU_HEADER_LEN + dataLen;
+    unsigned int sum;
 
     /* Check inputs */
     if (packet == NULL) {
@@ -121,21 +122,60 @@ size_t buildPacket(packet_t *packet, uint32_t seqNum, uint8_t flag, uint8_t *dat
     /* Add in the flag (1 byte) */
     packet->flag = flag;
 
-    /* Clear old data */
-    memset(packet->payload, 0, MAX_PAYLOAD_LEN);
+    /* Sum the header, its last byte is the first half of a word */
+    sum = in_cksum_partial(packet, PDU_HEADER_LEN, 0);
 
-    /* Add in the payload */
-    memcpy(packet->payload, data, dataLen);
-
-    /* Calculate the payload checksum */
-    checksum = in_cksum((unsigned short *) packet, pduLen);
+    /* Copy in the payload and sum it in the same pass, only the first
+     * pduLen bytes are sent so the rest of the payload is left alone */
+    sum = in_cksum_block_add(sum, in_cksum_partial_copy(packet->payload, data, (int) dataLen, 0), PDU_HEADER_LEN);
 
     /* Put the checksum into the PDU */
-    packet->checksum = checksum;
+    packet->checksum = in_cksum_fold(sum);
 
     return pduLen;
 }
 
+void setPacketSeq(packet_t *packet, uint32_t seqNum) {
+
+    uint32_t seq_NO = htonl(seqNum);
+
+    /* The sequence number is word aligned, so both of its words can be swapped at once */
+    packet->checksum = in_cksum_update32(packet->checksum, packet->seq_NO, seq_NO);
+
+    packet->seq_NO = seq_NO;
+}
+
+void setPacketFlag(packet_t *packet, uint8_t flag) {
+    setPacketBytes(packet, offsetof(packet_t, flag), &flag, sizeof(flag));
+}
+
+void setPacketBytes(packet_t *packet, size_t offset, const void *data, size_t len) {
+
+    uint8_t *pdu = (uint8_t *) packet;
+    const uint8_t *newBytes = (const uint8_t *) data;
+    uint16_t oldWord, newWord;
+    size_t i;
+
+    /* The checksum can't cover itself */
+    if (offset < offsetof(packet_t, checksum) + sizeof(packet->checksum) &&
+        offset + len > offsetof(packet_t, checksum)) {
+        fprintf(stderr, "setPacketBytes() err! Can't overwrite the checksum\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (i = 0; i < len; i++) {
+
+        /* Each byte is either the first or second half of the word in_cksum() adds it in */
+        oldWord = newWord = 0;
+        ((uint8_t *) &oldWord)[(offset + i) & 1] = pdu[offset + i];
+        ((uint8_t *) &newWord)[(offset + i) & 1] = newBytes[i];
+
+        packet->checksum = in_cksum_update(packet->checksum, oldWord, newWord);
+
+        pdu[offset + i] = newBytes[i];
+    }
+}
+
 void freeAddrInfo(addrInfo_t *addrInfo) {
     free(addrInfo->addrInfo);
     free(addrInfo);
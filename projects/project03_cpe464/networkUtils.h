@@ -6,6 +6,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <stddef.h>
 #include <unistd.h>
 
 #include <memory.h>
@@ -69,6 +70,14 @@ packet_t *initPacket(void);
 
 size_t buildPacket(packet_t *packet, uint32_t seqNum, uint8_t flag, uint8_t *data, size_t dataLen);
 
+/* Rewrite fields of a packet made by buildPacket() and patch its checksum
+ * in place instead of recomputing it over the whole PDU */
+void setPacketSeq(packet_t *packet, uint32_t seqNum);
+
+void setPacketFlag(packet_t *packet, uint8_t flag);
+
+void setPacketBytes(packet_t *packet, size_t offset, const void *data, size_t len);
+
 void freeAddrInfo(addrInfo_t *addrInfo);
 
 #endif /* SAFEUTIL_H */
@@ -19,6 +19,8 @@ int udpServerSetup(int port);
 
 void runServerController(int port, float errorRate);
 
+void updateAckPacket(packet_t *ackPacket, uint32_t seqNum, uint8_t flag, uint32_t nextPkt_NO);
+
 int main(int argc, char *argv[]) {
     int port;
     float errorRate;
@@ -230,11 +232,11 @@ void teardown(addrInfo_t *addrInfo, circularQueue_t *queue, pollSet_t *pollSet)
 int runServer(int childSocket, addrInfo_t *clientInfo) {
 
     uint8_t count = 0;
-    uint16_t bufferLen, pktLen;
+    uint16_t bufferLen, pktLen, ackLen;
     uint32_t serverSeq = 0, nextPkt = 0, nextPkt_NO = 0;
 
     FILE *new_fd = NULL;
-    packet_t *packet = NULL, *txPacket = NULL;
+    packet_t *packet = NULL, *txPacket = NULL, *reply = NULL;
     circularQueue_t *packetQueue = NULL;
 
     pollSet_t *pollSet = initPollSet();
@@ -252,9 +254,15 @@ int runServer(int childSocket, addrInfo_t *clientInfo) {
     /* Initialize the data packet struct */
     packet = initPacket();
 
+    /* RRs and SRejs are patched into this PDU instead of being rebuilt from scratch */
+    txPacket = initPacket();
+    ackLen = buildPacket(txPacket, serverSeq, DATA_ACK_PKT, (uint8_t *) &nextPkt_NO, sizeof(nextPkt_NO));
+
     /* Receive file data from client */
     while (1) {
 
+        reply = NULL;
+
         /* Check if the output of the queue has the packet we want */
         if (checkNextSeq_NO(packetQueue, nextPkt_NO)) {
 
@@ -267,6 +275,7 @@ int runServer(int childSocket, addrInfo_t *clientInfo) {
             if (pollCall(pollSet, POLL_10_SEC) == POLL_TIMEOUT) {
                 teardown(clientInfo, packetQueue, pollSet);
                 free(packet);
+                free(txPacket);
                 fclose(new_fd);
                 return 1;
             }
@@ -278,14 +287,16 @@ int runServer(int childSocket, addrInfo_t *clientInfo) {
             if (in_cksum((unsigned short *) packet, pktLen)) {
 
                 /* Selective reject the corrupt packet */
-                buildPacket(packet, serverSeq++, DATA_REJ_PKT, (uint8_t *) &nextPkt_NO, sizeof(nextPkt_NO));
+                updateAckPacket(txPacket, serverSeq++, DATA_REJ_PKT, nextPkt_NO);
+                reply = txPacket;
 
             } else if (ntohl(packet->seq_NO) < nextPkt) {
 
                 /* If it's a lower sequence, reply with an RR for the highest recv'd packet */
                 nextPkt_NO = htonl(nextPkt - 1);
 
-                buildPacket(packet, serverSeq++, DATA_ACK_PKT, (uint8_t *) &nextPkt_NO, sizeof(nextPkt_NO));
+                updateAckPacket(txPacket, serverSeq++, DATA_ACK_PKT, nextPkt_NO);
+                reply = txPacket;
 
             } else if (ntohl(packet->seq_NO) > nextPkt) {
 
@@ -310,25 +321,27 @@ int runServer(int childSocket, addrInfo_t *clientInfo) {
                 }
 
                 /* SRej the missing packet */
-                buildPacket(packet, serverSeq++, DATA_REJ_PKT, (uint8_t *) &nextPkt_NO, sizeof(nextPkt_NO));
+                updateAckPacket(txPacket, serverSeq++, DATA_REJ_PKT, nextPkt_NO);
+                reply = txPacket;
             }
         }
 
         /* Write data and make an RR */
-        if (packet->flag == DATA_PKT) {
+        if (reply == NULL && packet->flag == DATA_PKT) {
 
             /* Write the data to the file */
             fwrite(packet->payload, sizeof(uint8_t), pktLen - PDU_HEADER_LEN, new_fd);
 
             /* Create an ACK packet */
-            buildPacket(packet, serverSeq++, DATA_ACK_PKT, (uint8_t *) &nextPkt_NO, sizeof(nextPkt_NO));
+            updateAckPacket(txPacket, serverSeq++, DATA_ACK_PKT, nextPkt_NO);
+            reply = txPacket;
 
             /* Increment next expected packet sequence */
             nextPkt++;
         }
 
         /* Check for EOF */
-        if (packet->flag == DATA_EOF_PKT) {
+        if (reply == NULL && packet->flag == DATA_EOF_PKT) {
 
             /* Write the last of the data to the file */
             fwrite(packet->payload, sizeof(uint8_t), pktLen - PDU_HEADER_LEN, new_fd);
@@ -344,7 +357,11 @@ int runServer(int childSocket, addrInfo_t *clientInfo) {
         if (!checkNextSeq_NO(packetQueue, nextPkt_NO)) {
 
             /* Send the ACK/SRej/RR */
-            safeSendTo(childSocket, packet, bufferLen + PDU_HEADER_LEN, clientInfo);
+            if (reply != NULL) {
+                safeSendTo(childSocket, reply, ackLen, clientInfo);
+            } else {
+                safeSendTo(childSocket, packet, bufferLen + PDU_HEADER_LEN, clientInfo);
+            }
 
         }
     }
@@ -354,8 +371,6 @@ int runServer(int childSocket, addrInfo_t *clientInfo) {
 
     printf("File transfer has been successfully received!\n");
 
-    txPacket = initPacket();
-
     /* Ack the EOF packet by sending a termination request */
     pktLen = buildPacket(txPacket, serverSeq, TERM_CONN_PKT, NULL, 0);
 
@@ -365,6 +380,7 @@ int runServer(int childSocket, addrInfo_t *clientInfo) {
         if (count > 9) {
             teardown(clientInfo, packetQueue, pollSet);
             free(packet);
+            free(txPacket);
             fclose(new_fd);
             return 1;
         }
@@ -396,6 +412,22 @@ int runServer(int childSocket, addrInfo_t *clientInfo) {
     return 0;
 }
 
+/*!
+ * Turns the server's RR/SRej PDU into the next reply. Only the sequence,
+ * flag and requested packet number change between replies, so the checksum
+ * is patched for those bytes instead of being recomputed.
+ * @param ackPacket - A PDU made by buildPacket() with a 4 byte payload
+ * @param seqNum - The server's sequence number for this reply
+ * @param flag - DATA_ACK_PKT or DATA_REJ_PKT
+ * @param nextPkt_NO - The packet being RRed or SRejed, in network order
+ */
+void updateAckPacket(packet_t *ackPacket, uint32_t seqNum, uint8_t flag, uint32_t nextPkt_NO) {
+
+    setPacketSeq(ackPacket, seqNum);
+    setPacketFlag(ackPacket, flag);
+    setPacketBytes(ackPacket, offsetof(packet_t, payload), &nextPkt_NO, sizeof(nextPkt_NO));
+}
+
 void runServerController(int port, float errorRate) {
 
     int pollSock, childSock, stat, numChildren = 0, i;